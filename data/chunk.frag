@@ -0,0 +1,15 @@
+uniform sampler2D u_tex0;
+varying vec2 v_tex_coord;
+varying float v_tex_index;
+varying float v_light;
+
+// u_tex0 is an atlas of 16x16 tiles, numbered left to right, top to bottom.
+// The tile index is the block id, so only the first 256 block ids can be
+// drawn, see pack_vertex() in src/chunk_mesher.hpp.
+void main()
+{
+	float index = floor(v_tex_index + 0.5);
+	vec2 tile = vec2(mod(index, 16.0), floor(index / 16.0));
+	vec4 color = texture2D(u_tex0, (tile + fract(v_tex_coord)) / 16.0);
+	gl_FragColor = vec4(color.rgb * v_light, color.a);
+}
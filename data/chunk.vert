@@ -0,0 +1,35 @@
+uniform mat4 model_matrix;
+uniform mat4 view_matrix;
+uniform mat4 projection_matrix;
+uniform vec3 u_chunk_offset;
+// cube::packed_vertex read as four unsigned bytes.
+//   x | ao << 6, y | (direction & 3) << 6, z | (direction >> 2) << 6, texture
+attribute vec4 a_packed;
+varying vec2 v_tex_coord;
+varying float v_tex_index;
+varying float v_light;
+
+void main()
+{
+	vec3 position = mod(a_packed.xyz, 64.0);
+	vec3 high_bits = floor(a_packed.xyz / 64.0);
+	float ao = high_bits.x;
+	float direction = high_bits.y + high_bits.z * 4.0;
+
+	// Normal axis is z for front/back, x for right/left and y for top/bottom.
+	float axis = mod(direction, 3.0);
+	if(axis < 0.5) {
+		v_tex_coord = position.xy;
+	} else if(axis < 1.5) {
+		v_tex_coord = position.zy;
+	} else {
+		v_tex_coord = position.xz;
+	}
+	v_tex_index = a_packed.w;
+
+	float face_light = axis < 1.5 ? 0.8 : (direction < 2.5 ? 1.0 : 0.6);
+	v_light = face_light * (0.4 + 0.2 * ao);
+
+	mat4 mvp_matrix = projection_matrix * view_matrix * model_matrix;
+	gl_Position = mvp_matrix * vec4(u_chunk_offset + position, 1.0);
+}
@@ -1,6 +1,6 @@
-uniform vec4 u_color;
+varying vec4 v_color;
 
 void main()
 {
-	gl_FragColor = u_color;
+	gl_FragColor = v_color;
 }
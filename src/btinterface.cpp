@@ -1,10 +1,29 @@
+#include <algorithm>
+#include <cmath>
+
 #include "asserts.hpp"
 #include "btinterface.hpp"
 
 namespace bullet
 {
+	namespace
+	{
+		const btScalar time_step = 1/60.0f;
+		// Terrain is built this many blocks beyond each body, plus however far
+		// the body moves in a step.
+		const btScalar terrain_margin = 1.0f;
+		// Steps a terrain shape is kept after the last body leaves it, so
+		// bodies hovering around a chunk border don't rebuild it repeatedly.
+		const unsigned terrain_keep_steps = 60;
+
+		bool key_less(const std::pair<uint64_t, btRigidBody*>& a, const std::pair<uint64_t, btRigidBody*>& b)
+		{
+			return a.first < b.first;
+		}
+	}
+
 	manager::manager(const node::node& world)
-		: in_use_(true)
+		: in_use_(true), terrain_map_(NULL), terrain_step_(0)
 	{
 		if(world.is_null() || !world.has_key("has_physics") || !world["has_physics"].as_bool()) {
 			std::cerr << "World is empty: Physics disabled" << std::endl;
@@ -63,6 +82,7 @@ namespace bullet
 		if(!in_use_) {
 			return;
 		}
+		set_terrain(NULL);
 		for(int i = 0; i != rigid_bodies_.size(); ++i) {
 			dynamics_world_->removeRigidBody(rigid_bodies_[i].get());
 		}
@@ -71,7 +91,142 @@ namespace bullet
 	int manager::step()
 	{
 		ASSERT_LOG(in_use_, "bullet::manager::step() called when physics not in use.");
-		return dynamics_world_->stepSimulation(1/60.0f,10);
+		if(terrain_map_ != NULL) {
+			update_terrain();
+		}
+		return dynamics_world_->stepSimulation(time_step,10);
+	}
+
+	void manager::set_terrain(const cube::chunk_map* cm)
+	{
+		ASSERT_LOG(in_use_ || cm == NULL, "bullet::manager::set_terrain() called when physics not in use.");
+		while(!terrain_.empty()) {
+			remove_terrain_chunk(terrain_.begin());
+		}
+		terrain_map_ = cm;
+	}
+
+	void manager::update_terrain()
+	{
+		++terrain_step_;
+
+		// Chunks each dynamic body could touch during this step. Sleeping
+		// bodies are included so their support stays put, and is rebuilt
+		// if edited.
+		nearby_.clear();
+		const btCollisionObjectArray& objects = dynamics_world_->getCollisionObjectArray();
+		for(int n = 0; n != objects.size(); ++n) {
+			btRigidBody* body = btRigidBody::upcast(objects[n]);
+			if(body == NULL || body->isStaticOrKinematicObject()) {
+				continue;
+			}
+			btVector3 lo, hi;
+			body->getAabb(lo, hi);
+			const btVector3 reach = body->getLinearVelocity().absolute() * time_step + btVector3(terrain_margin, terrain_margin, terrain_margin);
+			lo -= reach;
+			hi += reach;
+			int c0[3], c1[3];
+			for(int a = 0; a != 3; ++a) {
+				c0[a] = cube::chunk_map::to_chunk(int(std::floor(lo[a])));
+				c1[a] = cube::chunk_map::to_chunk(int(std::floor(hi[a])));
+			}
+			for(int cy = c0[1]; cy <= c1[1]; ++cy) {
+				for(int cz = c0[2]; cz <= c1[2]; ++cz) {
+					for(int cx = c0[0]; cx <= c1[0]; ++cx) {
+						nearby_.push_back(std::make_pair(cube::chunk_map::key(cx, cy, cz), body));
+					}
+				}
+			}
+		}
+
+		// Bodies resting on a shape which changed are woken, so they don't
+		// stay asleep on ground which has gone.
+		std::sort(nearby_.begin(), nearby_.end(), key_less);
+		for(size_t n = 0; n != nearby_.size(); ) {
+			size_t end = n + 1;
+			while(end != nearby_.size() && nearby_[end].first == nearby_[n].first) {
+				++end;
+			}
+			if(update_terrain_chunk(nearby_[n].first)) {
+				for(size_t k = n; k != end; ++k) {
+					nearby_[k].second->activate();
+				}
+			}
+			n = end;
+		}
+
+		// Drop shapes of chunks which have been unloaded or edited since,
+		// and those no body has been near for a while.
+		for(auto it = terrain_.begin(); it != terrain_.end(); ) {
+			auto c = terrain_map_->find(it->first);
+			if(terrain_step_ - it->second.last_used > terrain_keep_steps
+				|| c == terrain_map_->end() || c->second != it->second.source) {
+				auto next = it;
+				++next;
+				remove_terrain_chunk(it);
+				it = next;
+			} else {
+				++it;
+			}
+		}
+	}
+
+	bool manager::update_terrain_chunk(uint64_t key)
+	{
+		auto c = terrain_map_->find(key);
+		cube::const_chunk_ptr current;
+		if(c != terrain_map_->end() && !c->second->is_empty()) {
+			current = c->second;
+		}
+		auto it = terrain_.find(key);
+		if(it != terrain_.end()) {
+			if(it->second.source == current) {
+				it->second.last_used = terrain_step_;
+				return false;
+			}
+			remove_terrain_chunk(it);
+		} else if(!current) {
+			return false;
+		}
+		if(!current) {
+			return true;
+		}
+
+		boxes_.clear();
+		cube::merge_solid_boxes(*current, boxes_);
+		terrain_chunk& t = terrain_[key];
+		t.source = current;
+		t.last_used = terrain_step_;
+		t.shape.reset(new btCompoundShape());
+		for(auto b = boxes_.begin(); b != boxes_.end(); ++b) {
+			const btVector3 center(b->x + b->sx * 0.5f, b->y + b->sy * 0.5f, b->z + b->sz * 0.5f);
+			t.shape->addChildShape(btTransform(btQuaternion(0,0,0,1), center), box_shape(b->sx, b->sy, b->sz));
+		}
+		t.object.reset(new btCollisionObject());
+		t.object->setCollisionShape(t.shape.get());
+		t.object->setWorldTransform(btTransform(btQuaternion(0,0,0,1), btVector3(
+			btScalar(current->cx() * cube::chunk_size),
+			btScalar(current->cy() * cube::chunk_size),
+			btScalar(current->cz() * cube::chunk_size))));
+		// Terrain never needs testing against other static objects.
+		dynamics_world_->addCollisionObject(t.object.get(), btBroadphaseProxy::StaticFilter,
+			btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::StaticFilter);
+		return true;
+	}
+
+	void manager::remove_terrain_chunk(terrain_map::iterator it)
+	{
+		dynamics_world_->removeCollisionObject(it->second.object.get());
+		terrain_.erase(it);
+	}
+
+	btBoxShape* manager::box_shape(int sx, int sy, int sz)
+	{
+		boost::shared_ptr<btBoxShape>& shape = box_shapes_[(sx - 1) | (sy - 1) << cube::chunk_shift | (sz - 1) << (2 * cube::chunk_shift)];
+		if(!shape) {
+			shape.reset(new btBoxShape(btVector3(sx * 0.5f, sy * 0.5f, sz * 0.5f)));
+		}
+		return shape.get();
 	}
 
 	boost::shared_ptr<btRigidBody> manager::get_rigid_body(size_t n)
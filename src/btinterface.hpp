@@ -2,8 +2,11 @@
 
 #include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <btBulletDynamicsCommon.h>
 
+#include "chunk.hpp"
+#include "chunk_mesher.hpp"
 #include "node.hpp"
 
 namespace bullet
@@ -15,7 +18,37 @@ namespace bullet
 		virtual ~manager();
 		int step();
 		boost::shared_ptr<btRigidBody> get_rigid_body(size_t n);
+
+		// Gives each chunk of cm near a dynamic body a static collision shape,
+		// a compound of the boxes from merge_solid_boxes(). Shapes are kept
+		// up to date by step(): built as bodies come near a chunk or it is
+		// paged in, rebuilt when it is edited, and dropped when it is
+		// unloaded or no body has been near it for a while. So the cost
+		// depends on the terrain around the bodies rather than the size of
+		// the world. cm must outlive the manager, NULL removes the terrain.
+		void set_terrain(const cube::chunk_map* cm);
+		size_t terrain_chunks() const { return terrain_.size(); }
 	private:
+		struct terrain_chunk
+		{
+			// The chunk the shape was built from. While it's held here the
+			// chunk_map copies the chunk before writing to it, so an edit
+			// shows up as a different chunk.
+			cube::const_chunk_ptr source;
+			boost::shared_ptr<btCompoundShape> shape;
+			boost::shared_ptr<btCollisionObject> object;
+			// Value of terrain_step_ when a body was last near the chunk.
+			unsigned last_used;
+		};
+		typedef boost::unordered_map<uint64_t, terrain_chunk> terrain_map;
+
+		void update_terrain();
+		// Brings the shape for the chunk up to date, returning true if it
+		// changed.
+		bool update_terrain_chunk(uint64_t key);
+		void remove_terrain_chunk(terrain_map::iterator it);
+		btBoxShape* box_shape(int sx, int sy, int sz);
+
 		bool in_use_;
 
 		boost::shared_ptr<btBroadphaseInterface> broadphase_;
@@ -29,5 +62,14 @@ namespace bullet
 		std::vector<boost::shared_ptr<btRigidBody> > rigid_bodies_;
 
 		std::vector<boost::shared_ptr<btDefaultMotionState> > motion_states_;
+
+		const cube::chunk_map* terrain_map_;
+		// Box shapes of each size, shared between the terrain compounds.
+		boost::unordered_map<int, boost::shared_ptr<btBoxShape> > box_shapes_;
+		terrain_map terrain_;
+		unsigned terrain_step_;
+		// Scratch space for update_terrain().
+		std::vector<std::pair<uint64_t, btRigidBody*> > nearby_;
+		std::vector<cube::block_box> boxes_;
 	};
 }
@@ -0,0 +1,746 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "asserts.hpp"
+#include "chunk.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	const int direction_offset[NUM_DIRECTIONS][3] = {
+		{  0,  0,  1 },		// FRONT
+		{  1,  0,  0 },		// RIGHT
+		{  0,  1,  0 },		// TOP
+		{  0,  0, -1 },		// BACK
+		{ -1,  0,  0 },		// LEFT
+		{  0, -1,  0 },		// BOTTOM
+	};
+
+	namespace
+	{
+		const size_t max_palette_size = 256;
+	}
+
+	chunk::chunk(int cx, int cy, int cz, block_id fill)
+		: cx_(cx), cy_(cy), cz_(cz), uniform_(fill)
+	{
+	}
+
+	chunk::chunk(const chunk& c)
+		: cx_(c.cx_), cy_(c.cy_), cz_(c.cz_), uniform_(c.uniform_),
+		palette_(c.palette_), indices_(c.indices_), blocks_(c.blocks_)
+	{
+	}
+
+	chunk::~chunk()
+	{
+	}
+
+	int chunk::palette_index(block_id b)
+	{
+		auto it = std::find(palette_.begin(), palette_.end(), b);
+		if(it != palette_.end()) {
+			return int(it - palette_.begin());
+		}
+		if(palette_.size() >= max_palette_size) {
+			return -1;
+		}
+		palette_.push_back(b);
+		return int(palette_.size() - 1);
+	}
+
+	void chunk::expand_to_raw()
+	{
+		blocks_.resize(chunk_volume);
+		for(int n = 0; n != chunk_volume; ++n) {
+			blocks_[n] = palette_[indices_[n]];
+		}
+		std::vector<uint8_t>().swap(indices_);
+		std::vector<block_id>().swap(palette_);
+	}
+
+	void chunk::set_index(int n, block_id b)
+	{
+		if(is_uniform()) {
+			if(b == uniform_) {
+				return;
+			}
+			palette_.push_back(uniform_);
+			palette_.push_back(b);
+			indices_.assign(chunk_volume, 0);
+			indices_[n] = 1;
+			return;
+		}
+
+		if(!blocks_.empty()) {
+			blocks_[n] = b;
+			return;
+		}
+
+		int ndx = palette_index(b);
+		if(ndx < 0) {
+			expand_to_raw();
+			blocks_[n] = b;
+		} else {
+			indices_[n] = uint8_t(ndx);
+		}
+	}
+
+	void chunk::fill(block_id b)
+	{
+		uniform_ = b;
+		std::vector<block_id>().swap(palette_);
+		std::vector<uint8_t>().swap(indices_);
+		std::vector<block_id>().swap(blocks_);
+	}
+
+	void chunk::fill_column(int x, int z, int y1, int y2, block_id b)
+	{
+		ASSERT_LOG(y1 >= 0 && y2 <= chunk_size, "chunk::fill_column() range out of bounds: " << y1 << "," << y2);
+		for(int y = y1; y < y2; ++y) {
+			set(x, y, z, b);
+		}
+	}
+
+	void chunk::fill_range(int first, int last, block_id b)
+	{
+		ASSERT_LOG(first >= 0 && first <= last && last <= chunk_volume, "chunk::fill_range() range out of bounds: " << first << "," << last);
+		if(first == last) {
+			return;
+		} else if(first == 0 && last == chunk_volume) {
+			fill(b);
+			return;
+		}
+		// Let set_index() sort out the storage for b, then fill the rest.
+		set_index(first, b);
+		if(!blocks_.empty()) {
+			std::fill(blocks_.begin() + first, blocks_.begin() + last, b);
+		} else if(!indices_.empty()) {
+			std::fill(indices_.begin() + first, indices_.begin() + last, uint8_t(palette_index(b)));
+		}
+	}
+
+	void chunk::get_row(int x, int y, int z, int count, block_id* out) const
+	{
+		ASSERT_LOG(x >= 0 && count >= 0 && x + count <= chunk_size, "chunk::get_row() range out of bounds: " << x << "," << count);
+		const int n = index(x, y, z);
+		if(!blocks_.empty()) {
+			std::copy(blocks_.begin() + n, blocks_.begin() + n + count, out);
+		} else if(!indices_.empty()) {
+			for(int i = 0; i != count; ++i) {
+				out[i] = palette_[indices_[n + i]];
+			}
+		} else {
+			std::fill(out, out + count, uniform_);
+		}
+	}
+
+	void chunk::set_row(int x, int y, int z, int count, const block_id* blocks)
+	{
+		ASSERT_LOG(x >= 0 && count >= 0 && x + count <= chunk_size, "chunk::set_row() range out of bounds: " << x << "," << count);
+		const int n = index(x, y, z);
+		if(!blocks_.empty()) {
+			std::copy(blocks, blocks + count, blocks_.begin() + n);
+			return;
+		}
+		for(int i = 0; i != count; ) {
+			int end = i + 1;
+			while(end != count && blocks[end] == blocks[i]) {
+				++end;
+			}
+			fill_range(n + i, n + end, blocks[i]);
+			i = end;
+		}
+	}
+
+	void chunk::compact()
+	{
+		if(is_uniform()) {
+			return;
+		}
+
+		std::vector<block_id> used;
+		if(!blocks_.empty()) {
+			used = blocks_;
+			std::sort(used.begin(), used.end());
+			used.erase(std::unique(used.begin(), used.end()), used.end());
+		} else {
+			std::vector<bool> seen(palette_.size(), false);
+			for(int n = 0; n != chunk_volume; ++n) {
+				seen[indices_[n]] = true;
+			}
+			for(size_t n = 0; n != palette_.size(); ++n) {
+				if(seen[n]) {
+					used.push_back(palette_[n]);
+				}
+			}
+		}
+
+		if(used.size() == 1) {
+			fill(used.front());
+			return;
+		}
+
+		if(used.size() > max_palette_size) {
+			return;
+		}
+
+		// Re-index against the reduced palette.
+		std::vector<uint8_t> indices(chunk_volume);
+		for(int n = 0; n != chunk_volume; ++n) {
+			block_id b = get_index(n);
+			indices[n] = uint8_t(std::find(used.begin(), used.end(), b) - used.begin());
+		}
+		palette_.swap(used);
+		indices_.swap(indices);
+		std::vector<block_id>().swap(blocks_);
+	}
+
+	size_t chunk::palette_size() const
+	{
+		if(is_uniform()) {
+			return 1;
+		}
+		return palette_.size();
+	}
+
+	size_t chunk::memory_usage() const
+	{
+		return sizeof(chunk)
+			+ palette_.capacity() * sizeof(block_id)
+			+ indices_.capacity() * sizeof(uint8_t)
+			+ blocks_.capacity() * sizeof(block_id);
+	}
+
+	chunk_map::chunk_map()
+	{
+	}
+
+	chunk_map::~chunk_map()
+	{
+	}
+
+	block_id chunk_map::get_block(int x, int y, int z) const
+	{
+		auto it = chunks_.find(key(to_chunk(x), to_chunk(y), to_chunk(z)));
+		if(it == chunks_.end()) {
+			if(!store_) {
+				return empty_block;
+			}
+			chunk_ptr c = get_chunk(to_chunk(x), to_chunk(y), to_chunk(z));
+			return c ? c->get(to_local(x), to_local(y), to_local(z)) : empty_block;
+		}
+		return it->second->get(to_local(x), to_local(y), to_local(z));
+	}
+
+	void chunk_map::set_block(int x, int y, int z, block_id b)
+	{
+		int cx = to_chunk(x), cy = to_chunk(y), cz = to_chunk(z);
+		if(b == empty_block && !get_chunk(cx, cy, cz)) {
+			return;
+		}
+		get_chunk_for_write(cx, cy, cz)->set(to_local(x), to_local(y), to_local(z), b);
+	}
+
+	void chunk_map::fill_row(int x1, int x2, int y, int z, block_id b)
+	{
+		const int cy = to_chunk(y), cz = to_chunk(z);
+		while(x1 < x2) {
+			const int cx = to_chunk(x1);
+			const int end = std::min(x2, (cx + 1) * chunk_size);
+			if(b != empty_block || get_chunk(cx, cy, cz)) {
+				chunk_ptr c = get_chunk_for_write(cx, cy, cz);
+				const int n = chunk::index(to_local(x1), to_local(y), to_local(z));
+				c->fill_range(n, n + end - x1, b);
+			}
+			x1 = end;
+		}
+	}
+
+	void chunk_map::fill_box(const block_box& box, block_id b)
+	{
+		if(box.sx <= 0 || box.sy <= 0 || box.sz <= 0) {
+			return;
+		}
+		const int lo[3] = { box.x, box.y, box.z };
+		const int hi[3] = { box.x + box.sx, box.y + box.sy, box.z + box.sz };
+		for(int cy = to_chunk(lo[1]); cy <= to_chunk(hi[1] - 1); ++cy) {
+			for(int cz = to_chunk(lo[2]); cz <= to_chunk(hi[2] - 1); ++cz) {
+				for(int cx = to_chunk(lo[0]); cx <= to_chunk(hi[0] - 1); ++cx) {
+					if(b == empty_block && !get_chunk(cx, cy, cz)) {
+						continue;
+					}
+					const int c0[3] = { cx * chunk_size, cy * chunk_size, cz * chunk_size };
+					int l1[3], l2[3];
+					for(int a = 0; a != 3; ++a) {
+						l1[a] = std::max(lo[a], c0[a]) - c0[a];
+						l2[a] = std::min(hi[a], c0[a] + chunk_size) - c0[a];
+					}
+					chunk_ptr c = get_chunk_for_write(cx, cy, cz);
+					if(l1[0] == 0 && l2[0] == chunk_size && l1[2] == 0 && l2[2] == chunk_size) {
+						// Whole layers are contiguous.
+						if(l1[1] == 0 && l2[1] == chunk_size) {
+							c->fill(b);
+						} else {
+							c->fill_range(chunk::index(0, l1[1], 0), chunk::index(0, l2[1], 0), b);
+						}
+						continue;
+					}
+					for(int y = l1[1]; y != l2[1]; ++y) {
+						for(int z = l1[2]; z != l2[2]; ++z) {
+							c->fill_range(chunk::index(l1[0], y, z), chunk::index(l1[0], y, z) + l2[0] - l1[0], b);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void chunk_map::fill_sphere(int x, int y, int z, int radius, block_id b)
+	{
+		for(int dy = -radius; dy <= radius; ++dy) {
+			for(int dz = -radius; dz <= radius; ++dz) {
+				const int r2 = radius * radius - dy * dy - dz * dz;
+				if(r2 < 0) {
+					continue;
+				}
+				// Largest w with w * w <= r2.
+				int w = int(std::sqrt(double(r2)));
+				while(w * w > r2) {
+					--w;
+				}
+				while((w + 1) * (w + 1) <= r2) {
+					++w;
+				}
+				fill_row(x - w, x + w + 1, y + dy, z + dz, b);
+			}
+		}
+	}
+
+	void chunk_map::copy_box(const block_box& box, block_volume& out) const
+	{
+		ASSERT_LOG(box.sx >= 0 && box.sy >= 0 && box.sz >= 0, "chunk_map::copy_box() negative size " << box.sx << "," << box.sy << "," << box.sz);
+		out.sx = box.sx;
+		out.sy = box.sy;
+		out.sz = box.sz;
+		out.blocks.resize(size_t(box.sx) * box.sy * box.sz);
+		for(int y = 0; y != box.sy; ++y) {
+			for(int z = 0; z != box.sz; ++z) {
+				const int wy = box.y + y, wz = box.z + z;
+				for(int x = 0; x != box.sx; ) {
+					const int wx = box.x + x;
+					const int count = std::min(box.sx - x, chunk_size - to_local(wx));
+					block_id* dst = &out.blocks[out.index(x, y, z)];
+					chunk_ptr c = get_chunk(to_chunk(wx), to_chunk(wy), to_chunk(wz));
+					if(c) {
+						c->get_row(to_local(wx), to_local(wy), to_local(wz), count, dst);
+					} else {
+						std::fill(dst, dst + count, empty_block);
+					}
+					x += count;
+				}
+			}
+		}
+	}
+
+	void chunk_map::paste(const block_volume& v, int x, int y, int z)
+	{
+		for(int j = 0; j != v.sy; ++j) {
+			for(int k = 0; k != v.sz; ++k) {
+				const int wy = y + j, wz = z + k;
+				for(int i = 0; i != v.sx; ) {
+					const int wx = x + i;
+					const int count = std::min(v.sx - i, chunk_size - to_local(wx));
+					const block_id* src = &v.blocks[v.index(i, j, k)];
+					const int cx = to_chunk(wx), cy = to_chunk(wy), cz = to_chunk(wz);
+					if(get_chunk(cx, cy, cz) || std::count(src, src + count, empty_block) != count) {
+						get_chunk_for_write(cx, cy, cz)->set_row(to_local(wx), to_local(wy), to_local(wz), count, src);
+					}
+					i += count;
+				}
+			}
+		}
+	}
+
+	void chunk_map::page_in(uint64_t k, int cx, int cy, int cz) const
+	{
+		if(store_ && paged_in_.insert(k).second) {
+			chunk_ptr c = store_->load_chunk(cx, cy, cz);
+			if(c) {
+				chunks_[k] = c;
+			}
+		}
+	}
+
+	bool chunk_map::is_paged_in(int cx, int cy, int cz) const
+	{
+		const uint64_t k = key(cx, cy, cz);
+		return !store_ || paged_in_.count(k) != 0 || chunks_.count(k) != 0;
+	}
+
+	void chunk_map::add_paged_in(int cx, int cy, int cz, chunk_ptr c)
+	{
+		const uint64_t k = key(cx, cy, cz);
+		if(store_ && paged_in_.insert(k).second && c && chunks_.count(k) == 0) {
+			chunks_[k] = c;
+		}
+	}
+
+	chunk_ptr chunk_map::get_chunk(int cx, int cy, int cz) const
+	{
+		const uint64_t k = key(cx, cy, cz);
+		auto it = chunks_.find(k);
+		if(it == chunks_.end()) {
+			if(!store_) {
+				return chunk_ptr();
+			}
+			page_in(k, cx, cy, cz);
+			it = chunks_.find(k);
+			if(it == chunks_.end()) {
+				return chunk_ptr();
+			}
+		}
+		return it->second;
+	}
+
+	chunk_ptr chunk_map::get_or_create_chunk(int cx, int cy, int cz)
+	{
+		page_in(key(cx, cy, cz), cx, cy, cz);
+		if(store_) {
+			modified_.insert(key(cx, cy, cz));
+		}
+		chunk_ptr& c = chunks_[key(cx, cy, cz)];
+		if(!c) {
+			c.reset(new chunk(cx, cy, cz));
+		}
+		return c;
+	}
+
+	chunk_ptr chunk_map::get_chunk_for_write(int cx, int cy, int cz)
+	{
+		page_in(key(cx, cy, cz), cx, cy, cz);
+		if(store_) {
+			modified_.insert(key(cx, cy, cz));
+		}
+		chunk_ptr& c = chunks_[key(cx, cy, cz)];
+		if(!c) {
+			c.reset(new chunk(cx, cy, cz));
+		} else if(!c.unique()) {
+			c.reset(c->clone());
+		}
+		return c;
+	}
+
+	void chunk_map::remove_chunk(int cx, int cy, int cz)
+	{
+		if(store_) {
+			paged_in_.insert(key(cx, cy, cz));
+		}
+		chunks_.erase(key(cx, cy, cz));
+	}
+
+	void chunk_map::clear()
+	{
+		chunks_.clear();
+		store_.reset();
+		paged_in_.clear();
+		modified_.clear();
+	}
+
+	bool chunk_map::unload_chunk(int cx, int cy, int cz)
+	{
+		const uint64_t k = key(cx, cy, cz);
+		if(!store_ || modified_.count(k) || chunks_.erase(k) == 0) {
+			return false;
+		}
+		paged_in_.erase(k);
+		return true;
+	}
+
+	void chunk_map::set_store(chunk_source_ptr store)
+	{
+		store_ = store;
+		paged_in_.clear();
+		modified_.clear();
+	}
+
+	void chunk_map::keys(std::vector<uint64_t>& out) const
+	{
+		for(auto it = chunks_.begin(); it != chunks_.end(); ++it) {
+			out.push_back(it->first);
+		}
+		if(store_) {
+			std::vector<uint64_t> stored;
+			store_->chunk_keys(stored);
+			for(auto it = stored.begin(); it != stored.end(); ++it) {
+				if(paged_in_.count(*it) == 0) {
+					out.push_back(*it);
+				}
+			}
+		}
+	}
+
+	void chunk_map::compact()
+	{
+		for(auto it = chunks_.begin(); it != chunks_.end(); ) {
+			it->second->compact();
+			if(it->second->is_empty()) {
+				it = chunks_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	void chunk_map::build_from_heightmap(const std::vector<uint8_t>& heights, int width, int depth, block_id b)
+	{
+		ASSERT_LOG(heights.size() >= size_t(width * depth), "Heightmap data too small: " << heights.size() << " < " << (width * depth));
+		const int chunks_x = (width + chunk_mask) >> chunk_shift;
+		const int chunks_z = (depth + chunk_mask) >> chunk_shift;
+		for(int cz = 0; cz != chunks_z; ++cz) {
+			for(int cx = 0; cx != chunks_x; ++cx) {
+				const int x0 = cx * chunk_size, z0 = cz * chunk_size;
+				const int x1 = std::min(x0 + chunk_size, width), z1 = std::min(z0 + chunk_size, depth);
+				const bool full_column = (x1 - x0) == chunk_size && (z1 - z0) == chunk_size;
+
+				int min_h = 256, max_h = 0;
+				for(int z = z0; z != z1; ++z) {
+					for(int x = x0; x != x1; ++x) {
+						const int h = heights[z * width + x];
+						min_h = std::min(min_h, h);
+						max_h = std::max(max_h, h);
+					}
+				}
+
+				for(int cy = 0; cy * chunk_size < max_h; ++cy) {
+					const int y0 = cy * chunk_size;
+					chunk_ptr c = get_or_create_chunk(cx, cy, cz);
+					if(full_column && y0 + chunk_size <= min_h) {
+						// Completely below the surface.
+						c->fill(b);
+						continue;
+					}
+					for(int z = z0; z != z1; ++z) {
+						for(int x = x0; x != x1; ++x) {
+							const int top = std::min(int(heights[z * width + x]) - y0, chunk_size);
+							if(top > 0) {
+								c->fill_column(x - x0, z - z0, 0, top, b);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	size_t chunk_map::memory_usage() const
+	{
+		size_t total = 0;
+		for(auto it = chunks_.begin(); it != chunks_.end(); ++it) {
+			total += it->second->memory_usage();
+		}
+		return total + chunks_.bucket_count() * sizeof(void*) + chunks_.size() * sizeof(map_type::value_type);
+	}
+
+	void chunk_map::memory_report(std::ostream& os) const
+	{
+		size_t num_uniform = 0, num_palette = 0, num_raw = 0;
+		for(auto it = chunks_.begin(); it != chunks_.end(); ++it) {
+			const chunk& c = *it->second;
+			os << "chunk (" << c.cx() << "," << c.cy() << "," << c.cz() << "): ";
+			if(c.is_uniform()) {
+				os << "uniform type " << c.uniform_type();
+				++num_uniform;
+			} else if(c.palette_size() != 0) {
+				os << "palette of " << c.palette_size();
+				++num_palette;
+			} else {
+				os << "raw";
+				++num_raw;
+			}
+			os << ", " << c.memory_usage() << " bytes" << std::endl;
+		}
+		const size_t total = memory_usage();
+		const double blocks = double(chunks_.size()) * chunk_volume;
+		os << chunks_.size() << " chunks (" << num_uniform << " uniform, "
+			<< num_palette << " palette, " << num_raw << " raw), "
+			<< total << " bytes total, "
+			<< std::fixed << std::setprecision(3) << (blocks > 0 ? total / blocks : 0.0) << " bytes/block" << std::endl;
+	}
+
+	chunk_neighbourhood::chunk_neighbourhood(const chunk_map& cm, int cx, int cy, int cz)
+	{
+		for(int sz = -1; sz <= 1; ++sz) {
+			for(int sy = -1; sy <= 1; ++sy) {
+				for(int sx = -1; sx <= 1; ++sx) {
+					chunks_[slot(sx, sy, sz)] = cm.get_chunk(cx + sx, cy + sy, cz + sz);
+				}
+			}
+		}
+	}
+}
+
+UNIT_TEST(chunk_storage)
+{
+	cube::chunk c(0, 0, 0);
+	CHECK_EQ(c.is_empty(), true);
+	CHECK_EQ(c.memory_usage(), sizeof(cube::chunk));
+
+	c.set(1, 2, 3, 5);
+	CHECK_EQ(c.get(1, 2, 3), 5);
+	CHECK_EQ(c.get(3, 2, 1), 0);
+	CHECK_EQ(c.palette_size(), 2);
+
+	// Overflow the palette, then check it compacts back down again.
+	for(int n = 0; n != 300; ++n) {
+		c.set_index(n, cube::block_id(n + 1));
+	}
+	CHECK_EQ(c.get_index(299), 300);
+	CHECK_EQ(c.palette_size(), 0);
+	for(int n = 0; n != 300; ++n) {
+		c.set_index(n, 7);
+	}
+	c.set(1, 2, 3, 7);
+	c.compact();
+	CHECK_EQ(c.palette_size(), 2);
+	c.fill(7);
+	c.compact();
+	CHECK_EQ(c.is_uniform(), true);
+	CHECK_EQ(c.get(31, 31, 31), 7);
+
+	cube::chunk_map cm;
+	cm.set_block(-1, -1, -1, 3);
+	CHECK_EQ(cm.get_block(-1, -1, -1), 3);
+	CHECK_EQ(cm.get_chunk(-1, -1, -1)->get(31, 31, 31), 3);
+	CHECK_EQ(cm.get_block(0, 0, 0), 0);
+	int cx, cy, cz;
+	cube::chunk_map::from_key(cube::chunk_map::key(-1, 2, -3), cx, cy, cz);
+	CHECK_EQ(cx, -1);
+	CHECK_EQ(cy, 2);
+	CHECK_EQ(cz, -3);
+
+	// Writing to a chunk someone else is reading leaves their copy alone.
+	cube::chunk_ptr reader = cm.get_chunk(-1, -1, -1);
+	cm.set_block(-1, -1, -1, cube::empty_block);
+	CHECK_EQ(reader->get(31, 31, 31), 3);
+	CHECK_EQ(cm.get_block(-1, -1, -1), 0);
+	reader.reset();
+	cm.compact();
+	CHECK_EQ(cm.num_chunks(), 0);
+
+	// 40x40 map, 40 high except for one 70 high column.
+	std::vector<uint8_t> heights(40 * 40, 40);
+	heights[5 * 40 + 5] = 70;
+	cm.build_from_heightmap(heights, 40, 40, 1);
+	CHECK_EQ(cm.get_chunk(0, 0, 0)->is_uniform(), true);
+	CHECK_EQ(cm.get_chunk(1, 0, 0)->is_uniform(), false);
+	CHECK_EQ(cm.is_solid(39, 39, 39), true);
+	CHECK_EQ(cm.is_solid(39, 40, 39), false);
+	CHECK_EQ(cm.is_solid(5, 69, 5), true);
+	CHECK_EQ(cm.is_solid(5, 70, 5), false);
+	CHECK_EQ(cm.is_solid(40, 0, 0), false);
+
+	cube::chunk_neighbourhood nh(cm, 0, 1, 0);
+	CHECK_EQ(nh.is_solid(5, -1, 5), true);
+	CHECK_EQ(nh.is_solid(6, 7, 5), true);
+	CHECK_EQ(nh.is_solid(6, 8, 5), false);
+	CHECK_EQ(nh.is_solid(5, 8, 5), true);
+	CHECK_EQ(nh.is_solid(5, 32, 5), true);
+	CHECK_EQ(nh.is_solid(-1, -1, -1), false);
+	CHECK_EQ(cube::chunk_neighbourhood(cm, 1, 1, 1).is_solid(-1, -1, -1), true);
+}
+
+UNIT_TEST(chunk_region_edits)
+{
+	cube::chunk_map cm;
+
+	// Clearing where nothing is stored creates nothing.
+	const cube::block_box everywhere = { -100, -100, -100, 200, 200, 200 };
+	cm.fill_box(everywhere, cube::empty_block);
+	CHECK_EQ(cm.num_chunks(), 0);
+
+	// A box across chunk borders at negative co-ordinates.
+	const cube::block_box box = { -5, -3, -40, 50, 10, 45 };
+	cm.fill_box(box, 3);
+	CHECK_EQ(cm.get_block(-5, -3, -40), 3);
+	CHECK_EQ(cm.get_block(44, 6, 4), 3);
+	CHECK_EQ(cm.get_block(45, 6, 4), 0);
+	CHECK_EQ(cm.get_block(-6, 0, 0), 0);
+	CHECK_EQ(cm.get_block(0, 7, 0), 0);
+	CHECK_EQ(cm.get_block(0, 0, 5), 0);
+	// Whole layers of a chunk are filled in one range.
+	const cube::block_box layers = { 0, 2, 0, 32, 3, 32 };
+	cm.fill_box(layers, 4);
+	CHECK_EQ(cm.get_block(31, 4, 31), 4);
+	CHECK_EQ(cm.get_block(31, 5, 31), 0);
+	CHECK_EQ(cm.get_block(0, 1, 0), 3);
+
+	// Copying a region and pasting it elsewhere reproduces it exactly.
+	cube::block_volume copied, pasted;
+	const cube::block_box source = { -10, -5, -10, 40, 15, 20 };
+	cm.copy_box(source, copied);
+	CHECK_EQ(copied.blocks.size(), 40 * 15 * 20);
+	cm.paste(copied, 100, 50, -70);
+	const cube::block_box dest = { 100, 50, -70, 40, 15, 20 };
+	cm.copy_box(dest, pasted);
+	CHECK_EQ(pasted.blocks == copied.blocks, true);
+
+	// A sphere takes out every block within the radius.
+	cube::block_volume before;
+	const cube::block_box around = { -7, -7, -27, 15, 15, 15 };
+	cm.copy_box(around, before);
+	cm.fill_sphere(0, 0, -20, 6, cube::empty_block);
+	for(int y = -7; y <= 7; ++y) {
+		for(int z = -7; z <= 7; ++z) {
+			for(int x = -7; x <= 7; ++x) {
+				const cube::block_id expected = x * x + y * y + z * z <= 36 ? cube::empty_block : before.blocks[before.index(x + 7, y + 7, z + 7)];
+				CHECK_EQ(cm.get_block(x, y, z - 20), expected);
+			}
+		}
+	}
+}
+
+namespace
+{
+	const cube::block_box edit_box = { -16, 0, -16, 64, 64, 64 };
+}
+
+// A 64^3 edit written a block at a time.
+BENCHMARK(cube_set_blocks_64)
+{
+	cube::chunk_map cm;
+	cube::block_id b = 1;
+	BENCHMARK_LOOP {
+		for(int y = edit_box.y; y != edit_box.y + edit_box.sy; ++y) {
+			for(int z = edit_box.z; z != edit_box.z + edit_box.sz; ++z) {
+				for(int x = edit_box.x; x != edit_box.x + edit_box.sx; ++x) {
+					cm.set_block(x, y, z, b);
+				}
+			}
+		}
+		b = cube::block_id(3 - b);
+	}
+}
+
+BENCHMARK(cube_fill_box_64)
+{
+	cube::chunk_map cm;
+	cube::block_id b = 1;
+	BENCHMARK_LOOP {
+		cm.fill_box(edit_box, b);
+		b = cube::block_id(3 - b);
+	}
+}
+
+BENCHMARK(cube_paste_64)
+{
+	cube::chunk_map cm;
+	cm.fill_box(edit_box, 1);
+	cm.fill_sphere(16, 32, 16, 20, 2);
+	cube::block_volume v;
+	cm.copy_box(edit_box, v);
+	BENCHMARK_LOOP {
+		cm.paste(v, 80, 3, 5);
+	}
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
+namespace cube
+{
+	// Chunks are cubes with chunk_size blocks along each axis.
+	const int chunk_shift = 5;
+	const int chunk_size = 1 << chunk_shift;
+	const int chunk_mask = chunk_size - 1;
+	const int chunk_area = chunk_size * chunk_size;
+	const int chunk_volume = chunk_size * chunk_size * chunk_size;
+
+	// Block type identifier, empty_block is always air.
+	typedef uint16_t block_id;
+	const block_id empty_block = 0;
+
+	// Face directions, same ordering as graphics::cube_model.
+	enum {
+		FRONT,		// +z
+		RIGHT,		// +x
+		TOP,		// +y
+		BACK,		// -z
+		LEFT,		// -x
+		BOTTOM,		// -y
+		NUM_DIRECTIONS,
+	};
+
+	// Unit offset to the neighbouring block in each direction.
+	extern const int direction_offset[NUM_DIRECTIONS][3];
+
+	inline int opposite_direction(int d) { return (d + 3) % NUM_DIRECTIONS; }
+
+	// Box of sx*sy*sz blocks starting at block x, y, z.
+	struct block_box
+	{
+		int x, y, z;
+		int sx, sy, sz;
+	};
+
+	// Blocks copied out of a chunk_map, ordered as in a chunk: x fastest,
+	// then z, then y.
+	struct block_volume
+	{
+		block_volume() : sx(0), sy(0), sz(0) {}
+
+		int sx, sy, sz;
+		std::vector<block_id> blocks;
+
+		int index(int x, int y, int z) const { return (y * sz + z) * sx + x; }
+	};
+
+	// Dense storage for a single chunk. A chunk holding only one block type
+	// stores no per-block data at all. Otherwise blocks are stored as byte
+	// indices into a palette, falling back to raw block_id's if more than
+	// 256 distinct types are present.
+	class chunk
+	{
+	public:
+		chunk(int cx, int cy, int cz, block_id fill=empty_block);
+		virtual ~chunk();
+
+		chunk* clone() const { return new chunk(*this); }
+
+		int cx() const { return cx_; }
+		int cy() const { return cy_; }
+		int cz() const { return cz_; }
+
+		// x, y, z are local co-ordinates in the range [0, chunk_size).
+		block_id get(int x, int y, int z) const { return get_index(index(x, y, z)); }
+		block_id get_index(int n) const
+		{
+			if(!indices_.empty()) {
+				return palette_[indices_[n]];
+			} else if(!blocks_.empty()) {
+				return blocks_[n];
+			}
+			return uniform_;
+		}
+		void set(int x, int y, int z, block_id b) { set_index(index(x, y, z), b); }
+		void set_index(int n, block_id b);
+
+		void fill(block_id b);
+		// Sets blocks [y1, y2) of the column at x, z to b.
+		void fill_column(int x, int z, int y1, int y2, block_id b);
+		// Sets blocks [first, last), in index order, to b.
+		void fill_range(int first, int last, block_id b);
+		// Copies count blocks along x, starting at local x, y, z, into out or
+		// from blocks. Raw storage is copied straight, otherwise set_row()
+		// fills runs of one type with fill_range().
+		void get_row(int x, int y, int z, int count, block_id* out) const;
+		void set_row(int x, int y, int z, int count, const block_id* blocks);
+
+		bool is_uniform() const { return indices_.empty() && blocks_.empty(); }
+		block_id uniform_type() const { return uniform_; }
+		bool is_empty() const { return is_uniform() && uniform_ == empty_block; }
+
+		// Drops unused palette entries and collapses the chunk to uniform
+		// storage if only a single block type remains.
+		void compact();
+
+		size_t palette_size() const;
+		size_t memory_usage() const;
+
+		static int index(int x, int y, int z) { return (y << (2*chunk_shift)) | (z << chunk_shift) | x; }
+	private:
+		int palette_index(block_id b);
+		void expand_to_raw();
+
+		int cx_;
+		int cy_;
+		int cz_;
+
+		block_id uniform_;
+		std::vector<block_id> palette_;
+		std::vector<uint8_t> indices_;
+		std::vector<block_id> blocks_;
+
+		chunk();
+		chunk(const chunk&);
+	};
+
+	typedef boost::shared_ptr<chunk> chunk_ptr;
+	typedef boost::shared_ptr<const chunk> const_chunk_ptr;
+
+	// Somewhere chunks missing from a chunk_map can be paged in from, such
+	// as a region_store.
+	class chunk_source
+	{
+	public:
+		virtual ~chunk_source() {}
+		// Returns a null pointer if there is no such chunk.
+		virtual chunk_ptr load_chunk(int cx, int cy, int cz) = 0;
+		// Appends the chunk_map key of every chunk available.
+		virtual void chunk_keys(std::vector<uint64_t>& keys) = 0;
+		// True if load_chunk() may be called from several threads at once,
+		// so chunks can be loaded on worker threads.
+		virtual bool concurrent_loads() const { return false; }
+		// Lets go of any files held open, so they can be replaced. They are
+		// opened again when next needed.
+		virtual void close_files() {}
+	};
+	typedef boost::shared_ptr<chunk_source> chunk_source_ptr;
+
+	// Sparse collection of chunks keyed by chunk co-ordinate. Chunks which
+	// are entirely empty need not be stored. With a chunk_source attached,
+	// chunks missing from the map are paged in from it when first asked for.
+	class chunk_map
+	{
+	public:
+		typedef boost::unordered_map<uint64_t, chunk_ptr> map_type;
+		typedef map_type::const_iterator const_iterator;
+
+		chunk_map();
+		virtual ~chunk_map();
+
+		block_id get_block(int x, int y, int z) const;
+		void set_block(int x, int y, int z, block_id b);
+		bool is_solid(int x, int y, int z) const { return get_block(x, y, z) != empty_block; }
+
+		// Region edits, writing whole rows or layers of each chunk at once
+		// rather than a block at a time. Chunks aren't created just to hold
+		// empty blocks.
+		void fill_box(const block_box& box, block_id b);
+		// Blocks whose distance from x, y, z is at most radius.
+		void fill_sphere(int x, int y, int z, int radius, block_id b);
+		void copy_box(const block_box& box, block_volume& out) const;
+		// Writes v with its first block at x, y, z, empty blocks included.
+		void paste(const block_volume& v, int x, int y, int z);
+
+		// Returns a null pointer if no chunk is stored at the given position.
+		chunk_ptr get_chunk(int cx, int cy, int cz) const;
+		// As get_chunk(), but never pages in, so any number of threads may
+		// call it at once while nothing modifies the map.
+		const chunk* resident_chunk(int cx, int cy, int cz) const
+		{
+			auto it = chunks_.find(key(cx, cy, cz));
+			return it == chunks_.end() ? NULL : it->second.get();
+		}
+		chunk_ptr get_or_create_chunk(int cx, int cy, int cz);
+		// As get_or_create_chunk(), but if anything besides the map holds a
+		// reference to the chunk it is replaced by a copy first. Anyone still
+		// reading the old chunk, such as a mesh job, is unaffected by writes.
+		chunk_ptr get_chunk_for_write(int cx, int cy, int cz);
+		void remove_chunk(int cx, int cy, int cz);
+		// Also detaches any chunk_source.
+		void clear();
+
+		// Drops a chunk paged in from the store, so it is paged in again
+		// next time it's needed. Chunks written to since being paged in are
+		// kept, as is everything when there's no store. Returns true if the
+		// chunk was dropped.
+		bool unload_chunk(int cx, int cy, int cz);
+
+		// False if the chunk has yet to be looked up in the store.
+		bool is_paged_in(int cx, int cy, int cz) const;
+		// Takes a chunk loaded from the store elsewhere, such as on a worker
+		// thread, as if it had been paged in here. c is null if the store has
+		// no such chunk. Ignored if the chunk was paged in meanwhile.
+		void add_paged_in(int cx, int cy, int cz, chunk_ptr c);
+
+		void set_store(chunk_source_ptr store);
+		const chunk_source_ptr& store() const { return store_; }
+		// Appends the key of every chunk, whether paged in yet or not.
+		void keys(std::vector<uint64_t>& out) const;
+
+		// Compacts every chunk and drops those which are now empty.
+		void compact();
+
+		// Creates columns of block type b from a width x depth heightmap. The
+		// column at (x, z) is filled from y = 0 up to, but not including,
+		// heights[z*width+x].
+		void build_from_heightmap(const std::vector<uint8_t>& heights, int width, int depth, block_id b);
+
+		// Only counts chunks which have been paged in, as do the iterators.
+		size_t num_chunks() const { return chunks_.size(); }
+		size_t memory_usage() const;
+		void memory_report(std::ostream& os) const;
+
+		const_iterator begin() const { return chunks_.begin(); }
+		const_iterator end() const { return chunks_.end(); }
+		// As resident_chunk(), by key.
+		const_iterator find(uint64_t k) const { return chunks_.find(k); }
+
+		static uint64_t key(int cx, int cy, int cz)
+		{
+			return (uint64_t(cx & 0x1fffff) << 42) | (uint64_t(cy & 0x1fffff) << 21) | uint64_t(cz & 0x1fffff);
+		}
+		static void from_key(uint64_t k, int& cx, int& cy, int& cz)
+		{
+			cx = sign_extend_key(int((k >> 42) & 0x1fffff));
+			cy = sign_extend_key(int((k >> 21) & 0x1fffff));
+			cz = sign_extend_key(int(k & 0x1fffff));
+		}
+		// Arithmetic shift, so negative co-ordinates round towards negative infinity.
+		static int to_chunk(int v) { return v >> chunk_shift; }
+		static int to_local(int v) { return v & chunk_mask; }
+	private:
+		static int sign_extend_key(int v) { return (v & 0x100000) ? v - 0x200000 : v; }
+
+		void page_in(uint64_t k, int cx, int cy, int cz) const;
+		// Sets blocks x1 to x2 - 1 of a row along x.
+		void fill_row(int x1, int x2, int y, int z, block_id b);
+
+		// Mutable since lookups page in chunks from store_.
+		mutable map_type chunks_;
+		chunk_source_ptr store_;
+		// Keys already looked up in store_, so removed chunks stay removed.
+		mutable boost::unordered_set<uint64_t> paged_in_;
+		// Keys written to since store_ was attached.
+		boost::unordered_set<uint64_t> modified_;
+
+		chunk_map(const chunk_map&);
+	};
+
+	// A chunk together with the 26 chunks surrounding it, so lookups up to one
+	// block outside the chunk don't need to go through the chunk_map.
+	class chunk_neighbourhood
+	{
+	public:
+		chunk_neighbourhood(const chunk_map& cm, int cx, int cy, int cz);
+
+		const chunk* center() const { return chunks_[13].get(); }
+		const chunk* neighbour(int dir) const
+		{
+			return chunks_[slot(direction_offset[dir][0], direction_offset[dir][1], direction_offset[dir][2])].get();
+		}
+
+		// x, y, z are local to the center chunk in the range [-1, chunk_size].
+		block_id get(int x, int y, int z) const
+		{
+			const int sx = x < 0 ? -1 : (x >= chunk_size ? 1 : 0);
+			const int sy = y < 0 ? -1 : (y >= chunk_size ? 1 : 0);
+			const int sz = z < 0 ? -1 : (z >= chunk_size ? 1 : 0);
+			const chunk* c = chunks_[slot(sx, sy, sz)].get();
+			return c ? c->get(x - sx * chunk_size, y - sy * chunk_size, z - sz * chunk_size) : empty_block;
+		}
+		bool is_solid(int x, int y, int z) const { return get(x, y, z) != empty_block; }
+	private:
+		static int slot(int sx, int sy, int sz) { return (sx + 1) + (sy + 1) * 3 + (sz + 1) * 9; }
+
+		chunk_ptr chunks_[27];
+	};
+}
@@ -0,0 +1,866 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHUNK_MESHER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "asserts.hpp"
+#include "chunk_mesher.hpp"
+#include "column_map.hpp"
+#include "test_terrain.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	const int direction_axis[NUM_DIRECTIONS] = { 2, 0, 1, 2, 0, 1 };
+
+	namespace
+	{
+		// Corners of each face of the unit cube, counter-clockwise when
+		// viewed from outside the cube.
+		const int face_corners[NUM_DIRECTIONS][4][3] = {
+			{ {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1} },		// FRONT
+			{ {1,0,1}, {1,0,0}, {1,1,0}, {1,1,1} },		// RIGHT
+			{ {0,1,1}, {1,1,1}, {1,1,0}, {0,1,0} },		// TOP
+			{ {1,0,0}, {0,0,0}, {0,1,0}, {1,1,0} },		// BACK
+			{ {0,0,0}, {0,0,1}, {0,1,1}, {0,1,0} },		// LEFT
+			{ {0,0,0}, {1,0,0}, {1,0,1}, {0,0,1} },		// BOTTOM
+		};
+
+		// Corner order for the two triangles making up a face, split along
+		// either diagonal.
+		const int face_triangles[2][6] = {
+			{ 0, 1, 2, 0, 2, 3 },
+			{ 1, 2, 3, 1, 3, 0 },
+		};
+
+		// Chunk blocks plus a one block border taken from the surrounding
+		// chunks, so the mesher inner loops can index it directly.
+		const int padded_size = chunk_size + 2;
+		const int padded_stride[3] = { 1, padded_size * padded_size, padded_size };
+
+		inline int padded_index(int x, int y, int z)
+		{
+			return (y + 1) * padded_stride[1] + (z + 1) * padded_stride[2] + (x + 1);
+		}
+
+		inline int padded_offset(int direction)
+		{
+			return direction_offset[direction][0] * padded_stride[0]
+				+ direction_offset[direction][1] * padded_stride[1]
+				+ direction_offset[direction][2] * padded_stride[2];
+		}
+
+		int solid_height(const chunk& c)
+		{
+			if(c.is_uniform()) {
+				return c.uniform_type() == empty_block ? 0 : chunk_size;
+			}
+			int height = chunk_size;
+			for(int n = 0; n != chunk_size * chunk_size && height != 0; ++n) {
+				int y = 0;
+				while(y != height && c.get_index((y << (2*chunk_shift)) | n) != empty_block) {
+					++y;
+				}
+				height = y;
+			}
+			return height;
+		}
+
+		void fill_padded(const chunk_neighbourhood& nh, std::vector<block_id>& padded)
+		{
+			padded.resize(padded_size * padded_size * padded_size);
+			const chunk& c = *nh.center();
+			for(int y = 0; y != chunk_size; ++y) {
+				for(int z = 0; z != chunk_size; ++z) {
+					const int row = padded_index(0, y, z);
+					if(c.is_uniform()) {
+						std::fill(padded.begin() + row, padded.begin() + row + chunk_size, c.uniform_type());
+						continue;
+					}
+					for(int x = 0; x != chunk_size; ++x) {
+						padded[row + x] = c.get_index(chunk::index(x, y, z));
+					}
+				}
+			}
+			for(int y = -1; y <= chunk_size; ++y) {
+				for(int z = -1; z <= chunk_size; ++z) {
+					if(y < 0 || y == chunk_size || z < 0 || z == chunk_size) {
+						for(int x = -1; x <= chunk_size; ++x) {
+							padded[padded_index(x, y, z)] = nh.get(x, y, z);
+						}
+					} else {
+						padded[padded_index(-1, y, z)] = nh.get(-1, y, z);
+						padded[padded_index(chunk_size, y, z)] = nh.get(chunk_size, y, z);
+					}
+				}
+			}
+		}
+
+		// Bit matrix transpose, moving bit j of rows[i] to bit i of rows[j].
+		void transpose_bits(uint64_t rows[64])
+		{
+			uint64_t m = 0x00000000ffffffffULL;
+			for(int j = 32; j != 0; j >>= 1, m ^= m << j) {
+				for(int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+					const uint64_t t = ((rows[k] >> j) ^ rows[k | j]) & m;
+					rows[k] ^= t << j;
+					rows[k | j] ^= t;
+				}
+			}
+		}
+
+		// Builds the column masks from the padded blocks. Each slice of
+		// constant z is read as rows along x, which are contiguous in padded,
+		// then transposed into columns, rather than setting one bit per block.
+		void fill_columns(const std::vector<block_id>& padded, column_mask* columns)
+		{
+			uint64_t rows[64];
+			for(int z = -1; z <= chunk_size; ++z) {
+				std::fill(rows + column_grid_size, rows + 64, 0);
+				for(int y = -1; y <= chunk_size; ++y) {
+					const block_id* src = &padded[padded_index(-1, y, z)];
+					uint64_t row = 0;
+					int x = 0;
+#if defined(CHUNK_MESHER_USE_SSE2)
+					const __m128i empty = _mm_set1_epi16(short(empty_block));
+					for(; x + 16 <= column_grid_size; x += 16) {
+						const __m128i lo = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)), empty);
+						const __m128i hi = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 8)), empty);
+						row |= uint64_t(~_mm_movemask_epi8(_mm_packs_epi16(lo, hi)) & 0xffff) << x;
+					}
+#endif
+					for(; x != column_grid_size; ++x) {
+						row |= uint64_t(src[x] != empty_block) << x;
+					}
+					rows[y + 1] = row;
+				}
+				transpose_bits(rows);
+				std::copy(rows, rows + column_grid_size, columns + (z + 1) * column_grid_size);
+			}
+		}
+
+		// Faces of the single column at x, z. A face is visible where its
+		// block is solid and the block in front is not; the masks of the
+		// columns to either side line up with this one, and the blocks above
+		// and below are a shift away.
+		void cull_column(const column_mask* columns, int x, int z, face_masks& out)
+		{
+			const int n = (z + 1) * column_grid_size + x + 1;
+			const column_mask c = columns[n];
+			const int i = z * chunk_size + x;
+			out.columns[FRONT][i] = uint32_t((c & ~columns[n + column_grid_size]) >> 1);
+			out.columns[RIGHT][i] = uint32_t((c & ~columns[n + 1]) >> 1);
+			out.columns[TOP][i] = uint32_t((c & ~(c >> 1)) >> 1);
+			out.columns[BACK][i] = uint32_t((c & ~columns[n - column_grid_size]) >> 1);
+			out.columns[LEFT][i] = uint32_t((c & ~columns[n - 1]) >> 1);
+			out.columns[BOTTOM][i] = uint32_t((c & ~(c << 1)) >> 1);
+		}
+
+#if defined(CHUNK_MESHER_USE_SSE2)
+		// Drops the border bit from the faces of two columns and stores the
+		// chunk bits of each.
+		inline void store_faces(uint32_t* dst, __m128i faces)
+		{
+			faces = _mm_shuffle_epi32(_mm_srli_epi64(faces, 1), _MM_SHUFFLE(2, 0, 2, 0));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst), faces);
+		}
+#endif
+
+		// Ambient occlusion for each corner of the face in the given direction
+		// of the block at padded index n, from the three blocks touching the
+		// corner in front of the face.
+		void face_ao(const std::vector<block_id>& padded, int n, int direction, int ao[4])
+		{
+			const int a = direction_axis[direction];
+			const int u = (a + 1) % 3;
+			const int v = (a + 2) % 3;
+			const int front = n + padded_offset(direction);
+			for(int k = 0; k != 4; ++k) {
+				const int du = face_corners[direction][k][u] ? padded_stride[u] : -padded_stride[u];
+				const int dv = face_corners[direction][k][v] ? padded_stride[v] : -padded_stride[v];
+				const int side1 = padded[front + du] != empty_block;
+				const int side2 = padded[front + dv] != empty_block;
+				const int corner = padded[front + du + dv] != empty_block;
+				ao[k] = side1 && side2 ? 0 : 3 - side1 - side2 - corner;
+			}
+		}
+
+		void mesh_naive(const chunk_neighbourhood& nh, chunk_mesh& out)
+		{
+			std::vector<block_id> padded;
+			fill_padded(nh, padded);
+			for(int y = 0; y != chunk_size; ++y) {
+				for(int z = 0; z != chunk_size; ++z) {
+					for(int x = 0; x != chunk_size; ++x) {
+						const int n = padded_index(x, y, z);
+						if(padded[n] == empty_block) {
+							continue;
+						}
+						for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+							if(padded[n + padded_offset(d)] == empty_block) {
+								int ao[4];
+								face_ao(padded, n, d, ao);
+								add_quad(out, d, x, y, z, 1, 1, 1, padded[n], ao);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		void mesh_greedy(const std::vector<block_id>& padded, const std::vector<column_mask>& columns, chunk_mesh& out)
+		{
+			face_masks faces;
+			cull_faces(&columns[0], faces);
+			// Block type of each visible face in the current slice in the low
+			// 16 bits, with the occlusion of its corners above that, so only
+			// faces which shade the same are merged. Zero where there is no
+			// face; merging clears each face it uses, so the mask is left all
+			// zero for the next slice.
+			std::vector<uint32_t> mask(chunk_area);
+			auto add_face = [&](int d, const int* p, int n) {
+				const int src = padded_index(p[0], p[1], p[2]);
+				int ao[4];
+				face_ao(padded, src, d, ao);
+				mask[n] = padded[src] | uint32_t(ao[0] | ao[1] << 2 | ao[2] << 4 | ao[3] << 6) << 16;
+			};
+
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				const int a = direction_axis[d];
+				const int u = a == 0 ? 2 : 0;
+				const int v = 3 - a - u;
+				const uint32_t* cols = faces.columns[d];
+				// Bit s set if slice s has any faces.
+				uint32_t slices = 0;
+				for(int n = 0; n != chunk_area; ++n) {
+					if(a == 1) {
+						slices |= cols[n];
+					} else if(cols[n] != 0) {
+						slices |= 1u << (a == 0 ? n & chunk_mask : n >> chunk_shift);
+					}
+				}
+
+				for(int s = 0; s != chunk_size; ++s) {
+					if((slices & (1u << s)) == 0) {
+						continue;
+					}
+					// Bit j set if row j of the slice has any faces.
+					uint32_t rows = 0;
+					int p[3];
+					p[a] = s;
+					if(a == 1) {
+						// Rows run along x at each z, picking bit s from each column.
+						for(p[2] = 0; p[2] != chunk_size; ++p[2]) {
+							for(p[0] = 0; p[0] != chunk_size; ++p[0]) {
+								const int n = p[2] * chunk_size + p[0];
+								if(cols[n] & (1u << s)) {
+									rows |= 1u << p[2];
+									add_face(d, p, n);
+								}
+							}
+						}
+					} else {
+						// Each column in the slice is a run along the rows.
+						for(p[u] = 0; p[u] != chunk_size; ++p[u]) {
+							uint32_t bits = a == 2 ? cols[s * chunk_size + p[u]] : cols[p[u] * chunk_size + s];
+							rows |= bits;
+							for(p[v] = 0; bits != 0; bits >>= 1, ++p[v]) {
+								if(bits & 1) {
+									add_face(d, p, p[v] * chunk_size + p[u]);
+								}
+							}
+						}
+					}
+
+					for(int j = 0; j != chunk_size; ++j) {
+						if((rows & (1u << j)) == 0) {
+							continue;
+						}
+						for(int i = 0; i != chunk_size; ) {
+							const int n = j * chunk_size + i;
+							const uint32_t b = mask[n];
+							if(b == 0) {
+								++i;
+								continue;
+							}
+							int w = 1;
+							while(i + w != chunk_size && mask[n + w] == b) {
+								++w;
+							}
+							int h = 1;
+							for(; j + h != chunk_size; ++h) {
+								const int row = n + h * chunk_size;
+								// The first row is known to be all b, so compare against it.
+								if(memcmp(&mask[row], &mask[n], w * sizeof(uint32_t)) != 0) {
+									break;
+								}
+							}
+							for(int k = 0; k != h; ++k) {
+								std::fill(mask.begin() + n + k * chunk_size, mask.begin() + n + k * chunk_size + w, 0);
+							}
+
+							int size[3];
+							size[a] = 1;
+							size[u] = w;
+							size[v] = h;
+							p[u] = i;
+							p[v] = j;
+							const int ao[4] = { int(b >> 16) & 3, int(b >> 18) & 3, int(b >> 20) & 3, int(b >> 22) & 3 };
+							add_quad(out, d, p[0], p[1], p[2], size[0], size[1], size[2], b & 0xffff, ao);
+							i += w;
+						}
+					}
+				}
+			}
+		}
+
+		void mesh_greedy(const chunk_neighbourhood& nh, chunk_mesh& out)
+		{
+			std::vector<block_id> padded;
+			fill_padded(nh, padded);
+			std::vector<column_mask> columns(column_grid_area);
+			fill_columns(padded, &columns[0]);
+			mesh_greedy(padded, columns, out);
+		}
+	}
+
+	chunk_mesh::chunk_mesh()
+		: solid_height(0), connectivity(all_faces_connected)
+	{
+	}
+
+	void chunk_mesh::clear()
+	{
+		for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+			vertices[d].clear();
+		}
+		solid_height = 0;
+		connectivity = all_faces_connected;
+	}
+
+	size_t chunk_mesh::vertex_count() const
+	{
+		size_t cnt = 0;
+		for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+			cnt += vertices[d].size();
+		}
+		return cnt;
+	}
+
+	void cull_faces(const column_mask* columns, face_masks& out)
+	{
+#if defined(CHUNK_MESHER_USE_SSE2)
+		// Two columns at a time, one in each 64-bit lane.
+		for(int z = 0; z != chunk_size; ++z) {
+			const column_mask* row = columns + (z + 1) * column_grid_size + 1;
+			for(int x = 0; x != chunk_size; x += 2) {
+				const int i = z * chunk_size + x;
+				const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+				const __m128i front = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + column_grid_size));
+				const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+				const __m128i back = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - column_grid_size));
+				const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+				store_faces(&out.columns[FRONT][i], _mm_andnot_si128(front, c));
+				store_faces(&out.columns[RIGHT][i], _mm_andnot_si128(right, c));
+				store_faces(&out.columns[TOP][i], _mm_andnot_si128(_mm_srli_epi64(c, 1), c));
+				store_faces(&out.columns[BACK][i], _mm_andnot_si128(back, c));
+				store_faces(&out.columns[LEFT][i], _mm_andnot_si128(left, c));
+				store_faces(&out.columns[BOTTOM][i], _mm_andnot_si128(_mm_slli_epi64(c, 1), c));
+			}
+		}
+#else
+		for(int z = 0; z != chunk_size; ++z) {
+			for(int x = 0; x != chunk_size; ++x) {
+				cull_column(columns, x, z, out);
+			}
+		}
+#endif
+	}
+
+	const int* face_corner(int direction, int n)
+	{
+		return face_corners[direction][n];
+	}
+
+	void add_quad(chunk_mesh& out, int direction, int x, int y, int z, int sx, int sy, int sz, int texture, const int ao[4])
+	{
+		ASSERT_LOG(direction >= 0 && direction < NUM_DIRECTIONS, "add_quad() invalid direction: " << direction);
+		ASSERT_LOG(texture >= 0 && texture < num_block_tiles, "add_quad() block " << texture << " has no tile in the block atlas");
+		std::vector<packed_vertex>& v = out.vertices[direction];
+		// Split along the diagonal whose ends are most alike, otherwise the
+		// occlusion gradient shows up the triangle edge.
+		const int* tri = face_triangles[ao[0] + ao[2] < ao[1] + ao[3] ? 1 : 0];
+		for(int n = 0; n != 6; ++n) {
+			const int* corner = face_corners[direction][tri[n]];
+			v.push_back(pack_vertex(x + corner[0] * sx, y + corner[1] * sy, z + corner[2] * sz, direction, texture, ao[tri[n]]));
+		}
+	}
+
+	void mesh_chunk(const column_map& cols, int cx, int cy, int cz, chunk_mesh& out)
+	{
+		// Both the padded blocks and the column masks are filled a run at a
+		// time. Padded y, like the mask bits, starts one below the chunk.
+		std::vector<block_id> padded(padded_size * padded_size * padded_size, empty_block);
+		std::vector<column_mask> columns(column_grid_area, 0);
+		const int x0 = cx * chunk_size, y0 = cy * chunk_size - 1, z0 = cz * chunk_size;
+		column_mask any = 0;
+		int height = chunk_size;
+		for(int z = -1; z <= chunk_size; ++z) {
+			for(int x = -1; x <= chunk_size; ++x) {
+				const column_view col = cols.get_column(x0 + x, z0 + z);
+				column_mask& mask = columns[(z + 1) * column_grid_size + x + 1];
+				int y = 0;
+				for(int n = 0; n != col.count && y < y0 + padded_size; ++n) {
+					const int start = std::max(y, y0), end = std::min(y + col.runs[n].length, y0 + padded_size);
+					y += col.runs[n].length;
+					if(start >= end || col.runs[n].type == empty_block) {
+						continue;
+					}
+					for(int py = start - y0; py != end - y0; ++py) {
+						padded[py * padded_stride[1] + (z + 1) * padded_stride[2] + x + 1] = col.runs[n].type;
+					}
+					mask |= ((column_mask(1) << (end - start)) - 1) << (start - y0);
+				}
+				if(x >= 0 && x < chunk_size && z >= 0 && z < chunk_size) {
+					const column_mask inside = (mask >> 1) & 0xffffffff;
+					any |= inside;
+					int h = 0;
+					while(h != height && (inside & (column_mask(1) << h))) {
+						++h;
+					}
+					height = h;
+				}
+			}
+		}
+		if(any == 0) {
+			return;
+		}
+		out.solid_height = height;
+		out.connectivity = all_faces_connected;
+		mesh_greedy(padded, columns, out);
+	}
+
+	void mesh_chunk_lod(const chunk_neighbourhood& nh, int level, chunk_mesh& out)
+	{
+		ASSERT_LOG(level > 0 && level < num_lod_levels, "mesh_chunk_lod() invalid level: " << level);
+		const chunk* c = nh.center();
+		if(c == NULL || c->is_empty()) {
+			return;
+		}
+		const int scale = 1 << level;
+		const int n = chunk_size >> level;
+		const int size = n + 2;
+		const int stride[3] = { 1, size * size, size };
+		// Cells plus a one cell border, as with the full detail padded array.
+		std::vector<block_id> cells(size * size * size, empty_block);
+
+		std::vector<std::pair<block_id, int> > votes;
+		for(int y = 0; y != n; ++y) {
+			for(int z = 0; z != n; ++z) {
+				for(int x = 0; x != n; ++x) {
+					block_id b = c->uniform_type();
+					if(!c->is_uniform()) {
+						votes.clear();
+						for(int by = y * scale; by != (y + 1) * scale; ++by) {
+							for(int bz = z * scale; bz != (z + 1) * scale; ++bz) {
+								for(int bx = x * scale; bx != (x + 1) * scale; ++bx) {
+									const block_id t = c->get(bx, by, bz);
+									if(t == empty_block) {
+										continue;
+									}
+									auto it = votes.begin();
+									while(it != votes.end() && it->first != t) {
+										++it;
+									}
+									if(it == votes.end()) {
+										votes.push_back(std::make_pair(t, 1));
+									} else {
+										++it->second;
+									}
+								}
+							}
+						}
+						b = empty_block;
+						int best = 0;
+						for(auto it = votes.begin(); it != votes.end(); ++it) {
+							if(it->second > best) {
+								b = it->first;
+								best = it->second;
+							}
+						}
+					}
+					cells[(y + 1) * stride[1] + (z + 1) * stride[2] + x + 1] = b;
+				}
+			}
+		}
+
+		// Only a neighbour which is solid throughout hides border faces.
+		for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+			const chunk* nb = nh.neighbour(d);
+			if(nb == NULL || !nb->is_uniform() || nb->is_empty()) {
+				continue;
+			}
+			const int a = direction_axis[d];
+			const int u = (a + 1) % 3, v = (a + 2) % 3;
+			int p[3];
+			p[a] = direction_offset[d][a] > 0 ? n : -1;
+			for(p[v] = 0; p[v] != n; ++p[v]) {
+				for(p[u] = 0; p[u] != n; ++p[u]) {
+					cells[(p[1] + 1) * stride[1] + (p[2] + 1) * stride[2] + p[0] + 1] = nb->uniform_type();
+				}
+			}
+		}
+
+		static const int no_ao[4] = { 3, 3, 3, 3 };
+		std::vector<block_id> mask(n * n);
+		for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+			const int a = direction_axis[d];
+			const int u = a == 0 ? 2 : 0;
+			const int v = 3 - a - u;
+			const int facing = direction_offset[d][0] * stride[0] + direction_offset[d][1] * stride[1] + direction_offset[d][2] * stride[2];
+			for(int s = 0; s != n; ++s) {
+				bool any = false;
+				int p[3];
+				p[a] = s;
+				for(p[v] = 0; p[v] != n; ++p[v]) {
+					for(p[u] = 0; p[u] != n; ++p[u]) {
+						const int idx = (p[1] + 1) * stride[1] + (p[2] + 1) * stride[2] + p[0] + 1;
+						const block_id b = cells[idx + facing] == empty_block ? cells[idx] : empty_block;
+						mask[p[v] * n + p[u]] = b;
+						any |= b != empty_block;
+					}
+				}
+				if(!any) {
+					continue;
+				}
+
+				for(int j = 0; j != n; ++j) {
+					for(int i = 0; i != n; ) {
+						const block_id b = mask[j * n + i];
+						if(b == empty_block) {
+							++i;
+							continue;
+						}
+						int w = 1;
+						while(i + w != n && mask[j * n + i + w] == b) {
+							++w;
+						}
+						int h = 1;
+						for(; j + h != n; ++h) {
+							const block_id* row = &mask[(j + h) * n + i];
+							if(std::find_if(row, row + w, [b](block_id m) { return m != b; }) != row + w) {
+								break;
+							}
+						}
+						for(int k = 0; k != h; ++k) {
+							std::fill(mask.begin() + (j + k) * n + i, mask.begin() + (j + k) * n + i + w, empty_block);
+						}
+
+						int sz[3];
+						sz[a] = scale;
+						sz[u] = w * scale;
+						sz[v] = h * scale;
+						p[u] = i;
+						p[v] = j;
+						add_quad(out, d, p[0] * scale, p[1] * scale, p[2] * scale, sz[0], sz[1], sz[2], b, no_ao);
+						i += w;
+					}
+				}
+			}
+		}
+	}
+
+	void merge_solid_boxes(const chunk& c, std::vector<block_box>& out)
+	{
+		if(c.is_uniform()) {
+			if(!c.is_empty()) {
+				const block_box b = { 0, 0, 0, chunk_size, chunk_size, chunk_size };
+				out.push_back(b);
+			}
+			return;
+		}
+
+		// Solid blocks not yet in a box, bit x of rows[y][z].
+		uint32_t rows[chunk_size][chunk_size];
+		for(int y = 0; y != chunk_size; ++y) {
+			for(int z = 0; z != chunk_size; ++z) {
+				uint32_t row = 0;
+				const int n = chunk::index(0, y, z);
+				for(int x = 0; x != chunk_size; ++x) {
+					if(c.get_index(n + x) != empty_block) {
+						row |= 1u << x;
+					}
+				}
+				rows[y][z] = row;
+			}
+		}
+
+		for(int y = 0; y != chunk_size; ++y) {
+			for(int z = 0; z != chunk_size; ++z) {
+				while(rows[y][z] != 0) {
+					const uint32_t row = rows[y][z];
+					int x = 0;
+					while((row & (1u << x)) == 0) {
+						++x;
+					}
+					int w = 1;
+					while(x + w != chunk_size && (row & (1u << (x + w))) != 0) {
+						++w;
+					}
+					const uint32_t run = (w == chunk_size ? ~0u : (1u << w) - 1) << x;
+
+					int d = 1;
+					while(z + d != chunk_size && (rows[y][z + d] & run) == run) {
+						++d;
+					}
+					int h = 1;
+					for(bool grow = true; grow && y + h != chunk_size; ) {
+						for(int k = z; k != z + d && grow; ++k) {
+							grow = (rows[y + h][k] & run) == run;
+						}
+						if(grow) {
+							++h;
+						}
+					}
+
+					for(int j = y; j != y + h; ++j) {
+						for(int k = z; k != z + d; ++k) {
+							rows[j][k] &= ~run;
+						}
+					}
+					const block_box b = { x, y, z, w, h, d };
+					out.push_back(b);
+				}
+			}
+		}
+	}
+
+	void mesh_chunk(const chunk_map& cm, int cx, int cy, int cz, mesh_mode mode, chunk_mesh& out)
+	{
+		mesh_chunk(chunk_neighbourhood(cm, cx, cy, cz), mode, out);
+	}
+
+	void mesh_chunk(const chunk_neighbourhood& nh, mesh_mode mode, chunk_mesh& out)
+	{
+		if(nh.center() == NULL || nh.center()->is_empty()) {
+			return;
+		}
+		out.solid_height = solid_height(*nh.center());
+		out.connectivity = compute_connectivity(*nh.center());
+		switch(mode) {
+		case MESH_NAIVE:	mesh_naive(nh, out); break;
+		case MESH_GREEDY:	mesh_greedy(nh, out); break;
+		default:
+			ASSERT_LOG(false, "mesh_chunk() unknown mesh mode: " << mode);
+		}
+	}
+}
+
+UNIT_TEST(chunk_mesher)
+{
+	cube::chunk_map cm;
+	cube::chunk_mesh naive, greedy;
+
+	const cube::packed_vertex pv = cube::pack_vertex(32, 17, 5, cube::BOTTOM, 200, 2);
+	CHECK_EQ(cube::vertex_x(pv), 32);
+	CHECK_EQ(cube::vertex_y(pv), 17);
+	CHECK_EQ(cube::vertex_z(pv), 5);
+	CHECK_EQ(cube::vertex_direction(pv), cube::BOTTOM);
+	CHECK_EQ(cube::vertex_texture(pv), 200);
+	CHECK_EQ(cube::vertex_ao(pv), 2);
+
+	// A single block has six faces in either mode.
+	cm.set_block(3, 4, 5, 1);
+	cube::mesh_chunk(cm, 0, 0, 0, cube::MESH_NAIVE, naive);
+	cube::mesh_chunk(cm, 0, 0, 0, cube::MESH_GREEDY, greedy);
+	CHECK_EQ(naive.quad_count(), 6);
+	CHECK_EQ(greedy.quad_count(), 6);
+
+	// A flat 32x32 slab merges into one quad per side.
+	naive.clear();
+	greedy.clear();
+	for(int z = 0; z != cube::chunk_size; ++z) {
+		for(int x = 0; x != cube::chunk_size; ++x) {
+			cm.set_block(x, 4, z, 1);
+		}
+	}
+	cube::mesh_chunk(cm, 0, 0, 0, cube::MESH_NAIVE, naive);
+	cube::mesh_chunk(cm, 0, 0, 0, cube::MESH_GREEDY, greedy);
+	CHECK_EQ(naive.quad_count(), 2*32*32 + 4*32);
+	CHECK_EQ(greedy.quad_count(), 6);
+
+	// Different block types don't merge.
+	cm.set_block(0, 4, 0, 2);
+	greedy.clear();
+	cube::mesh_chunk(cm, 0, 0, 0, cube::MESH_GREEDY, greedy);
+	CHECK_GT(greedy.quad_count(), 10);
+
+	// Faces against solid neighbouring chunks are hidden.
+	cm.get_or_create_chunk(0, -1, 0)->fill(1);
+	cm.get_or_create_chunk(0, -2, 0)->fill(1);
+	cube::chunk_mesh bottom;
+	cube::mesh_chunk(cm, 0, -2, 0, cube::MESH_GREEDY, bottom);
+	CHECK_EQ(bottom.vertices[cube::TOP].size(), 0);
+	CHECK_EQ(bottom.vertices[cube::BOTTOM].size(), 6);
+	CHECK_EQ(bottom.solid_height, cube::chunk_size);
+	CHECK_EQ(greedy.solid_height, 0);
+
+	// A block above and to the right darkens the right hand corners of the
+	// top face.
+	cube::chunk_map ao_map;
+	ao_map.set_block(10, 10, 10, 1);
+	ao_map.set_block(11, 11, 10, 1);
+	cube::chunk_mesh ao_mesh;
+	cube::mesh_chunk(ao_map, 0, 0, 0, cube::MESH_NAIVE, ao_mesh);
+	int occluded = 0;
+	for(auto it = ao_mesh.vertices[cube::TOP].begin(); it != ao_mesh.vertices[cube::TOP].end(); ++it) {
+		if(cube::vertex_y(*it) == 11 && cube::vertex_ao(*it) != 3) {
+			CHECK_EQ(cube::vertex_x(*it), 11);
+			CHECK_EQ(cube::vertex_ao(*it), 2);
+			++occluded;
+		}
+	}
+	CHECK_EQ(occluded, 3);
+
+	// Coarser levels round solid cells outwards and take the commonest type.
+	cube::chunk_map lod_map;
+	lod_map.set_block(3, 4, 5, 1);
+	lod_map.set_block(3, 5, 5, 2);
+	lod_map.set_block(2, 5, 5, 2);
+	cube::chunk_mesh lod;
+	cube::mesh_chunk_lod(cube::chunk_neighbourhood(lod_map, 0, 0, 0), 3, lod);
+	CHECK_EQ(lod.quad_count(), 6);
+	CHECK_EQ(cube::vertex_texture(lod.vertices[cube::TOP][0]), 2);
+	for(auto it = lod.vertices[cube::TOP].begin(); it != lod.vertices[cube::TOP].end(); ++it) {
+		CHECK_EQ(cube::vertex_y(*it), 8);
+	}
+
+	// Border faces stay as skirts unless the neighbour is solid.
+	lod.clear();
+	cube::mesh_chunk_lod(cube::chunk_neighbourhood(cm, 0, -1, 0), 1, lod);
+	CHECK_EQ(lod.vertices[cube::TOP].size(), 6);
+	CHECK_EQ(lod.vertices[cube::BOTTOM].size(), 0);
+	CHECK_EQ(lod.vertices[cube::LEFT].size(), 6);
+}
+
+UNIT_TEST(chunk_solid_boxes)
+{
+	std::vector<cube::block_box> boxes;
+	cube::merge_solid_boxes(cube::chunk(0, 0, 0, 3), boxes);
+	CHECK_EQ(boxes.size(), 1);
+	CHECK_EQ(boxes[0].sy, cube::chunk_size);
+
+	// Two steps of terrain, with a hole through the lower one.
+	cube::chunk c(0, 0, 0);
+	for(int z = 0; z != cube::chunk_size; ++z) {
+		for(int x = 0; x != cube::chunk_size; ++x) {
+			c.fill_column(x, z, 0, x < 16 ? 10 : 4, cube::block_id(1 + (x + z) % 3));
+		}
+	}
+	c.set(20, 2, 7, cube::empty_block);
+	boxes.clear();
+	cube::merge_solid_boxes(c, boxes);
+	CHECK_LE(boxes.size(), 8);
+
+	// Every solid block is covered exactly once.
+	std::vector<int> covered(cube::chunk_volume);
+	for(auto it = boxes.begin(); it != boxes.end(); ++it) {
+		for(int y = it->y; y != it->y + it->sy; ++y) {
+			for(int z = it->z; z != it->z + it->sz; ++z) {
+				for(int x = it->x; x != it->x + it->sx; ++x) {
+					++covered[cube::chunk::index(x, y, z)];
+				}
+			}
+		}
+	}
+	for(int n = 0; n != cube::chunk_volume; ++n) {
+		CHECK_EQ(covered[n], c.get_index(n) != cube::empty_block ? 1 : 0);
+	}
+}
+
+UNIT_TEST(chunk_face_cull)
+{
+	cube::chunk_map cm;
+	for(int n = 0; n != 3000; ++n) {
+		cm.set_block((n * 7) % 34 - 1, (n * 13) % 34 - 1, (n * 29) % 34 - 1, cube::block_id(1 + n % 3));
+	}
+	std::vector<cube::block_id> padded;
+	cube::fill_padded(cube::chunk_neighbourhood(cm, 0, 0, 0), padded);
+	std::vector<cube::column_mask> columns(cube::column_grid_area);
+	cube::fill_columns(padded, &columns[0]);
+	cube::face_masks faces, expected;
+	cube::cull_faces(&columns[0], faces);
+	for(int z = 0; z != cube::chunk_size; ++z) {
+		for(int x = 0; x != cube::chunk_size; ++x) {
+			cube::cull_column(&columns[0], x, z, expected);
+		}
+	}
+	for(int d = 0; d != cube::NUM_DIRECTIONS; ++d) {
+		for(int y = 0; y != cube::chunk_size; ++y) {
+			for(int z = 0; z != cube::chunk_size; ++z) {
+				for(int x = 0; x != cube::chunk_size; ++x) {
+					const int n = cube::padded_index(x, y, z);
+					const bool visible = padded[n] != cube::empty_block && padded[n + cube::padded_offset(d)] == cube::empty_block;
+					const int i = z * cube::chunk_size + x;
+					CHECK_EQ((faces.columns[d][i] >> y) & 1, uint32_t(visible));
+					CHECK_EQ((expected.columns[d][i] >> y) & 1, uint32_t(visible));
+				}
+			}
+		}
+	}
+}
+
+namespace
+{
+	// Rolling terrain crossing the chunk at 1, 0, 1.
+	const cube::chunk_map& benchmark_terrain()
+	{
+		static cube::chunk_map res;
+		if(res.num_chunks() == 0) {
+			test::build_rolling_terrain(res, 3 * cube::chunk_size, 16, 16, 0.3, 0.2);
+		}
+		return res;
+	}
+}
+
+// Hidden face removal one block face at a time, as mesh_naive() does.
+BENCHMARK(cube_cull_blocks)
+{
+	std::vector<cube::block_id> padded;
+	cube::fill_padded(cube::chunk_neighbourhood(benchmark_terrain(), 1, 0, 1), padded);
+	size_t visible = 0;
+	BENCHMARK_LOOP {
+		for(int y = 0; y != cube::chunk_size; ++y) {
+			for(int z = 0; z != cube::chunk_size; ++z) {
+				for(int x = 0; x != cube::chunk_size; ++x) {
+					const int n = cube::padded_index(x, y, z);
+					if(padded[n] == cube::empty_block) {
+						continue;
+					}
+					for(int d = 0; d != cube::NUM_DIRECTIONS; ++d) {
+						visible += padded[n + cube::padded_offset(d)] == cube::empty_block;
+					}
+				}
+			}
+		}
+	}
+	benchmark_sink = visible;
+}
+
+// The same using column masks, as mesh_greedy() does.
+BENCHMARK(cube_cull_columns)
+{
+	std::vector<cube::block_id> padded;
+	cube::fill_padded(cube::chunk_neighbourhood(benchmark_terrain(), 1, 0, 1), padded);
+	std::vector<cube::column_mask> columns(cube::column_grid_area);
+	cube::face_masks faces;
+	BENCHMARK_LOOP {
+		cube::fill_columns(padded, &columns[0]);
+		cube::cull_faces(&columns[0], faces);
+	}
+	benchmark_sink = faces.columns[cube::TOP][0];
+}
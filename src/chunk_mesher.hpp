@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hpp"
+#include "chunk_visibility.hpp"
+
+namespace cube
+{
+	class column_map;
+
+	enum mesh_mode
+	{
+		// One quad per visible block face.
+		MESH_NAIVE,
+		// Coplanar adjacent faces of the same block type are merged into
+		// maximal rectangles.
+		MESH_GREEDY,
+	};
+
+	// Vertex packed into 32 bits. Co-ordinates are local to the chunk, in the
+	// range [0, chunk_size]. The fields are byte aligned so the shader can read
+	// the vertex as four unsigned bytes, since GLSL 1.10 has no integer
+	// attributes:
+	//   byte 0: x | ao << 6
+	//   byte 1: y | (direction & 3) << 6
+	//   byte 2: z | (direction >> 2) << 6
+	//   byte 3: texture index
+	// ao is 0 for a fully occluded corner up to 3 for no occlusion. The
+	// texture index is the block_id, which must be below num_block_tiles to
+	// fit, see data/chunk.frag.
+	typedef uint32_t packed_vertex;
+	const int num_block_tiles = 256;
+
+	inline packed_vertex pack_vertex(int x, int y, int z, int direction, int texture, int ao)
+	{
+		return packed_vertex(x | ao << 6)
+			| packed_vertex(y | (direction & 3) << 6) << 8
+			| packed_vertex(z | (direction >> 2) << 6) << 16
+			| packed_vertex(texture & 0xff) << 24;
+	}
+	inline int vertex_x(packed_vertex v) { return v & 0x3f; }
+	inline int vertex_y(packed_vertex v) { return (v >> 8) & 0x3f; }
+	inline int vertex_z(packed_vertex v) { return (v >> 16) & 0x3f; }
+	inline int vertex_ao(packed_vertex v) { return (v >> 6) & 3; }
+	inline int vertex_direction(packed_vertex v) { return ((v >> 14) & 3) | ((v >> 20) & 4); }
+	inline int vertex_texture(packed_vertex v) { return v >> 24; }
+
+	// CPU side mesh of a single chunk, two triangles per quad, bucketed by
+	// face direction.
+	struct chunk_mesh
+	{
+		chunk_mesh();
+
+		std::vector<packed_vertex> vertices[NUM_DIRECTIONS];
+		// Height of the slab at the bottom of the chunk which is solid in
+		// every column, so usable as an occluder. 0 if there is none.
+		int solid_height;
+		// Which faces of the chunk are joined through empty space.
+		face_connectivity connectivity;
+
+		void clear();
+		size_t vertex_count() const;
+		size_t quad_count() const { return vertex_count() / 6; }
+		size_t memory_usage() const { return vertex_count() * sizeof(packed_vertex); }
+	};
+
+	// Appends the mesh for the chunk at cx, cy, cz to out. Faces against a
+	// chunk which isn't present in cm are treated as visible.
+	void mesh_chunk(const chunk_map& cm, int cx, int cy, int cz, mesh_mode mode, chunk_mesh& out);
+	// As above, but only touches the chunks held by nh. This may be called from
+	// a worker thread while the chunk_map is modified, provided the chunks in
+	// nh are not.
+	void mesh_chunk(const chunk_neighbourhood& nh, mesh_mode mode, chunk_mesh& out);
+
+	// Greedy meshes the chunk at cx, cy, cz straight from the runs of cols,
+	// without building any chunks. The faces are the same as mesh_chunk()
+	// would give for the chunks paged in from cols, but connectivity is left
+	// as all faces connected.
+	void mesh_chunk(const column_map& cols, int cx, int cy, int cz, chunk_mesh& out);
+
+	// Detail levels meshed for each chunk. Level l merges cubes of 2^l blocks
+	// along each side into one cell, level 0 being full detail.
+	const int num_lod_levels = 4;
+
+	// Appends a reduced detail greedy mesh of the chunk, for level 1 up to
+	// num_lod_levels - 1. A cell is solid if any of its blocks are, taking
+	// the most common solid type, so the surface never sinks below the full
+	// detail one. Faces on the chunk border are kept unless the neighbour is
+	// entirely solid; these skirts cover the cracks against neighbours drawn
+	// at another level. Vertices have no ambient occlusion.
+	void mesh_chunk_lod(const chunk_neighbourhood& nh, int level, chunk_mesh& out);
+
+	// Solid blocks in a column of the chunk along y, including the border
+	// block below and above: bit y + 1 is set when the block at local y is
+	// solid, for y from -1 to chunk_size.
+	typedef uint64_t column_mask;
+	// Columns cover the chunk plus a one block border in x and z, indexed by
+	// (z + 1) * column_grid_size + x + 1.
+	const int column_grid_size = chunk_size + 2;
+	const int column_grid_area = column_grid_size * column_grid_size;
+
+	// Visible faces of each column of the chunk for each direction, bit y
+	// set when the block at local y has a face that way. Indexed by
+	// z * chunk_size + x.
+	struct face_masks
+	{
+		uint32_t columns[NUM_DIRECTIONS][chunk_area];
+	};
+
+	// Finds every visible face in the chunk from its column masks, a whole
+	// column at a time with shifts and AND-NOT. Uses SSE2 where available.
+	void cull_faces(const column_mask* columns, face_masks& out);
+
+	// Appends a quad covering sx*sy*sz blocks starting at local block x, y, z.
+	// The size along the axis of the face normal is the thickness of the
+	// cell, 1 for a single block. ao holds the occlusion of the face corners
+	// in the order given by face_corner().
+	void add_quad(chunk_mesh& out, int direction, int x, int y, int z, int sx, int sy, int sz, int texture, const int ao[4]);
+
+	// Corner n of a unit cube face, counter-clockwise when viewed from outside.
+	const int* face_corner(int direction, int n);
+
+	// Appends boxes, in local co-ordinates, which exactly cover the solid
+	// blocks of c without overlapping, ignoring block types. Runs along x are
+	// grown greedily along z and then y, so a heightmap chunk gives roughly
+	// one box per step in the terrain. A uniform solid chunk is a single box.
+	// Suited to collision shapes, where the faces between boxes don't matter.
+	void merge_solid_boxes(const chunk& c, std::vector<block_box>& out);
+
+	// Index of the axis (0 = x, 1 = y, 2 = z) a face direction points along.
+	extern const int direction_axis[NUM_DIRECTIONS];
+}
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <boost/bind.hpp>
+
+#include "asserts.hpp"
+#include "chunk_query.hpp"
+#include "test_terrain.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		// Face entered by stepping along each axis, backwards then forwards.
+		const int entry_face[3][2] = {
+			{ RIGHT, LEFT },
+			{ TOP, BOTTOM },
+			{ FRONT, BACK },
+		};
+
+		// Rays cast by each job of a batch is at least this many.
+		const size_t min_rays_per_job = 256;
+
+		struct batch_state
+		{
+			boost::mutex guard;
+			boost::condition_variable done;
+			int remaining;
+		};
+
+		void cast_range(const chunk_map& cm, const std::vector<ray>& rays, std::vector<ray_hit>& hits, size_t first, size_t last)
+		{
+			for(size_t n = first; n != last; ++n) {
+				raycast(cm, rays[n], hits[n]);
+			}
+		}
+
+		void cast_job(const chunk_map* cm, const std::vector<ray>* rays, std::vector<ray_hit>* hits, size_t first, size_t last, batch_state* state)
+		{
+			cast_range(*cm, *rays, *hits, first, last);
+			boost::mutex::scoped_lock lock(state->guard);
+			if(--state->remaining == 0) {
+				state->done.notify_one();
+			}
+		}
+	}
+
+	ray::ray()
+		: origin(0.0f), direction(0.0f, 0.0f, 1.0f), max_distance(0.0f)
+	{
+	}
+
+	ray::ray(const glm::vec3& o, const glm::vec3& d, float max_dist)
+		: origin(o), direction(d), max_distance(max_dist)
+	{
+	}
+
+	ray_hit::ray_hit()
+		: hit(false), x(0), y(0), z(0), type(empty_block), face(NUM_DIRECTIONS), distance(0.0f)
+	{
+	}
+
+	bool raycast(const chunk_map& cm, const ray& r, ray_hit& hit)
+	{
+		ASSERT_LOG(r.max_distance >= 0.0f && r.max_distance <= std::numeric_limits<float>::max(),
+			"raycast() max_distance must be finite: " << r.max_distance);
+		hit = ray_hit();
+		const float len = glm::length(r.direction);
+		const glm::vec3 d = len > 0.0f ? r.direction / len : glm::vec3(0.0f);
+
+		// t_max is the distance along the ray to the next block boundary on
+		// each axis, t_delta the distance between boundaries.
+		int pos[3], step[3];
+		float t_max[3], t_delta[3];
+		for(int a = 0; a != 3; ++a) {
+			pos[a] = int(std::floor(r.origin[a]));
+			if(d[a] > 0.0f) {
+				step[a] = 1;
+				t_delta[a] = 1.0f / d[a];
+				t_max[a] = (pos[a] + 1 - r.origin[a]) * t_delta[a];
+			} else if(d[a] < 0.0f) {
+				step[a] = -1;
+				t_delta[a] = -1.0f / d[a];
+				t_max[a] = (r.origin[a] - pos[a]) * t_delta[a];
+			} else {
+				step[a] = 0;
+				t_delta[a] = t_max[a] = std::numeric_limits<float>::infinity();
+			}
+		}
+
+		// The chunk holding pos, looked up again only on crossing into
+		// another.
+		int current[3] = { chunk_map::to_chunk(pos[0]), chunk_map::to_chunk(pos[1]), chunk_map::to_chunk(pos[2]) };
+		const chunk* c = cm.resident_chunk(current[0], current[1], current[2]);
+		float t = 0.0f;
+		int face = NUM_DIRECTIONS;
+		for(;;) {
+			if(c != NULL && !c->is_empty()) {
+				const block_id b = c->get(chunk_map::to_local(pos[0]), chunk_map::to_local(pos[1]), chunk_map::to_local(pos[2]));
+				if(b != empty_block) {
+					hit.hit = true;
+					hit.x = pos[0];
+					hit.y = pos[1];
+					hit.z = pos[2];
+					hit.type = b;
+					hit.face = face;
+					hit.distance = t;
+					return true;
+				}
+			}
+
+			const int a = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+			t = t_max[a];
+			if(t > r.max_distance) {
+				return false;
+			}
+			t_max[a] += t_delta[a];
+			pos[a] += step[a];
+			face = entry_face[a][step[a] > 0];
+			if(chunk_map::to_chunk(pos[a]) != current[a]) {
+				current[a] = chunk_map::to_chunk(pos[a]);
+				c = cm.resident_chunk(current[0], current[1], current[2]);
+			}
+		}
+	}
+
+	void raycast_batch(const chunk_map& cm, const std::vector<ray>& rays, std::vector<ray_hit>& hits, threading::pool& p)
+	{
+		hits.resize(rays.size());
+		const size_t parts = std::min(size_t(p.num_threads() + 1), (rays.size() + min_rays_per_job - 1) / min_rays_per_job);
+		if(parts <= 1) {
+			cast_range(cm, rays, hits, 0, rays.size());
+			return;
+		}
+
+		// The calling thread casts the first part itself.
+		batch_state state;
+		state.remaining = int(parts - 1);
+		const size_t per_part = (rays.size() + parts - 1) / parts;
+		for(size_t n = 1; n != parts; ++n) {
+			p.add_job(boost::bind(cast_job, &cm, &rays, &hits, n * per_part, std::min(rays.size(), (n + 1) * per_part), &state));
+		}
+		cast_range(cm, rays, hits, 0, per_part);
+
+		boost::mutex::scoped_lock lock(state.guard);
+		while(state.remaining != 0) {
+			state.done.wait(lock);
+		}
+	}
+
+	void query_region(const chunk_map& cm, const graphics::aabb& box, std::vector<block_position>& out)
+	{
+		if(box.empty()) {
+			return;
+		}
+		// Blocks overlapping the box, inclusive.
+		int lo[3], hi[3];
+		for(int a = 0; a != 3; ++a) {
+			lo[a] = int(std::floor(box.min[a]));
+			hi[a] = int(std::ceil(box.max[a])) - 1;
+		}
+
+		for(int cy = chunk_map::to_chunk(lo[1]); cy <= chunk_map::to_chunk(hi[1]); ++cy) {
+			for(int cz = chunk_map::to_chunk(lo[2]); cz <= chunk_map::to_chunk(hi[2]); ++cz) {
+				for(int cx = chunk_map::to_chunk(lo[0]); cx <= chunk_map::to_chunk(hi[0]); ++cx) {
+					const chunk* c = cm.resident_chunk(cx, cy, cz);
+					if(c == NULL || c->is_empty()) {
+						continue;
+					}
+					const int x0 = cx * chunk_size, y0 = cy * chunk_size, z0 = cz * chunk_size;
+					const int x1 = std::max(lo[0], x0), x2 = std::min(hi[0], x0 + chunk_mask);
+					const int y1 = std::max(lo[1], y0), y2 = std::min(hi[1], y0 + chunk_mask);
+					const int z1 = std::max(lo[2], z0), z2 = std::min(hi[2], z0 + chunk_mask);
+					for(int y = y1; y <= y2; ++y) {
+						for(int z = z1; z <= z2; ++z) {
+							for(int x = x1; x <= x2; ++x) {
+								const block_id b = c->get(x - x0, y - y0, z - z0);
+								if(b != empty_block) {
+									const block_position p = { x, y, z, b };
+									out.push_back(p);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+UNIT_TEST(chunk_query)
+{
+	cube::chunk_map cm;
+	cm.set_block(5, 3, 40, 2);
+	cm.set_block(-3, 3, 3, 4);
+
+	// Straight down the z axis, crossing into the next chunk.
+	cube::ray_hit hit;
+	CHECK_EQ(cube::raycast(cm, cube::ray(glm::vec3(5.5f, 3.5f, 0.5f), glm::vec3(0.0f, 0.0f, 1.0f), 100.0f), hit), true);
+	CHECK_EQ(hit.x, 5);
+	CHECK_EQ(hit.z, 40);
+	CHECK_EQ(hit.type, 2);
+	CHECK_EQ(hit.face, cube::BACK);
+	CHECK_LT(std::abs(hit.distance - 39.5f), 1e-4f);
+	CHECK_EQ(cube::raycast(cm, cube::ray(glm::vec3(5.5f, 3.5f, 0.5f), glm::vec3(0.0f, 0.0f, 1.0f), 39.0f), hit), false);
+
+	// Diagonally towards negative x, into a chunk at negative co-ordinates.
+	CHECK_EQ(cube::raycast(cm, cube::ray(glm::vec3(2.5f, 3.5f, 3.5f), glm::vec3(-1.0f, 0.0f, 0.0f), 10.0f), hit), true);
+	CHECK_EQ(hit.x, -3);
+	CHECK_EQ(hit.face, cube::RIGHT);
+	CHECK_EQ(cube::raycast(cm, cube::ray(glm::vec3(4.0f, 5.0f, 3.5f), glm::vec3(-1.0f, -0.3f, 0.0f), 10.0f), hit), true);
+	CHECK_EQ(hit.x, -3);
+	CHECK_EQ(hit.y, 3);
+	CHECK_EQ(cube::raycast(cm, cube::ray(glm::vec3(-1.5f, 3.5f, 3.5f), glm::vec3(1.0f, 0.0f, 0.0f), 10.0f), hit), false);
+
+	// Starting inside a block.
+	CHECK_EQ(cube::raycast(cm, cube::ray(glm::vec3(-2.5f, 3.5f, 3.5f), glm::vec3(0.0f, 1.0f, 0.0f), 0.0f), hit), true);
+	CHECK_EQ(hit.face, cube::NUM_DIRECTIONS);
+	CHECK_EQ(hit.distance, 0.0f);
+
+	// A batch split across threads gives the same answers.
+	cm.get_or_create_chunk(0, -1, 0)->fill(1);
+	std::vector<cube::ray> rays;
+	for(int n = 0; n != 2000; ++n) {
+		rays.push_back(cube::ray(glm::vec3(float(n % 40), 20.0f, float(n % 17)), glm::vec3(float(n % 7) - 3.0f, -1.0f, float(n % 5) - 2.0f), 60.0f));
+	}
+	std::vector<cube::ray_hit> hits;
+	threading::pool p(3);
+	cube::raycast_batch(cm, rays, hits, p);
+	CHECK_EQ(hits.size(), rays.size());
+	for(size_t n = 0; n != rays.size(); ++n) {
+		cube::raycast(cm, rays[n], hit);
+		CHECK_EQ(hits[n].hit, hit.hit);
+		CHECK_EQ(hits[n].x, hit.x);
+		CHECK_EQ(hits[n].y, hit.y);
+		CHECK_EQ(hits[n].z, hit.z);
+	}
+
+	std::vector<cube::block_position> blocks;
+	cube::query_region(cm, graphics::aabb(glm::vec3(-4.0f, -2.0f, 2.5f), glm::vec3(6.0f, 3.5f, 41.0f)), blocks);
+	// 6 x 2 x 30 blocks of the solid chunk, plus the two blocks set.
+	CHECK_EQ(blocks.size(), 6 * 2 * 30 + 2);
+}
+
+namespace
+{
+	const cube::chunk_map& benchmark_terrain()
+	{
+		static cube::chunk_map res;
+		if(res.num_chunks() == 0) {
+			test::build_rolling_terrain(res, 256, 40, 20, 0.05, 0.04);
+		}
+		return res;
+	}
+}
+
+// Sight lines between random points above the terrain.
+BENCHMARK(cube_raycast_batch)
+{
+	const cube::chunk_map& cm = benchmark_terrain();
+	std::vector<cube::ray> rays;
+	unsigned seed = 1;
+	for(int n = 0; n != 4096; ++n) {
+		glm::vec3 p[2];
+		for(int k = 0; k != 2; ++k) {
+			seed = seed * 1103515245 + 12345;
+			p[k] = glm::vec3(float((seed >> 8) % 256), 50.0f + float((seed >> 4) % 16), float((seed >> 16) % 256));
+		}
+		rays.push_back(cube::ray(p[0], p[1] - p[0], glm::length(p[1] - p[0])));
+	}
+	std::vector<cube::ray_hit> hits;
+	BENCHMARK_LOOP {
+		cube::raycast_batch(cm, rays, hits);
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "chunk.hpp"
+#include "frustum.hpp"
+#include "thread_pool.hpp"
+
+namespace cube
+{
+	struct ray
+	{
+		ray();
+		ray(const glm::vec3& o, const glm::vec3& d, float max_dist);
+
+		glm::vec3 origin;
+		// Needn't be normalised.
+		glm::vec3 direction;
+		// In blocks along the ray.
+		float max_distance;
+	};
+
+	struct ray_hit
+	{
+		ray_hit();
+
+		bool hit;
+		int x, y, z;
+		block_id type;
+		// Face of the block the ray entered through, NUM_DIRECTIONS if the
+		// ray started inside it.
+		int face;
+		float distance;
+	};
+
+	// Walks the blocks the ray passes through in order, stopping at the
+	// first solid one (Amanatides & Woo). Only chunks already in cm are
+	// looked at, none are paged in, so any number of threads may cast rays
+	// at once while nothing modifies cm. Returns hit.hit.
+	bool raycast(const chunk_map& cm, const ray& r, ray_hit& hit);
+
+	// Casts every ray, in batches spread across the pool's threads and the
+	// calling one, returning once all are done. hits is resized to match.
+	void raycast_batch(const chunk_map& cm, const std::vector<ray>& rays, std::vector<ray_hit>& hits, threading::pool& p);
+	inline void raycast_batch(const chunk_map& cm, const std::vector<ray>& rays, std::vector<ray_hit>& hits)
+	{
+		raycast_batch(cm, rays, hits, threading::get_pool());
+	}
+
+	struct block_position
+	{
+		int x, y, z;
+		block_id type;
+	};
+
+	// Appends each solid block overlapping box, in no particular order. As
+	// with raycast(), no chunks are paged in.
+	void query_region(const chunk_map& cm, const graphics::aabb& box, std::vector<block_position>& out);
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "chunk.hpp"
+#include "chunk_stream.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	stream_queue::stream_queue()
+		: radius_(0), has_focus_(false), next_(0), load_next_(0)
+	{
+		focus_[0] = focus_[1] = focus_[2] = 0;
+	}
+
+	void stream_queue::set_radius(int radius)
+	{
+		ASSERT_LOG(radius >= 0, "stream_queue::set_radius(): negative radius " << radius);
+		radius_ = radius;
+		rebuild();
+	}
+
+	bool stream_queue::set_focus(int cx, int cy, int cz)
+	{
+		if(has_focus_ && cx == focus_[0] && cy == focus_[1] && cz == focus_[2]) {
+			return false;
+		}
+		has_focus_ = true;
+		focus_[0] = cx;
+		focus_[1] = cy;
+		focus_[2] = cz;
+		rebuild();
+		return true;
+	}
+
+	bool stream_queue::in_radius(uint64_t key) const
+	{
+		if(!active()) {
+			return false;
+		}
+		int cx, cy, cz;
+		chunk_map::from_key(key, cx, cy, cz);
+		const int dx = cx - focus_[0], dy = cy - focus_[1], dz = cz - focus_[2];
+		return dx * dx + dy * dy + dz * dz <= radius_ * radius_;
+	}
+
+	bool stream_queue::pop()
+	{
+		ASSERT_LOG(next_ != queue_.size(), "stream_queue::pop(): queue is empty");
+		return streamed_.insert(queue_[next_++]).second;
+	}
+
+	bool stream_queue::next_load(uint64_t& key)
+	{
+		load_next_ = std::max(load_next_, next_);
+		if(load_next_ == queue_.size()) {
+			return false;
+		}
+		key = queue_[load_next_++];
+		return true;
+	}
+
+	void stream_queue::evict(uint64_t key)
+	{
+		// Queued after everything else, as whatever evicted it was most
+		// likely in less need of it than the chunks already waiting.
+		if(streamed_.erase(key) != 0 && in_radius(key)) {
+			queue_.push_back(key);
+		}
+	}
+
+	void stream_queue::rebuild()
+	{
+		queue_.clear();
+		next_ = 0;
+		load_next_ = 0;
+		if(!active()) {
+			return;
+		}
+		const int r = radius_;
+		std::vector<std::pair<int, uint64_t> > keys;
+		for(int dy = -r; dy <= r; ++dy) {
+			for(int dz = -r; dz <= r; ++dz) {
+				for(int dx = -r; dx <= r; ++dx) {
+					const int d2 = dx * dx + dy * dy + dz * dz;
+					const uint64_t key = chunk_map::key(focus_[0] + dx, focus_[1] + dy, focus_[2] + dz);
+					if(d2 <= r * r && streamed_.count(key) == 0) {
+						keys.push_back(std::make_pair(d2, key));
+					}
+				}
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+		for(auto it = keys.begin(); it != keys.end(); ++it) {
+			queue_.push_back(it->second);
+		}
+	}
+}
+
+UNIT_TEST(stream_queue)
+{
+	cube::stream_queue q;
+	q.set_radius(1);
+	CHECK_EQ(q.queued(), 0);
+	CHECK_EQ(q.set_focus(0, 0, -1), true);
+	CHECK_EQ(q.set_focus(0, 0, -1), false);
+	CHECK_EQ(q.queued(), 7);
+	CHECK_EQ(q.front(), cube::chunk_map::key(0, 0, -1));
+	while(q.queued() != 0) {
+		CHECK_EQ(q.pop(), true);
+	}
+
+	// Evicted chunks inside the radius stream again with the focus
+	// unchanged, those outside don't.
+	const uint64_t near_key = cube::chunk_map::key(1, 0, -1);
+	q.evict(near_key);
+	CHECK_EQ(q.is_streamed(near_key), false);
+	CHECK_EQ(q.queued(), 1);
+	uint64_t key = 0;
+	CHECK_EQ(q.next_load(key), true);
+	CHECK_EQ(key, near_key);
+	CHECK_EQ(q.next_load(key), false);
+	CHECK_EQ(q.front(), near_key);
+	CHECK_EQ(q.pop(), true);
+	CHECK_EQ(q.is_streamed(near_key), true);
+
+	q.set_radius(3);
+	while(q.queued() != 0) {
+		q.pop();
+	}
+	const uint64_t far_key = cube::chunk_map::key(3, 0, -1);
+	q.set_radius(1);
+	q.evict(far_key);
+	CHECK_EQ(q.is_streamed(far_key), false);
+	CHECK_EQ(q.queued(), 0);
+}
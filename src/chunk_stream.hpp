@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <boost/unordered_set.hpp>
+
+namespace cube
+{
+	// The chunks within a radius of a focus point which are yet to be
+	// streamed in, nearest first, along with those which have been. A
+	// chunk that is evicted goes back in the queue if it's still inside
+	// the radius, so it streams in again without the focus having to move.
+	class stream_queue
+	{
+	public:
+		stream_queue();
+
+		// In chunks, 0 means nothing is queued.
+		void set_radius(int radius);
+		int radius() const { return radius_; }
+		// Chunk co-ordinates. Returns false if the focus was already there.
+		bool set_focus(int cx, int cy, int cz);
+		bool active() const { return radius_ > 0 && has_focus_; }
+		bool in_radius(uint64_t key) const;
+
+		// Chunks still queued, including any streamed since being queued.
+		size_t queued() const { return queue_.size() - next_; }
+		// Next chunk to stream, which should only be taken once it's ready.
+		uint64_t front() const { return queue_[next_]; }
+		// Takes the front chunk, returning false if it was already
+		// streamed, in which case there's nothing more to do for it.
+		bool pop();
+		// Chunks to start loading ahead of streaming, in the same order.
+		// Returns false once the loads have caught up with the queue.
+		bool next_load(uint64_t& key);
+
+		bool is_streamed(uint64_t key) const { return streamed_.count(key) != 0; }
+		const boost::unordered_set<uint64_t>& streamed() const { return streamed_; }
+		// The chunk needs loading again before it can be streamed.
+		void evict(uint64_t key);
+	private:
+		void rebuild();
+
+		int radius_;
+		bool has_focus_;
+		int focus_[3];
+		// Those before next_ have been dealt with.
+		std::vector<uint64_t> queue_;
+		size_t next_;
+		// Entries before this have had their loads started.
+		size_t load_next_;
+		// Including ones which turned out empty.
+		boost::unordered_set<uint64_t> streamed_;
+	};
+}
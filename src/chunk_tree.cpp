@@ -0,0 +1,227 @@
+#include <boost/bind.hpp>
+
+#include "asserts.hpp"
+#include "chunk_tree.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	cull_stats::cull_stats()
+		: nodes_tested(0), chunks_tested(0), chunks_culled(0), chunks_visible(0)
+	{
+	}
+
+	chunk_tree::node::node()
+		: x(0), z(0), num_chunks(0), dirty(false)
+	{
+	}
+
+	chunk_tree::chunk_tree()
+	{
+	}
+
+	chunk_tree::~chunk_tree()
+	{
+	}
+
+	void chunk_tree::mark_dirty(int level, uint64_t nkey, node& n)
+	{
+		if(!n.dirty) {
+			n.dirty = true;
+			dirty_[level].push_back(nkey);
+		}
+	}
+
+	void chunk_tree::insert(uint64_t key, const graphics::aabb& box)
+	{
+		int cx, cy, cz;
+		chunk_map::from_key(key, cx, cy, cz);
+
+		const uint64_t leaf_key = node_key(cx, cz);
+		node& leaf = levels_[0][leaf_key];
+		leaf.x = cx;
+		leaf.z = cz;
+		mark_dirty(0, leaf_key, leaf);
+		for(auto it = leaf.items.begin(); it != leaf.items.end(); ++it) {
+			if(it->key == key) {
+				it->box = box;
+				for(int level = 1; level != num_levels; ++level) {
+					const uint64_t nkey = node_key(cx >> level, cz >> level);
+					mark_dirty(level, nkey, levels_[level][nkey]);
+				}
+				return;
+			}
+		}
+
+		item i;
+		i.key = key;
+		i.box = box;
+		leaf.items.push_back(i);
+		++leaf.num_chunks;
+		for(int level = 1; level != num_levels; ++level) {
+			const uint64_t nkey = node_key(cx >> level, cz >> level);
+			node& n = levels_[level][nkey];
+			n.x = cx >> level;
+			n.z = cz >> level;
+			++n.num_chunks;
+			mark_dirty(level, nkey, n);
+		}
+	}
+
+	void chunk_tree::remove(uint64_t key)
+	{
+		int cx, cy, cz;
+		chunk_map::from_key(key, cx, cy, cz);
+
+		auto leaf = levels_[0].find(node_key(cx, cz));
+		if(leaf == levels_[0].end()) {
+			return;
+		}
+		std::vector<item>& items = leaf->second.items;
+		auto it = items.begin();
+		while(it != items.end() && it->key != key) {
+			++it;
+		}
+		if(it == items.end()) {
+			return;
+		}
+		items.erase(it);
+
+		for(int level = 0; level != num_levels; ++level) {
+			const uint64_t nkey = node_key(cx >> level, cz >> level);
+			auto n = levels_[level].find(nkey);
+			ASSERT_LOG(n != levels_[level].end(), "chunk_tree::remove(): missing node at level " << level);
+			if(--n->second.num_chunks == 0) {
+				levels_[level].erase(n);
+			} else {
+				mark_dirty(level, nkey, n->second);
+			}
+		}
+	}
+
+	void chunk_tree::clear()
+	{
+		for(int level = 0; level != num_levels; ++level) {
+			levels_[level].clear();
+			dirty_[level].clear();
+		}
+	}
+
+	size_t chunk_tree::size() const
+	{
+		size_t cnt = 0;
+		for(auto it = levels_[num_levels - 1].begin(); it != levels_[num_levels - 1].end(); ++it) {
+			cnt += it->second.num_chunks;
+		}
+		return cnt;
+	}
+
+	void chunk_tree::refresh()
+	{
+		for(int level = 0; level != num_levels; ++level) {
+			for(auto k = dirty_[level].begin(); k != dirty_[level].end(); ++k) {
+				auto it = levels_[level].find(*k);
+				if(it == levels_[level].end()) {
+					continue;
+				}
+				node& n = it->second;
+				n.box = graphics::aabb();
+				n.dirty = false;
+				if(level == 0) {
+					for(auto i = n.items.begin(); i != n.items.end(); ++i) {
+						n.box.add(i->box);
+					}
+					continue;
+				}
+				for(int child = 0; child != 4; ++child) {
+					auto c = levels_[level - 1].find(node_key(n.x * 2 + (child & 1), n.z * 2 + (child >> 1)));
+					if(c != levels_[level - 1].end()) {
+						n.box.add(c->second.box);
+					}
+				}
+			}
+			dirty_[level].clear();
+		}
+	}
+
+	void chunk_tree::query(const graphics::frustum& f, const visitor& fn, cull_stats& stats)
+	{
+		refresh();
+		const level_map& roots = levels_[num_levels - 1];
+		for(auto it = roots.begin(); it != roots.end(); ++it) {
+			visit(num_levels - 1, it->second, false, f, fn, stats);
+		}
+	}
+
+	void chunk_tree::visit(int level, const node& n, bool inside, const graphics::frustum& f, const visitor& fn, cull_stats& stats) const
+	{
+		if(!inside) {
+			++stats.nodes_tested;
+			const graphics::frustum::intersection res = f.test(n.box);
+			if(res == graphics::frustum::OUTSIDE) {
+				stats.chunks_culled += n.num_chunks;
+				return;
+			}
+			inside = res == graphics::frustum::INSIDE;
+		}
+
+		if(level == 0) {
+			for(auto it = n.items.begin(); it != n.items.end(); ++it) {
+				if(!inside) {
+					++stats.chunks_tested;
+					if(!f.is_visible(it->box)) {
+						++stats.chunks_culled;
+						continue;
+					}
+				}
+				++stats.chunks_visible;
+				fn(it->key);
+			}
+			return;
+		}
+
+		for(int child = 0; child != 4; ++child) {
+			auto c = levels_[level - 1].find(node_key(n.x * 2 + (child & 1), n.z * 2 + (child >> 1)));
+			if(c != levels_[level - 1].end()) {
+				visit(level - 1, c->second, inside, f, fn, stats);
+			}
+		}
+	}
+}
+
+namespace
+{
+	void count_visible(int& cnt, uint64_t)
+	{
+		++cnt;
+	}
+}
+
+UNIT_TEST(chunk_tree)
+{
+	// The identity frustum is the cube from -1 to 1.
+	const graphics::frustum f(glm::mat4(1.0f));
+	cube::chunk_tree tree;
+	tree.insert(cube::chunk_map::key(0, 0, 0), graphics::aabb(glm::vec3(-0.5f), glm::vec3(0.5f)));
+	tree.insert(cube::chunk_map::key(1, 0, 0), graphics::aabb(glm::vec3(0.5f), glm::vec3(1.5f)));
+	tree.insert(cube::chunk_map::key(-1, 3, 0), graphics::aabb(glm::vec3(-0.5f), glm::vec3(0.0f)));
+	tree.insert(cube::chunk_map::key(500, 0, -500), graphics::aabb(glm::vec3(5.0f), glm::vec3(6.0f)));
+	CHECK_EQ(tree.size(), 4);
+
+	int visible = 0;
+	cube::cull_stats stats;
+	tree.query(f, boost::bind(count_visible, boost::ref(visible), _1), stats);
+	CHECK_EQ(visible, 3);
+	CHECK_EQ(stats.chunks_visible, 3);
+	CHECK_EQ(stats.chunks_culled, 1);
+
+	// Moving a chunk out of view updates the bounds above it.
+	tree.insert(cube::chunk_map::key(1, 0, 0), graphics::aabb(glm::vec3(3.0f), glm::vec3(4.0f)));
+	tree.remove(cube::chunk_map::key(-1, 3, 0));
+	CHECK_EQ(tree.size(), 3);
+	visible = 0;
+	stats = cube::cull_stats();
+	tree.query(f, boost::bind(count_visible, boost::ref(visible), _1), stats);
+	CHECK_EQ(visible, 1);
+	CHECK_EQ(stats.chunks_culled, 2);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "chunk.hpp"
+#include "frustum.hpp"
+
+namespace cube
+{
+	struct cull_stats
+	{
+		cull_stats();
+
+		// Tree nodes and individual chunk bounds tested against the frustum.
+		size_t nodes_tested;
+		size_t chunks_tested;
+		// Chunks rejected, either on their own or as part of a node.
+		size_t chunks_culled;
+		size_t chunks_visible;
+	};
+
+	// Sparse quadtree over chunk columns. Every node holds the bounds of the
+	// chunks below it, so a region outside the frustum is rejected with a
+	// single test, and one entirely inside needs no further tests. Bounds are
+	// refreshed lazily by the next query after a change.
+	class chunk_tree
+	{
+	public:
+		typedef boost::function<void (uint64_t key)> visitor;
+
+		chunk_tree();
+		virtual ~chunk_tree();
+
+		// Adds, or updates the bounds of, the chunk with the given chunk_map key.
+		void insert(uint64_t key, const graphics::aabb& box);
+		void remove(uint64_t key);
+		void clear();
+		size_t size() const;
+
+		// Calls fn with the key of each chunk whose bounds intersect f.
+		void query(const graphics::frustum& f, const visitor& fn, cull_stats& stats);
+	private:
+		// Level 0 nodes are single columns, the top level nodes cover
+		// 2^(num_levels-1) columns along each side.
+		static const int num_levels = 7;
+
+		struct item
+		{
+			uint64_t key;
+			graphics::aabb box;
+		};
+		struct node
+		{
+			node();
+
+			int x;
+			int z;
+			graphics::aabb box;
+			size_t num_chunks;
+			bool dirty;
+			// Only used by level 0 nodes.
+			std::vector<item> items;
+		};
+		typedef boost::unordered_map<uint64_t, node> level_map;
+
+		static uint64_t node_key(int x, int z) { return (uint64_t(uint32_t(x)) << 32) | uint32_t(z); }
+
+		void mark_dirty(int level, uint64_t nkey, node& n);
+		void refresh();
+		void visit(int level, const node& n, bool inside, const graphics::frustum& f, const visitor& fn, cull_stats& stats) const;
+
+		level_map levels_[num_levels];
+		std::vector<uint64_t> dirty_[num_levels];
+	};
+}
@@ -0,0 +1,217 @@
+#include <cstdlib>
+#include <deque>
+
+#include "asserts.hpp"
+#include "chunk_visibility.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		// Index of each pair of faces in a face_connectivity, -1 on the
+		// diagonal.
+		const int face_pair[NUM_DIRECTIONS][NUM_DIRECTIONS] = {
+			{ -1,  0,  1,  2,  3,  4 },
+			{  0, -1,  5,  6,  7,  8 },
+			{  1,  5, -1,  9, 10, 11 },
+			{  2,  6,  9, -1, 12, 13 },
+			{  3,  7, 10, 12, -1, 14 },
+			{  4,  8, 11, 13, 14, -1 },
+		};
+
+		// Grows seed to cover every run of set bits in open which it touches,
+		// doubling the distance covered at each step.
+		uint32_t spread_row(uint32_t seed, uint32_t open)
+		{
+			uint32_t up = seed, down = seed;
+			uint32_t up_open = open, down_open = open;
+			for(int shift = 1; shift != 32; shift <<= 1) {
+				up |= up_open & (up << shift);
+				up_open &= up_open << shift;
+				down |= down_open & (down >> shift);
+				down_open &= down_open >> shift;
+			}
+			return up | down;
+		}
+
+		struct flood_step
+		{
+			int x, y, z;
+			// Face the chunk was entered by, -1 for the camera chunk.
+			int from;
+			// Directions taken to get here.
+			int directions;
+		};
+	}
+
+	face_connectivity connection_bit(int a, int b)
+	{
+		ASSERT_LOG(a >= 0 && a < NUM_DIRECTIONS && b >= 0 && b < NUM_DIRECTIONS, "connection_bit() invalid direction: " << a << ", " << b);
+		return face_pair[a][b] < 0 ? 0 : face_connectivity(1 << face_pair[a][b]);
+	}
+
+	face_connectivity compute_connectivity(const chunk& c)
+	{
+		if(c.is_uniform()) {
+			return c.uniform_type() == empty_block ? all_faces_connected : 0;
+		}
+
+		// Works a row of blocks along x at a time, with a bit for each block.
+		// Row r holds blocks with y = r / chunk_size and z = r % chunk_size.
+		std::vector<uint32_t> open(chunk_area);
+		for(int r = 0; r != chunk_area; ++r) {
+			uint32_t bits = 0;
+			for(int x = 0; x != chunk_size; ++x) {
+				bits |= uint32_t(c.get_index((r << chunk_shift) | x) == empty_block) << x;
+			}
+			open[r] = bits;
+		}
+
+		face_connectivity res = 0;
+		std::vector<std::pair<int, uint32_t> > stack;
+		for(int start = 0; start != chunk_area && res != all_faces_connected; ++start) {
+			while(open[start] != 0 && res != all_faces_connected) {
+				int faces = 0;
+				stack.push_back(std::make_pair(start, open[start] & (~open[start] + 1)));
+				while(!stack.empty()) {
+					const int r = stack.back().first;
+					uint32_t fill = stack.back().second & open[r];
+					stack.pop_back();
+					if(fill == 0) {
+						continue;
+					}
+					// Blocks are removed from open once reached.
+					if(fill != open[r]) {
+						fill = spread_row(fill, open[r]);
+					}
+					open[r] &= ~fill;
+
+					const int y = r >> chunk_shift, z = r & chunk_mask;
+					faces |= (fill & 1 ? 1 << LEFT : 0)
+						| (fill >> chunk_mask ? 1 << RIGHT : 0)
+						| (y == 0 ? 1 << BOTTOM : 0)
+						| (y == chunk_mask ? 1 << TOP : 0)
+						| (z == 0 ? 1 << BACK : 0)
+						| (z == chunk_mask ? 1 << FRONT : 0);
+					if(z != 0 && (fill & open[r - 1])) {
+						stack.push_back(std::make_pair(r - 1, fill));
+					}
+					if(z != chunk_mask && (fill & open[r + 1])) {
+						stack.push_back(std::make_pair(r + 1, fill));
+					}
+					if(y != 0 && (fill & open[r - chunk_size])) {
+						stack.push_back(std::make_pair(r - chunk_size, fill));
+					}
+					if(y != chunk_mask && (fill & open[r + chunk_size])) {
+						stack.push_back(std::make_pair(r + chunk_size, fill));
+					}
+				}
+				for(int a = 0; a != NUM_DIRECTIONS; ++a) {
+					for(int b = a + 1; b != NUM_DIRECTIONS; ++b) {
+						if((faces & (1 << a)) && (faces & (1 << b))) {
+							res |= connection_bit(a, b);
+						}
+					}
+				}
+			}
+		}
+		return res;
+	}
+
+	visibility_graph::visibility_graph()
+	{
+	}
+
+	visibility_graph::~visibility_graph()
+	{
+	}
+
+	void visibility_graph::set(uint64_t key, face_connectivity c)
+	{
+		// Empty space is the default, so isn't stored.
+		if(c == all_faces_connected) {
+			connectivity_.erase(key);
+		} else {
+			connectivity_[key] = c;
+		}
+	}
+
+	face_connectivity visibility_graph::get(uint64_t key) const
+	{
+		auto it = connectivity_.find(key);
+		return it == connectivity_.end() ? all_faces_connected : it->second;
+	}
+
+	void visibility_graph::flood(int cx, int cy, int cz, const graphics::frustum& f, int max_distance, boost::unordered_set<uint64_t>& reachable) const
+	{
+		reachable.clear();
+		reachable.insert(chunk_map::key(cx, cy, cz));
+
+		std::deque<flood_step> queue;
+		flood_step start = { cx, cy, cz, -1, 0 };
+		queue.push_back(start);
+		while(!queue.empty()) {
+			const flood_step s = queue.front();
+			queue.pop_front();
+			const face_connectivity c = s.from < 0 ? all_faces_connected : get(chunk_map::key(s.x, s.y, s.z));
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				if(s.directions & (1 << opposite_direction(d))) {
+					continue;
+				}
+				if(s.from >= 0 && !faces_connected(c, s.from, d)) {
+					continue;
+				}
+				flood_step next = { s.x + direction_offset[d][0], s.y + direction_offset[d][1], s.z + direction_offset[d][2],
+					opposite_direction(d), s.directions | (1 << d) };
+				if(std::abs(next.x - cx) > max_distance || std::abs(next.y - cy) > max_distance || std::abs(next.z - cz) > max_distance) {
+					continue;
+				}
+				const uint64_t key = chunk_map::key(next.x, next.y, next.z);
+				if(reachable.count(key)) {
+					continue;
+				}
+				const glm::vec3 origin(float(next.x * chunk_size), float(next.y * chunk_size), float(next.z * chunk_size));
+				if(!f.is_visible(graphics::aabb(origin, origin + glm::vec3(float(chunk_size))))) {
+					continue;
+				}
+				reachable.insert(key);
+				queue.push_back(next);
+			}
+		}
+	}
+}
+
+UNIT_TEST(chunk_visibility)
+{
+	cube::chunk c(0, 0, 0, 1);
+	CHECK_EQ(cube::compute_connectivity(c), 0);
+
+	// A tunnel along z joins the front and back faces only.
+	for(int z = 0; z != cube::chunk_size; ++z) {
+		c.set(5, 5, z, cube::empty_block);
+	}
+	const cube::face_connectivity tunnel = cube::compute_connectivity(c);
+	CHECK_EQ(tunnel, cube::connection_bit(cube::FRONT, cube::BACK));
+	CHECK_EQ(cube::faces_connected(tunnel, cube::BACK, cube::FRONT), true);
+	CHECK_EQ(cube::faces_connected(tunnel, cube::LEFT, cube::RIGHT), false);
+
+	// A solid chunk at x = 1 can be seen but blocks the way along x. Getting
+	// round it means going up then down, which the search doesn't allow.
+	cube::visibility_graph g;
+	g.set(cube::chunk_map::key(1, 0, 0), 0);
+	boost::unordered_set<uint64_t> reachable;
+	g.flood(0, 0, 0, graphics::frustum(), 3, reachable);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(1, 0, 0)), 1);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(2, 0, 0)), 0);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(2, 1, 0)), 1);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(0, 0, 3)), 1);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(0, 0, 4)), 0);
+
+	// From in front of it, the chunk behind can only be reached through it.
+	g.flood(1, 0, -1, graphics::frustum(), 3, reachable);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(1, 0, 1)), 0);
+	g.set(cube::chunk_map::key(1, 0, 0), tunnel);
+	g.flood(1, 0, -1, graphics::frustum(), 3, reachable);
+	CHECK_EQ(reachable.count(cube::chunk_map::key(1, 0, 1)), 1);
+}
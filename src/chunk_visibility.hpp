@@ -0,0 +1,45 @@
+#pragma once
+
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
+#include "chunk.hpp"
+#include "frustum.hpp"
+
+namespace cube
+{
+	// One bit for each pair of chunk faces, set when the two faces are
+	// joined by a path through empty blocks inside the chunk.
+	typedef uint16_t face_connectivity;
+	const face_connectivity all_faces_connected = 0x7fff;
+
+	face_connectivity connection_bit(int a, int b);
+	inline bool faces_connected(face_connectivity c, int a, int b) { return (c & connection_bit(a, b)) != 0; }
+
+	// Flood fills the empty blocks of c to find which faces they join.
+	face_connectivity compute_connectivity(const chunk& c);
+
+	// Face connectivity of every chunk, used to find the chunks which could
+	// be seen from the camera by looking through empty space. Chunks not in
+	// the graph are treated as empty.
+	class visibility_graph
+	{
+	public:
+		visibility_graph();
+		virtual ~visibility_graph();
+
+		void set(uint64_t key, face_connectivity c);
+		void remove(uint64_t key) { connectivity_.erase(key); }
+		void clear() { connectivity_.clear(); }
+		face_connectivity get(uint64_t key) const;
+
+		// Breadth first search out from the chunk holding the camera, which
+		// only passes through a chunk between faces it connects, never turns
+		// back on a direction already taken and only enters chunks that
+		// intersect f and are within max_distance chunks of the camera.
+		// Fills reachable with the keys of the chunks reached.
+		void flood(int cx, int cy, int cz, const graphics::frustum& f, int max_distance, boost::unordered_set<uint64_t>& reachable) const;
+	private:
+		boost::unordered_map<uint64_t, face_connectivity> connectivity_;
+	};
+}
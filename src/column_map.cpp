@@ -0,0 +1,298 @@
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "chunk_mesher.hpp"
+#include "column_map.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		// Sets type and returns true if blocks [y1, y2) of the column are all
+		// one type.
+		bool single_type(const column_view& col, int y1, int y2, block_id& type)
+		{
+			int y = 0;
+			for(int n = 0; n != col.count; ++n) {
+				const int end = y + col.runs[n].length;
+				if(end > y1) {
+					type = col.runs[n].type;
+					return end >= y2;
+				}
+				y = end;
+			}
+			type = empty_block;
+			return true;
+		}
+	}
+
+	column_map::column_map(int width, int depth)
+		: width_(width), depth_(depth)
+	{
+		ASSERT_LOG(width >= 0 && depth >= 0, "column_map: bad size " << width << "x" << depth);
+		const block_run empty = { empty_block, 0 };
+		columns_.assign(width * depth, empty);
+	}
+
+	column_map::~column_map()
+	{
+	}
+
+	column_view column_map::get_column(int x, int z) const
+	{
+		column_view res = { NULL, 0 };
+		if(x < 0 || z < 0 || x >= width_ || z >= depth_) {
+			return res;
+		}
+		const block_run& r = columns_[z * width_ + x];
+		if(is_overflow(r)) {
+			const std::vector<block_run>& runs = overflow_[overflow_index(r)];
+			res.runs = &runs[0];
+			res.count = int(runs.size());
+		} else {
+			res.runs = &r;
+			res.count = r.length != 0 ? 1 : 0;
+		}
+		return res;
+	}
+
+	block_id column_map::get_block(int x, int y, int z) const
+	{
+		const column_view col = get_column(x, z);
+		if(y < 0) {
+			return empty_block;
+		}
+		for(int n = 0; n != col.count; ++n) {
+			y -= col.runs[n].length;
+			if(y < 0) {
+				return col.runs[n].type;
+			}
+		}
+		return empty_block;
+	}
+
+	int column_map::column_height(int x, int z) const
+	{
+		const column_view col = get_column(x, z);
+		int height = 0;
+		for(int n = 0; n != col.count; ++n) {
+			height += col.runs[n].length;
+		}
+		return height;
+	}
+
+	void column_map::fill_column(int x, int z, int y1, int y2, block_id b)
+	{
+		ASSERT_LOG(x >= 0 && z >= 0 && x < width_ && z < depth_, "column_map::fill_column() column out of bounds: " << x << "," << z);
+		ASSERT_LOG(y1 >= 0 && y1 <= y2 && y2 <= max_height, "column_map::fill_column() range out of bounds: " << y1 << "," << y2);
+		if(y1 == y2) {
+			return;
+		}
+
+		// Rebuild the runs: the old ones below y1, then the new one, then the
+		// old ones above y2, merging neighbours of the same type.
+		edit_.clear();
+		auto add_run = [this](block_id type, int length) {
+			if(length <= 0) {
+				return;
+			}
+			if(!edit_.empty() && edit_.back().type == type) {
+				edit_.back().length = uint16_t(edit_.back().length + length);
+			} else {
+				const block_run r = { type, uint16_t(length) };
+				edit_.push_back(r);
+			}
+		};
+		const column_view col = get_column(x, z);
+		int y = 0;
+		for(int n = 0; n != col.count; ++n) {
+			add_run(col.runs[n].type, std::min(y + col.runs[n].length, y1) - y);
+			y += col.runs[n].length;
+		}
+		add_run(empty_block, y1 - y);
+		add_run(b, y2 - y1);
+		y = 0;
+		for(int n = 0; n != col.count; ++n) {
+			const int end = y + col.runs[n].length;
+			add_run(col.runs[n].type, end - std::max(y, y2));
+			y = end;
+		}
+		// Empty space at the top is implicit.
+		while(!edit_.empty() && edit_.back().type == empty_block) {
+			edit_.pop_back();
+		}
+
+		block_run& slot = columns_[z * width_ + x];
+		if(edit_.size() <= 1) {
+			if(is_overflow(slot)) {
+				const size_t index = overflow_index(slot);
+				std::vector<block_run>().swap(overflow_[index]);
+				free_overflow_.push_back(index);
+			}
+			const block_run empty = { empty_block, 0 };
+			slot = edit_.empty() ? empty : edit_.front();
+			return;
+		}
+
+		size_t index;
+		if(is_overflow(slot)) {
+			index = overflow_index(slot);
+		} else if(!free_overflow_.empty()) {
+			index = free_overflow_.back();
+			free_overflow_.pop_back();
+		} else {
+			index = overflow_.size();
+			ASSERT_LOG(index < 0x80000000u, "column_map::fill_column() too many columns with more than one run");
+			overflow_.push_back(std::vector<block_run>());
+		}
+		overflow_[index] = edit_;
+		slot.type = block_id(index & 0xffff);
+		slot.length = uint16_t(0x8000 | (index >> 16));
+	}
+
+	void column_map::build_from_heightmap(const std::vector<uint8_t>& heights, block_id b)
+	{
+		ASSERT_LOG(heights.size() >= columns_.size(), "Heightmap data too small: " << heights.size() << " < " << columns_.size());
+		std::vector<std::vector<block_run> >().swap(overflow_);
+		free_overflow_.clear();
+		for(size_t n = 0; n != columns_.size(); ++n) {
+			columns_[n].type = heights[n] != 0 ? b : empty_block;
+			columns_[n].length = heights[n];
+		}
+	}
+
+	chunk_ptr column_map::load_chunk(int cx, int cy, int cz)
+	{
+		const int x0 = cx * chunk_size, y0 = cy * chunk_size, z0 = cz * chunk_size;
+		if(cx < 0 || cy < 0 || cz < 0 || x0 >= width_ || z0 >= depth_) {
+			return chunk_ptr();
+		}
+
+		// Heightmap worlds are mostly chunks entirely above or below the
+		// surface, which need no per-block storage.
+		block_id uniform = empty_block;
+		bool is_uniform = true;
+		for(int z = 0; z != chunk_size && is_uniform; ++z) {
+			for(int x = 0; x != chunk_size && is_uniform; ++x) {
+				block_id type;
+				is_uniform = single_type(get_column(x0 + x, z0 + z), y0, y0 + chunk_size, type) && (type == uniform || (x == 0 && z == 0));
+				uniform = type;
+			}
+		}
+		if(is_uniform) {
+			return uniform == empty_block ? chunk_ptr() : chunk_ptr(new chunk(cx, cy, cz, uniform));
+		}
+
+		chunk_ptr c(new chunk(cx, cy, cz));
+		for(int z = 0; z != chunk_size; ++z) {
+			for(int x = 0; x != chunk_size; ++x) {
+				const column_view col = get_column(x0 + x, z0 + z);
+				int y = 0;
+				for(int n = 0; n != col.count && y < y0 + chunk_size; ++n) {
+					const int start = std::max(y, y0), end = std::min(y + col.runs[n].length, y0 + chunk_size);
+					if(start < end && col.runs[n].type != empty_block) {
+						c->fill_column(x, z, start - y0, end - y0, col.runs[n].type);
+					}
+					y += col.runs[n].length;
+				}
+			}
+		}
+		return c;
+	}
+
+	void column_map::chunk_keys(std::vector<uint64_t>& keys)
+	{
+		for(int cz = 0; cz * chunk_size < depth_; ++cz) {
+			for(int cx = 0; cx * chunk_size < width_; ++cx) {
+				int height = 0;
+				for(int z = cz * chunk_size; z != std::min((cz + 1) * chunk_size, depth_); ++z) {
+					for(int x = cx * chunk_size; x != std::min((cx + 1) * chunk_size, width_); ++x) {
+						height = std::max(height, column_height(x, z));
+					}
+				}
+				for(int cy = 0; cy * chunk_size < height; ++cy) {
+					keys.push_back(chunk_map::key(cx, cy, cz));
+				}
+			}
+		}
+	}
+
+	size_t column_map::memory_usage() const
+	{
+		size_t total = sizeof(column_map)
+			+ columns_.capacity() * sizeof(block_run)
+			+ overflow_.capacity() * sizeof(std::vector<block_run>)
+			+ free_overflow_.capacity() * sizeof(size_t)
+			+ edit_.capacity() * sizeof(block_run);
+		for(auto it = overflow_.begin(); it != overflow_.end(); ++it) {
+			total += it->capacity() * sizeof(block_run);
+		}
+		return total;
+	}
+}
+
+UNIT_TEST(column_map)
+{
+	// Same 40x40 map as the chunk_storage test.
+	std::vector<uint8_t> heights(40 * 40, 40);
+	heights[5 * 40 + 5] = 70;
+	cube::column_map cols(40, 40);
+	cols.build_from_heightmap(heights, 1);
+	CHECK_EQ(cols.is_solid(39, 39, 39), true);
+	CHECK_EQ(cols.is_solid(39, 40, 39), false);
+	CHECK_EQ(cols.is_solid(5, 69, 5), true);
+	CHECK_EQ(cols.is_solid(40, 0, 0), false);
+	CHECK_EQ(cols.column_height(5, 5), 70);
+	CHECK_EQ(cols.overflow_columns(), 0);
+	CHECK_LT(cols.memory_usage(), 40 * 40 * 4 + 256);
+
+	// Chunks paged in match those built from the heightmap directly.
+	cube::chunk_map expected;
+	expected.build_from_heightmap(heights, 40, 40, 1);
+	std::vector<uint64_t> keys;
+	cols.chunk_keys(keys);
+	CHECK_EQ(keys.size(), expected.num_chunks());
+	for(auto it = expected.begin(); it != expected.end(); ++it) {
+		const cube::chunk& c = *it->second;
+		cube::chunk_ptr loaded = cols.load_chunk(c.cx(), c.cy(), c.cz());
+		CHECK_EQ(loaded->is_uniform(), c.is_uniform());
+		for(int n = 0; n != cube::chunk_volume; ++n) {
+			CHECK_EQ(loaded->get_index(n), c.get_index(n));
+		}
+	}
+	CHECK_EQ(cols.load_chunk(1, 2, 0) == NULL, true);
+
+	// Meshing from the runs gives the same faces as meshing the chunks.
+	for(auto it = expected.begin(); it != expected.end(); ++it) {
+		const cube::chunk& c = *it->second;
+		cube::chunk_mesh from_chunks, from_runs;
+		cube::mesh_chunk(expected, c.cx(), c.cy(), c.cz(), cube::MESH_GREEDY, from_chunks);
+		cube::mesh_chunk(cols, c.cx(), c.cy(), c.cz(), from_runs);
+		for(int d = 0; d != cube::NUM_DIRECTIONS; ++d) {
+			CHECK_EQ(from_runs.vertices[d] == from_chunks.vertices[d], true);
+		}
+		CHECK_EQ(from_runs.solid_height, from_chunks.solid_height);
+	}
+
+	// A cave splits the column into several runs, and filling it back in
+	// merges them again.
+	cols.fill_column(3, 3, 10, 20, cube::empty_block);
+	cols.set_block(3, 15, 3, 2);
+	CHECK_EQ(cols.get_column(3, 3).count, 5);
+	CHECK_EQ(cols.get_block(3, 9, 3), 1);
+	CHECK_EQ(cols.get_block(3, 10, 3), 0);
+	CHECK_EQ(cols.get_block(3, 15, 3), 2);
+	CHECK_EQ(cols.get_block(3, 20, 3), 1);
+	CHECK_EQ(cols.overflow_columns(), 1);
+	cols.fill_column(3, 3, 5, 25, 1);
+	CHECK_EQ(cols.get_column(3, 3).count, 1);
+	CHECK_EQ(cols.overflow_columns(), 0);
+
+	// Clearing the top of a column lowers it.
+	cols.fill_column(3, 3, 30, 40, cube::empty_block);
+	CHECK_EQ(cols.column_height(3, 3), 30);
+	cols.set_block(3, 50, 3, 1);
+	CHECK_EQ(cols.column_height(3, 3), 51);
+	CHECK_EQ(cols.is_solid(3, 49, 3), false);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace cube
+{
+	// A run of length blocks of one type along y.
+	struct block_run
+	{
+		block_id type;
+		uint16_t length;
+	};
+
+	// Blocks of one column, valid until the column_map is next modified.
+	struct column_view
+	{
+		const block_run* runs;
+		int count;
+	};
+
+	// World stored as run length encoded columns, width by depth, starting at
+	// y = 0. Each column is a list of runs from the bottom up, with empty
+	// space above the last one. A column that is a single run, as every
+	// column built from a heightmap is, takes four bytes; columns with more
+	// runs are kept separately. Chunks are built from the runs as they're
+	// paged in, so the map can sit behind a chunk_map as its chunk_source.
+	class column_map : public chunk_source
+	{
+	public:
+		// Columns can be up to max_height blocks high.
+		static const int max_height = 0x7fff;
+
+		column_map(int width, int depth);
+		virtual ~column_map();
+
+		int width() const { return width_; }
+		int depth() const { return depth_; }
+
+		// Blocks outside the map are empty.
+		block_id get_block(int x, int y, int z) const;
+		bool is_solid(int x, int y, int z) const { return get_block(x, y, z) != empty_block; }
+		void set_block(int x, int y, int z, block_id b) { fill_column(x, z, y, y + 1, b); }
+		// Sets blocks [y1, y2) of the column at x, z to b, replacing the runs
+		// in that range in one go.
+		void fill_column(int x, int z, int y1, int y2, block_id b);
+		column_view get_column(int x, int z) const;
+		// One above the highest solid block, 0 for an empty column.
+		int column_height(int x, int z) const;
+
+		// As chunk_map::build_from_heightmap(), replacing every column.
+		void build_from_heightmap(const std::vector<uint8_t>& heights, block_id b);
+
+		virtual chunk_ptr load_chunk(int cx, int cy, int cz);
+		virtual void chunk_keys(std::vector<uint64_t>& keys);
+
+		size_t memory_usage() const;
+		// Columns which didn't fit in a single run.
+		size_t overflow_columns() const { return overflow_.size() - free_overflow_.size(); }
+	private:
+		// A column which doesn't fit in a single run holds an index into
+		// overflow_ instead, flagged by the top bit of the length.
+		static bool is_overflow(const block_run& r) { return (r.length & 0x8000) != 0; }
+		static size_t overflow_index(const block_run& r) { return r.type | size_t(r.length & 0x7fff) << 16; }
+
+		int width_;
+		int depth_;
+		std::vector<block_run> columns_;
+		std::vector<std::vector<block_run> > overflow_;
+		std::vector<size_t> free_overflow_;
+		// Scratch space for fill_column().
+		std::vector<block_run> edit_;
+
+		column_map();
+		column_map(const column_map&);
+	};
+	typedef boost::shared_ptr<column_map> column_map_ptr;
+}
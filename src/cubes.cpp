@@ -1,56 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/shared_array.hpp>
 
 #include "asserts.hpp"
+#include "column_map.hpp"
 #include "cubes.hpp"
+#include "gl_state.hpp"
+#include "module.hpp"
+#include "profile_timer.hpp"
 #include "render.hpp"
+#include "surface.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
 
 namespace cube
 {
-	namespace 
+	namespace
 	{
-		const int num_array_buffers = 2;
+		// Default time allowed for mesh uploads and for remeshing edited
+		// chunks each frame.
+		const int default_upload_budget_us = 2000;
+		const int default_remesh_budget_us = 1000;
 
-		boost::shared_array<GLuint>& cube_array_buffer()
+		// A quarter of the resolution of the default window.
+		const int occlusion_width = 256;
+		const int occlusion_height = 192;
+		// Only the nearest occluders are drawn, the rest tend to cover little
+		// of the screen and are often hidden by the nearer ones anyway.
+		const size_t max_occluders = 64;
+		// Thinner slabs aren't worth drawing as occluders.
+		const int min_occluder_height = 4;
+		// Occluders are pulled in slightly so faces lying on their surface
+		// are never hidden by them.
+		const float occluder_inset = 0.01f;
+		// Limit on how far, in chunks, the visibility search goes from the
+		// camera, in case the far plane is a long way off.
+		const int max_visibility_distance = 16;
+
+		// Time allowed for streaming in chunks each update, and a limit on the
+		// mesh jobs streaming keeps in flight so that edits don't queue behind
+		// them.
+		const int stream_budget_us = 1000;
+		const size_t max_streaming_jobs = 64;
+		// Limit on the chunks being loaded on worker threads at once, for
+		// sources which allow it.
+		const size_t max_loading_jobs = 128;
+
+		// Three chunks, so the edits near the player are always at full
+		// detail.
+		const float default_lod_distance = 96.0f;
+
+		void push_key(std::vector<uint64_t>& keys, uint64_t key)
+		{
+			keys.push_back(key);
+		}
+
+		// Calls fn(cx, cy, cz) for the chunk containing block x, y, z and for
+		// each neighbouring chunk that the block shares a face with.
+		template<typename F>
+		void for_each_chunk_touching(int x, int y, int z, F fn)
+		{
+			const int pos[3] = { x, y, z };
+			int c[3];
+			for(int a = 0; a != 3; ++a) {
+				c[a] = chunk_map::to_chunk(pos[a]);
+			}
+			fn(c[0], c[1], c[2]);
+			for(int a = 0; a != 3; ++a) {
+				const int local = chunk_map::to_local(pos[a]);
+				if(local == 0 || local == chunk_mask) {
+					int n[3] = { c[0], c[1], c[2] };
+					n[a] += local == 0 ? -1 : 1;
+					fn(n[0], n[1], n[2]);
+				}
+			}
+		}
+
+		Uint32 get_pixel(const SDL_Surface* s, int x, int y)
 		{
-			static boost::shared_array<GLuint> res;
-			if(res == NULL) {
-				res = boost::shared_array<GLuint>(new GLuint[num_array_buffers], graphics::vbo_deleter(num_array_buffers));
-				glGenBuffers(num_array_buffers, &res[0]);
+			const Uint8* p = static_cast<const Uint8*>(s->pixels) + y * s->pitch + x * s->format->BytesPerPixel;
+			switch(s->format->BytesPerPixel) {
+			case 1: return *p;
+			case 2: return *reinterpret_cast<const Uint16*>(p);
+			case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+				return p[0] | p[1] << 8 | p[2] << 16;
+#else
+				return p[0] << 16 | p[1] << 8 | p[2];
+#endif
+			case 4: return *reinterpret_cast<const Uint32*>(p);
 			}
-			return res;
+			return 0;
 		}
 	}
 
-	world::world(shader::program_object_ptr shader, const std::string& fname)
-		: shader_(shader), size_x_(0), size_y_(0), size_z_(0)
+	chunk_draw_data::chunk_draw_data()
+		: total(0), last_drawn(0)
 	{
-		model_ = glm::mat4(1.0f);
+		for(int l = 0; l != num_lod_levels; ++l) {
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				first[l][d] = 0;
+				count[l][d] = 0;
+			}
+		}
+		offset[0] = offset[1] = offset[2] = 0.0f;
+	}
 
-		// grab actives iterators from shader so we can use them later to draw.
-		mm_uniform_it_ = shader->get_uniform_iterator("model_matrix");
-		a_position_it_ = shader->get_attribute_iterator("a_position");
-		a_tex_coord_it_ = shader->get_attribute_iterator("a_tex_coord");
-		tex0_it_ = shader->get_uniform_iterator("u_tex0");
-
-		// Load surface and iterate over the red channel to get height details.
+	stream_stats::stream_stats()
+		: chunks_resident(0), chunks_meshed(0), ram_bytes(0), vram_bytes(0), chunks_queued(0), chunks_evicted(0)
+	{
+	}
+
+	draw_stats::draw_stats()
+		: vertices_drawn(0), vertices_backfacing(0), chunks_unreachable(0), chunks_occluded(0), occluders_drawn(0)
+	{
+		for(int l = 0; l != num_lod_levels; ++l) {
+			chunks_at_lod[l] = 0;
+		}
+	}
+
+	void load_heightmap(const std::string& fname, std::vector<uint8_t>& heights, int& width, int& depth)
+	{
 		graphics::surface_ptr surf = new graphics::surface(fname);
 		SDL_Surface* s = surf->get();
-		SDL_PixelFormat *fmt = s->format;
-		ASSERT_LOG(fmt->BitsPerPixel != 8, fname << " needs to be 8 bpp format, found: " << fmt->BitsPerPixel);
-		uint32_t* pixels = (uint32_t*)s->pixels;
-		for(int x = 0; x != s->w; ++x) {
-			for(int y = 0; y != s->h; ++y) {
-				int z = pixels[y * s->pitch + x] & SURFACE_MASK_R;
-				if(z != 0) {
-					blocks_[boost::make_tuple(x,y,z)] = 1; // hard coded block type.
-				}
+		width = s->w;
+		depth = s->h;
+		heights.resize(width * depth);
+		if(SDL_MUSTLOCK(s)) {
+			SDL_LockSurface(s);
+		}
+		for(int y = 0; y != s->h; ++y) {
+			for(int x = 0; x != s->w; ++x) {
+				Uint8 r, g, b;
+				SDL_GetRGB(get_pixel(s, x, y), s->format, &r, &g, &b);
+				heights[y * width + x] = r;
 			}
 		}
-		size_x_ = s->w;
-		size_y_ = s->h;
-		size_z_ = 256;
+		if(SDL_MUSTLOCK(s)) {
+			SDL_UnlockSurface(s);
+		}
+	}
+
+	world::world(shader::program_object_ptr shader, graphics::const_texture_ptr block_atlas, const std::string& fname)
+		: size_x_(0), size_y_(0), size_z_(0), shader_(shader), block_atlas_(block_atlas), mesh_mode_(MESH_GREEDY),
+		completed_meshes_(new mesh_queue), pending_meshes_(0), upload_budget_us_(default_upload_budget_us),
+		remesh_budget_us_(default_remesh_budget_us), remesh_cost_us_(0),
+		occlusion_(occlusion_width, occlusion_height), occlusion_culling_(true), visibility_culling_(true),
+		lod_distance_(default_lod_distance), ram_budget_(0), vram_budget_(0), vram_bytes_(0), frame_(0),
+		completed_loads_(new load_queue), light_(chunks_), lighting_(false), paths_(chunks_), pathfinding_(false)
+	{
+		init();
+
+		// Image x maps to world x, image y maps to world z and y is up.
+		std::vector<uint8_t> heights;
+		load_heightmap(fname, heights, size_x_, size_z_);
+		chunks_.build_from_heightmap(heights, size_x_, size_z_, 1); // hard coded block type.
+		size_y_ = 256;
+	}
+
+	world::world(shader::program_object_ptr shader, graphics::const_texture_ptr block_atlas, chunk_source_ptr store)
+		: size_x_(0), size_y_(0), size_z_(0), shader_(shader), block_atlas_(block_atlas), mesh_mode_(MESH_GREEDY),
+		completed_meshes_(new mesh_queue), pending_meshes_(0), upload_budget_us_(default_upload_budget_us),
+		remesh_budget_us_(default_remesh_budget_us), remesh_cost_us_(0),
+		occlusion_(occlusion_width, occlusion_height), occlusion_culling_(true), visibility_culling_(true),
+		lod_distance_(default_lod_distance), ram_budget_(0), vram_budget_(0), vram_bytes_(0), frame_(0),
+		completed_loads_(new load_queue), light_(chunks_), lighting_(false), paths_(chunks_), pathfinding_(false)
+	{
+		init();
+		chunks_.set_store(store);
+	}
 
-		arrays_ = cube_array_buffer();
+	void world::init()
+	{
+		model_ = glm::mat4(1.0f);
+
+		// grab actives iterators from shader so we can use them later to draw.
+		mm_uniform_it_ = shader_->get_uniform_iterator("model_matrix");
+		chunk_offset_it_ = shader_->get_uniform_iterator("u_chunk_offset");
+		a_packed_it_ = shader_->get_attribute_iterator("a_packed");
+		tex0_it_ = shader_->get_uniform_iterator("u_tex0");
+		ASSERT_LOG(block_atlas_ != NULL, "world: no block atlas texture given.");
 	}
 
 	world::~world()
@@ -59,94 +190,772 @@ namespace cube
 
 	bool world::is_solid(int x, int y, int z) const
 	{
-		auto it = blocks_.find(boost::make_tuple(x,y,z));
-		if(it == blocks_.end()) {
-			return false;
-		}
-		return it->second != 0;
+		return chunks_.is_solid(x, y, z);
 	}
 
 	void world::build_world()
 	{
-		for(auto b = blocks_.begin(); b != blocks_.end(); ++b) {
-			int x, y, z;
-			boost::tie(x, y, z) = b->first;
-			if(x > 0) {
-				if(is_solid(x-1, y, z) == false) {
-					add_face(x,y,z,LEFT);
+		std::vector<uint64_t> keys;
+		chunks_.keys(keys);
+		for(auto it = keys.begin(); it != keys.end(); ++it) {
+			int cx, cy, cz;
+			chunk_map::from_key(*it, cx, cy, cz);
+			queue_mesh(cx, cy, cz);
+		}
+	}
+
+	void world::save(const std::string& dir) const
+	{
+		region_store::save(chunks_, dir);
+	}
+
+	void world::queue_mesh(int cx, int cy, int cz)
+	{
+		// The neighbourhood is gathered here so the job never touches the
+		// chunk_map itself.
+		const uint64_t key = chunk_map::key(cx, cy, cz);
+		const unsigned generation = ++mesh_generation_[key];
+		threading::get_pool().add_job(boost::bind(&world::mesh_job, completed_meshes_,
+			chunk_neighbourhood(chunks_, cx, cy, cz), mesh_mode_, key, generation));
+		++pending_meshes_;
+	}
+
+	void world::mesh_job(boost::shared_ptr<mesh_queue> q, chunk_neighbourhood nh, mesh_mode mode, uint64_t key, unsigned generation)
+	{
+		mesh_result r;
+		r.key = key;
+		r.generation = generation;
+		r.meshes.reset(new chunk_mesh[num_lod_levels]);
+		mesh_levels(nh, mode, r.meshes.get());
+
+		boost::mutex::scoped_lock lock(q->guard);
+		q->completed.push_back(r);
+	}
+
+	void world::set_lighting(bool enable)
+	{
+		lighting_ = enable;
+		if(!enable) {
+			light_.clear();
+			return;
+		}
+		// Chunks not yet paged in are lit once streaming loads them.
+		std::vector<uint64_t> keys(stream_.streamed().begin(), stream_.streamed().end());
+		for(auto it = chunks_.begin(); it != chunks_.end(); ++it) {
+			if(!stream_.is_streamed(it->first)) {
+				keys.push_back(it->first);
+			}
+		}
+		light_.add_chunks(keys, threading::get_pool());
+	}
+
+	void world::set_pathfinding(bool enable)
+	{
+		pathfinding_ = enable;
+		if(!enable) {
+			paths_.clear();
+			return;
+		}
+		std::vector<uint64_t> keys(stream_.streamed().begin(), stream_.streamed().end());
+		for(auto it = chunks_.begin(); it != chunks_.end(); ++it) {
+			keys.push_back(it->first);
+		}
+		for(auto it = keys.begin(); it != keys.end(); ++it) {
+			int cx, cy, cz;
+			chunk_map::from_key(*it, cx, cy, cz);
+			paths_.add_chunk(cx, cy, cz);
+		}
+		paths_.update(threading::get_pool());
+	}
+
+	void world::set_block(int x, int y, int z, block_id b)
+	{
+		if(chunks_.get_block(x, y, z) == b) {
+			return;
+		}
+		chunks_.set_block(x, y, z, b);
+		if(lighting_) {
+			light_.block_changed(x, y, z);
+		}
+		if(pathfinding_) {
+			paths_.block_changed(x, y, z);
+		}
+		for_each_chunk_touching(x, y, z, [this](int cx, int cy, int cz) { mark_dirty(cx, cy, cz); });
+	}
+
+	void world::fill_box(const block_box& box, block_id b)
+	{
+		chunks_.fill_box(box, b);
+		if(lighting_) {
+			light_.blocks_changed(box);
+		}
+		if(pathfinding_) {
+			paths_.blocks_changed(box);
+		}
+		mark_box_dirty(box);
+	}
+
+	void world::fill_sphere(int x, int y, int z, int radius, block_id b)
+	{
+		chunks_.fill_sphere(x, y, z, radius, b);
+		const block_box box = { x - radius, y - radius, z - radius, 2 * radius + 1, 2 * radius + 1, 2 * radius + 1 };
+		if(lighting_) {
+			light_.blocks_changed(box);
+		}
+		if(pathfinding_) {
+			paths_.blocks_changed(box);
+		}
+		mark_box_dirty(box);
+	}
+
+	void world::paste(const block_volume& v, int x, int y, int z)
+	{
+		chunks_.paste(v, x, y, z);
+		const block_box box = { x, y, z, v.sx, v.sy, v.sz };
+		if(lighting_) {
+			light_.blocks_changed(box);
+		}
+		if(pathfinding_) {
+			paths_.blocks_changed(box);
+		}
+		mark_box_dirty(box);
+	}
+
+	void world::mark_box_dirty(const block_box& box)
+	{
+		if(box.sx <= 0 || box.sy <= 0 || box.sz <= 0) {
+			return;
+		}
+		for(int cy = chunk_map::to_chunk(box.y - 1); cy <= chunk_map::to_chunk(box.y + box.sy); ++cy) {
+			for(int cz = chunk_map::to_chunk(box.z - 1); cz <= chunk_map::to_chunk(box.z + box.sz); ++cz) {
+				for(int cx = chunk_map::to_chunk(box.x - 1); cx <= chunk_map::to_chunk(box.x + box.sx); ++cx) {
+					mark_dirty(cx, cy, cz);
 				}
-			} else {
-				add_face(x,y,z,LEFT);
 			}
-			if(x < size_x_ - 1) {
-				if(is_solid(x+1, y, z)) {
-					add_face(x,y,z,RIGHT);
+		}
+	}
+
+	void world::mark_dirty(int cx, int cy, int cz)
+	{
+		const uint64_t key = chunk_map::key(cx, cy, cz);
+		// Neither resident nor drawn, so there is nothing to update. Never
+		// pages in, which for a terrain_generator would run the generator
+		// here on the main thread.
+		if(!chunks_.resident_chunk(cx, cy, cz) && draw_data_.find(key) == draw_data_.end()) {
+			return;
+		}
+		if(dirty_.insert(key).second) {
+			dirty_queue_.push_back(key);
+		}
+	}
+
+	void world::remesh_dirty()
+	{
+		profile::timer remesh_timer;
+		for(int done = 0; !dirty_queue_.empty(); ++done) {
+			// Stop if the next chunk would be expected to overrun the budget.
+			const double start = remesh_timer.elapsed_time_microseconds();
+			if(done != 0 && start + remesh_cost_us_ > remesh_budget_us_) {
+				break;
+			}
+			const uint64_t key = dirty_queue_.front();
+			dirty_queue_.pop_front();
+			dirty_.erase(key);
+
+			// Supersedes any mesh job still running for this chunk.
+			++mesh_generation_[key];
+
+			int cx, cy, cz;
+			chunk_map::from_key(key, cx, cy, cz);
+			for(int l = 0; l != num_lod_levels; ++l) {
+				remesh_scratch_[l].clear();
+			}
+			mesh_levels(chunk_neighbourhood(chunks_, cx, cy, cz), mesh_mode_, remesh_scratch_);
+			upload_mesh(key, remesh_scratch_);
+
+			remesh_cost_us_ = 0.75 * remesh_cost_us_ + 0.25 * (remesh_timer.elapsed_time_microseconds() - start);
+		}
+	}
+
+	void world::update()
+	{
+		remesh_dirty();
+		if(stream_.active()) {
+			stream_chunks();
+		}
+
+		profile::timer upload_timer;
+		while(upload_timer.elapsed_time_microseconds() < upload_budget_us_) {
+			mesh_result r;
+			{
+				boost::mutex::scoped_lock lock(completed_meshes_->guard);
+				if(completed_meshes_->completed.empty()) {
+					break;
 				}
-			} else {
-				add_face(x,y,z,RIGHT);
+				r = completed_meshes_->completed.front();
+				completed_meshes_->completed.pop_front();
+			}
+			--pending_meshes_;
+
+			auto gen = mesh_generation_.find(r.key);
+			if(gen != mesh_generation_.end() && gen->second == r.generation) {
+				upload_mesh(r.key, r.meshes.get());
 			}
-			if(y > 0) {
-				if(is_solid(x, y-1, z) == false) {
-					add_face(x,y,z,BOTTOM);
+		}
+
+		if(pathfinding_) {
+			paths_.update(threading::get_pool());
+		}
+		enforce_memory_budget();
+	}
+
+	void world::set_stream_radius(int radius)
+	{
+		ASSERT_LOG(radius >= 0, "world::set_stream_radius(): negative radius " << radius);
+		stream_.set_radius(radius);
+	}
+
+	void world::set_focus(const glm::vec3& pos)
+	{
+		stream_.set_focus(chunk_map::to_chunk(int(std::floor(pos.x))),
+			chunk_map::to_chunk(int(std::floor(pos.y))),
+			chunk_map::to_chunk(int(std::floor(pos.z))));
+	}
+
+	void world::set_memory_budget(size_t ram_bytes, size_t vram_bytes)
+	{
+		ram_budget_ = ram_bytes;
+		vram_budget_ = vram_bytes;
+	}
+
+	void world::stream_chunks()
+	{
+		const bool concurrent = chunks_.store() && chunks_.store()->concurrent_loads();
+		if(concurrent) {
+			load_chunks();
+		}
+
+		profile::timer stream_timer;
+		while(stream_.queued() != 0
+			&& pending_meshes_ < max_streaming_jobs
+			&& stream_timer.elapsed_time_microseconds() < stream_budget_us) {
+			const uint64_t key = stream_.front();
+			int cx, cy, cz;
+			chunk_map::from_key(key, cx, cy, cz);
+			// Meshing waits for the neighbours too, since gathering the
+			// neighbourhood would otherwise load them here.
+			if(concurrent && !request_neighbourhood(cx, cy, cz)) {
+				break;
+			}
+			if(!stream_.pop()) {
+				continue;
+			}
+			// Pages the chunk in if the world is backed by region files.
+			const bool stored = chunks_.get_chunk(cx, cy, cz).get() != NULL;
+			if(lighting_) {
+				light_.add_chunk(cx, cy, cz);
+			}
+			if(pathfinding_) {
+				paths_.add_chunk(cx, cy, cz);
+			}
+			if(stored) {
+				queue_mesh(cx, cy, cz);
+			}
+		}
+		stream_stats_.chunks_queued = stream_.queued();
+	}
+
+	void world::load_chunks()
+	{
+		for(;;) {
+			std::pair<uint64_t, chunk_ptr> loaded;
+			{
+				boost::mutex::scoped_lock lock(completed_loads_->guard);
+				if(completed_loads_->completed.empty()) {
+					break;
+				}
+				loaded = completed_loads_->completed.front();
+				completed_loads_->completed.pop_front();
+			}
+			int cx, cy, cz;
+			chunk_map::from_key(loaded.first, cx, cy, cz);
+			chunks_.add_paged_in(cx, cy, cz, loaded.second);
+			loading_.erase(loaded.first);
+		}
+
+		// Keeps the loads running ahead of meshing, in stream order.
+		uint64_t key;
+		while(loading_.size() < max_loading_jobs && stream_.next_load(key)) {
+			int cx, cy, cz;
+			chunk_map::from_key(key, cx, cy, cz);
+			request_neighbourhood(cx, cy, cz);
+		}
+	}
+
+	bool world::request_neighbourhood(int cx, int cy, int cz)
+	{
+		bool paged_in = true;
+		for(int dy = -1; dy <= 1; ++dy) {
+			for(int dz = -1; dz <= 1; ++dz) {
+				for(int dx = -1; dx <= 1; ++dx) {
+					if(chunks_.is_paged_in(cx + dx, cy + dy, cz + dz)) {
+						continue;
+					}
+					paged_in = false;
+					const uint64_t key = chunk_map::key(cx + dx, cy + dy, cz + dz);
+					if(loading_.insert(key).second) {
+						threading::get_pool().add_job(boost::bind(&world::load_job, completed_loads_, chunks_.store(), key));
+					}
 				}
-			} else {
-				add_face(x,y,z,BOTTOM);
 			}
-			if(y < size_y_ - 1) {
-				if(is_solid(x, y+1, z)) {
-					add_face(x,y,z,TOP);
+		}
+		return paged_in;
+	}
+
+	void world::load_job(boost::shared_ptr<load_queue> q, chunk_source_ptr store, uint64_t key)
+	{
+		int cx, cy, cz;
+		chunk_map::from_key(key, cx, cy, cz);
+		chunk_ptr c = store->load_chunk(cx, cy, cz);
+
+		boost::mutex::scoped_lock lock(q->guard);
+		q->completed.push_back(std::make_pair(key, c));
+	}
+
+	void world::enforce_memory_budget()
+	{
+		const size_t ram = chunks_.memory_usage() + light_.memory_usage() + paths_.memory_usage();
+		stream_stats_.chunks_resident = chunks_.num_chunks();
+		stream_stats_.chunks_meshed = draw_data_.size();
+		stream_stats_.ram_bytes = ram;
+		stream_stats_.vram_bytes = vram_bytes_;
+		// Without a store nothing can be dropped from memory.
+		const bool over_ram = ram_budget_ != 0 && ram > ram_budget_ && chunks_.store();
+		const bool over_vram = vram_budget_ != 0 && vram_bytes_ > vram_budget_;
+		if(!over_ram && !over_vram) {
+			return;
+		}
+
+		// Chunks outside the stream radius first, then least recently drawn
+		// first. Chunks drawn this frame, or waiting to be remeshed, are left
+		// alone. Those inside the radius are streamed in again.
+		std::vector<std::pair<std::pair<bool, unsigned>, uint64_t> > lru;
+		if(over_vram) {
+			for(auto it = draw_data_.begin(); it != draw_data_.end(); ++it) {
+				if(it->second.last_drawn != frame_ && dirty_.count(it->first) == 0) {
+					lru.push_back(std::make_pair(std::make_pair(stream_.in_radius(it->first), it->second.last_drawn), it->first));
 				}
-			} else {
-				add_face(x,y,z,TOP);
 			}
-			if(z > 0) {
-				if(is_solid(x, y, z-1) == false) {
-					add_face(x,y,z,FRONT);
+			std::sort(lru.begin(), lru.end());
+			for(auto it = lru.begin(); it != lru.end() && vram_bytes_ > vram_budget_; ++it) {
+				evict_mesh(it->second);
+				++stream_stats_.chunks_evicted;
+			}
+			lru.clear();
+		}
+
+		if(over_ram) {
+			for(auto it = chunks_.begin(); it != chunks_.end(); ++it) {
+				auto dd = draw_data_.find(it->first);
+				const unsigned last_drawn = dd == draw_data_.end() ? 0 : dd->second.last_drawn;
+				if(last_drawn != frame_ && dirty_.count(it->first) == 0) {
+					lru.push_back(std::make_pair(std::make_pair(stream_.in_radius(it->first), last_drawn), it->first));
 				}
-			} else {
-				add_face(x,y,z,FRONT);
 			}
-			if(z < size_z_ - 1) {
-				if(is_solid(x, y, z+1) == false) {
-					add_face(x,y,z,BACK);
+			std::sort(lru.begin(), lru.end());
+			size_t used = ram;
+			for(auto it = lru.begin(); it != lru.end() && used > ram_budget_; ++it) {
+				int cx, cy, cz;
+				chunk_map::from_key(it->second, cx, cy, cz);
+				const size_t bytes = chunks_.get_chunk(cx, cy, cz)->memory_usage() + (light_.has_chunk(cx, cy, cz) ? chunk_volume : 0);
+				if(chunks_.unload_chunk(cx, cy, cz)) {
+					used -= std::min(used, bytes);
+					// Its mesh can stay, but it needs loading, and lighting,
+					// again before streaming can remesh it.
+					stream_.evict(it->second);
+					light_.remove_chunk(cx, cy, cz);
+					paths_.remove_chunk(cx, cy, cz);
+					++stream_stats_.chunks_evicted;
 				}
-			} else {
-				add_face(x,y,z,BACK);
 			}
 		}
+		stream_stats_.chunks_resident = chunks_.num_chunks();
+		stream_stats_.chunks_meshed = draw_data_.size();
+		stream_stats_.vram_bytes = vram_bytes_;
+	}
 
-		
-		//glBindBuffer(GL_ARRAY_BUFFER, arrays_[0]);
-		//glBufferData(GL_ARRAY_BUFFER, sizeof(cube_face_varray), cube_face_varray, GL_STATIC_DRAW);
-		//glBindBuffer(GL_ARRAY_BUFFER, arrays_[0]);
-		//glBufferData(GL_ARRAY_BUFFER, sizeof(cube_face_tarray), cube_face_tarray, GL_STATIC_DRAW);
+	void world::evict_mesh(uint64_t key)
+	{
+		auto dd = draw_data_.find(key);
+		if(dd != draw_data_.end()) {
+			vram_bytes_ -= dd->second.total * sizeof(packed_vertex);
+			draw_data_.erase(dd);
+			tree_.remove(key);
+		}
+		if(occluder_boxes_.erase(key) != 0) {
+			occluder_tree_.remove(key);
+		}
+		// Unknown connectivity is treated as open, which is conservative.
+		visibility_.remove(key);
+		// Drops the result of any mesh job still running.
+		++mesh_generation_[key];
+		stream_.evict(key);
 	}
 
-	void world::add_face(int x, int y, int z, int direction)
+	void world::mesh_levels(const chunk_neighbourhood& nh, mesh_mode mode, chunk_mesh* meshes)
 	{
-		switch(direction) {
-		case FRONT:
-			vertices_[FRONT].push_back(x+1); vertices_[FRONT].push_back(y+1); vertices_[FRONT].push_back(z+1);
-			vertices_[FRONT].push_back(x+1); vertices_[FRONT].push_back(y+1); vertices_[FRONT].push_back(z);
-			vertices_[FRONT].push_back(x); vertices_[FRONT].push_back(y+1); vertices_[FRONT].push_back(z+1);
-
-			vertices_[FRONT].push_back(x); vertices_[FRONT].push_back(y+1); vertices_[FRONT].push_back(z+1);
-			vertices_[FRONT].push_back(x+1); vertices_[FRONT].push_back(y+1); vertices_[FRONT].push_back(z);
-			vertices_[FRONT].push_back(x); vertices_[FRONT].push_back(y+1); vertices_[FRONT].push_back(z);
-			break;
-		case RIGHT:
-		case TOP:
-		case BACK:
-		case LEFT:
-		case BOTTOM:
+		mesh_chunk(nh, mode, meshes[0]);
+		if(meshes[0].vertex_count() == 0) {
+			return;
+		}
+		for(int l = 1; l != num_lod_levels; ++l) {
+			mesh_chunk_lod(nh, l, meshes[l]);
 		}
 	}
 
-	void world::draw() const
+	void world::upload_mesh(uint64_t key, const chunk_mesh* meshes)
+	{
+		const chunk_mesh& mesh = meshes[0];
+		int cx, cy, cz;
+		chunk_map::from_key(key, cx, cy, cz);
+		const glm::vec3 offset(GLfloat(cx * chunk_size), GLfloat(cy * chunk_size), GLfloat(cz * chunk_size));
+
+		if(mesh.solid_height >= min_occluder_height) {
+			const graphics::aabb box(offset + glm::vec3(occluder_inset),
+				offset + glm::vec3(GLfloat(chunk_size), GLfloat(mesh.solid_height), GLfloat(chunk_size)) - glm::vec3(occluder_inset));
+			occluder_boxes_[key] = box;
+			occluder_tree_.insert(key, box);
+		} else if(occluder_boxes_.erase(key) != 0) {
+			occluder_tree_.remove(key);
+		}
+
+		visibility_.set(key, mesh.connectivity);
+
+		auto old = draw_data_.find(key);
+		if(old != draw_data_.end()) {
+			vram_bytes_ -= old->second.total * sizeof(packed_vertex);
+		}
+
+		size_t total = 0;
+		for(int l = 0; l != num_lod_levels; ++l) {
+			total += meshes[l].vertex_count();
+		}
+		if(total == 0) {
+			draw_data_.erase(key);
+			tree_.remove(key);
+			return;
+		}
+
+		chunk_draw_data& dd = draw_data_[key];
+		if(dd.vbo == NULL) {
+			dd.vbo = boost::shared_array<GLuint>(new GLuint[1], graphics::vbo_deleter(1));
+			glGenBuffers(1, &dd.vbo[0]);
+		}
+		dd.offset[0] = offset.x;
+		dd.offset[1] = offset.y;
+		dd.offset[2] = offset.z;
+
+		graphics::state::bind_buffer(GL_ARRAY_BUFFER, dd.vbo[0]);
+		glBufferData(GL_ARRAY_BUFFER, total * sizeof(packed_vertex), NULL, GL_STATIC_DRAW);
+		GLint first = 0;
+		for(int l = 0; l != num_lod_levels; ++l) {
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				const std::vector<packed_vertex>& v = meshes[l].vertices[d];
+				dd.first[l][d] = first;
+				dd.count[l][d] = GLsizei(v.size());
+				if(!v.empty()) {
+					glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(packed_vertex), v.size() * sizeof(packed_vertex), &v[0]);
+				}
+				first += dd.count[l][d];
+			}
+		}
+		dd.total = first;
+		vram_bytes_ += dd.total * sizeof(packed_vertex);
+
+		// Reduced levels stand proud of the full detail surface, so the
+		// bounds cover them all.
+		graphics::aabb box;
+		for(int l = 0; l != num_lod_levels; ++l) {
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				for(auto v = meshes[l].vertices[d].begin(); v != meshes[l].vertices[d].end(); ++v) {
+					box.add(glm::vec3(GLfloat(vertex_x(*v)), GLfloat(vertex_y(*v)), GLfloat(vertex_z(*v))));
+				}
+			}
+		}
+		box.min += offset;
+		box.max += offset;
+		dd.box = box;
+		tree_.insert(key, box);
+	}
+
+	size_t world::vertex_count() const
+	{
+		size_t cnt = 0;
+		for(auto it = draw_data_.begin(); it != draw_data_.end(); ++it) {
+			cnt += it->second.total;
+		}
+		return cnt;
+	}
+
+	void world::draw(graphics::render& render_obj) const
 	{
 		shader_->make_active();
 
+		// The view and projection are global uniforms, see render::set_view().
 		shader_->set_uniform(mm_uniform_it_, model());
 
+		const GLint tex_unit = 0;
+		shader_->set_uniform(tex0_it_, &tex_unit);
+
+		stats_ = draw_stats();
+		++frame_;
+		const glm::vec4 camera = glm::inverse(model_) * glm::vec4(render_obj.camera_position(), 1.0f);
+		const glm::mat4 mvp = glm::make_mat4(render_obj.projection()) * glm::make_mat4(render_obj.view()) * model_;
+		const graphics::frustum view_frustum(mvp);
+
+		visible_.clear();
+		tree_.query(view_frustum, boost::bind(push_key, boost::ref(visible_), _1), stats_.culling);
+		if(visibility_culling_) {
+			visibility_.flood(chunk_map::to_chunk(int(std::floor(camera.x))),
+				chunk_map::to_chunk(int(std::floor(camera.y))),
+				chunk_map::to_chunk(int(std::floor(camera.z))),
+				view_frustum, max_visibility_distance, reachable_);
+		}
+		if(occlusion_culling_) {
+			draw_occluders(view_frustum, mvp, camera);
+		}
+
+		graphics::render_queue& queue = render_obj.queue();
+		for(auto it = visible_.begin(); it != visible_.end(); ++it) {
+			if(visibility_culling_ && reachable_.count(*it) == 0) {
+				++stats_.chunks_unreachable;
+				continue;
+			}
+			if(occlusion_culling_ && !occlusion_.is_visible(draw_data_.find(*it)->second.box)) {
+				++stats_.chunks_occluded;
+				continue;
+			}
+			const graphics::aabb& b = draw_data_.find(*it)->second.box;
+			const glm::vec3 centre = (b.min + b.max) * 0.5f;
+			const float depth = glm::distance(centre, glm::vec3(camera.x, camera.y, camera.z));
+			queue.submit(queue.opaque_key(shader_->get(), 0, draw_data_.find(*it)->second.vbo[0], depth),
+				boost::bind(&world::draw_chunk, this, *it, camera));
+		}
+	}
+
+	void world::draw_occluders(const graphics::frustum& f, const glm::mat4& mvp, const glm::vec4& camera) const
+	{
+		// Nearest first, by distance to the centre of the occluder.
+		std::vector<uint64_t> keys;
+		cull_stats unused;
+		occluder_tree_.query(f, boost::bind(push_key, boost::ref(keys), _1), unused);
+		occluders_.clear();
+		for(auto it = keys.begin(); it != keys.end(); ++it) {
+			const graphics::aabb& b = occluder_boxes_.find(*it)->second;
+			const glm::vec3 d = (b.min + b.max) * 0.5f - glm::vec3(camera.x, camera.y, camera.z);
+			occluders_.push_back(std::make_pair(glm::dot(d, d), *it));
+		}
+		const size_t cnt = std::min(occluders_.size(), max_occluders);
+		std::partial_sort(occluders_.begin(), occluders_.begin() + cnt, occluders_.end());
+
+		occlusion_.clear(mvp);
+		for(size_t n = 0; n != cnt; ++n) {
+			occlusion_.add_occluder(occluder_boxes_.find(occluders_[n].second)->second);
+		}
+		occlusion_.build_pyramid();
+		stats_.occluders_drawn = occlusion_.occluders_drawn();
+	}
+
+	int world::select_lod(const chunk_draw_data& dd, const glm::vec4& camera) const
+	{
+		if(lod_distance_ <= 0.0f) {
+			return 0;
+		}
+		// Distance to the nearest point of the chunk, so the camera's own
+		// chunk and its neighbours are always at full detail.
+		float dist2 = 0.0f;
+		for(int a = 0; a != 3; ++a) {
+			const float d = std::max(std::max(dd.offset[a] - camera[a], camera[a] - dd.offset[a] - chunk_size), 0.0f);
+			dist2 += d * d;
+		}
+		int lod = 0;
+		for(float limit = lod_distance_; lod != num_lod_levels - 1 && dist2 >= limit * limit; limit *= 2.0f) {
+			++lod;
+		}
+		return lod;
+	}
+
+	void world::draw_chunk(uint64_t key, const glm::vec4& camera) const
+	{
+		auto it = draw_data_.find(key);
+		ASSERT_LOG(it != draw_data_.end(), "world::draw_chunk(): chunk in tree without draw data");
+		const chunk_draw_data& dd = it->second;
+		dd.last_drawn = frame_;
+		const int lod = select_lod(dd, camera);
+		++stats_.chunks_at_lod[lod];
+		// Other draws may have run since this chunk was queued.
+		shader_->make_active();
+		// Each packed_vertex is read as four unsigned bytes, see chunk_mesher.hpp.
+		graphics::state::use_attributes(graphics::state::attribute_bit(a_packed_it_->second.location));
+		graphics::state::bind_texture(0, block_atlas_->id());
+		shader_->set_uniform(chunk_offset_it_, dd.offset);
+		graphics::state::bind_buffer(GL_ARRAY_BUFFER, dd.vbo[0]);
+		glVertexAttribPointer(a_packed_it_->second.location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+
+		// Faces in a bucket all lie in planes inside the chunk, so a bucket
+		// can only face the camera if the camera is on its side of the far
+		// plane of the chunk. Visible buckets next to each other in the
+		// buffer are drawn together.
+		GLint first = 0;
+		GLsizei count = 0;
+		for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+			const int a = direction_axis[d];
+			const bool visible = direction_offset[d][a] > 0
+				? camera[a] > dd.offset[a]
+				: camera[a] < dd.offset[a] + chunk_size;
+			if(!visible) {
+				stats_.vertices_backfacing += dd.count[lod][d];
+				if(count != 0) {
+					glDrawArrays(GL_TRIANGLES, first, count);
+				}
+				count = 0;
+				continue;
+			}
+			if(count == 0) {
+				first = dd.first[lod][d];
+			}
+			count += dd.count[lod][d];
+			stats_.vertices_drawn += dd.count[lod][d];
+		}
+		if(count != 0) {
+			glDrawArrays(GL_TRIANGLES, first, count);
+		}
+	}
+}
+
+namespace
+{
+	cube::chunk_map& benchmark_world()
+	{
+		static cube::chunk_map res;
+		if(res.num_chunks() == 0) {
+			std::vector<uint8_t> heights;
+			int width, depth;
+			cube::load_heightmap(module::map_file("images/noise.png"), heights, width, depth);
+			res.build_from_heightmap(heights, width, depth, 1);
+		}
+		return res;
+	}
+
+	void benchmark_mesh(int benchmark_iterations, cube::mesh_mode mode, bool& reported)
+	{
+		const cube::chunk_map& cm = benchmark_world();
+		cube::chunk_mesh mesh;
+		BENCHMARK_LOOP {
+			mesh.clear();
+			for(auto it = cm.begin(); it != cm.end(); ++it) {
+				cube::mesh_chunk(cm, it->second->cx(), it->second->cy(), it->second->cz(), mode, mesh);
+			}
+		}
+		if(!reported) {
+			std::cerr << "noise.png: " << cm.num_chunks() << " chunks, " << mesh.vertex_count() << " vertices, "
+				<< mesh.memory_usage() << " bytes" << std::endl;
+			reported = true;
+		}
+	}
+}
+
+BENCHMARK(cube_mesh_naive)
+{
+	static bool reported = false;
+	benchmark_mesh(benchmark_iterations, cube::MESH_NAIVE, reported);
+}
+
+BENCHMARK(cube_mesh_greedy)
+{
+	static bool reported = false;
+	benchmark_mesh(benchmark_iterations, cube::MESH_GREEDY, reported);
+}
+
+// Meshes the same world straight from column runs, without building chunks.
+BENCHMARK(cube_mesh_columns)
+{
+	static cube::column_map_ptr cols;
+	const cube::chunk_map& cm = benchmark_world();
+	if(!cols) {
+		std::vector<uint8_t> heights;
+		int width, depth;
+		cube::load_heightmap(module::map_file("images/noise.png"), heights, width, depth);
+		cols.reset(new cube::column_map(width, depth));
+		cols->build_from_heightmap(heights, 1);
+		std::cerr << "noise.png: " << cols->memory_usage() << " bytes as columns, " << cm.memory_usage() << " bytes as chunks" << std::endl;
+	}
+	cube::chunk_mesh mesh;
+	BENCHMARK_LOOP {
+		mesh.clear();
+		for(auto it = cm.begin(); it != cm.end(); ++it) {
+			cube::mesh_chunk(*cols, it->second->cx(), it->second->cy(), it->second->cz(), mesh);
+		}
+	}
+}
+
+// Meshes every reduced detail level, reporting how many vertices each keeps.
+BENCHMARK(cube_mesh_lod)
+{
+	static bool reported = false;
+	const cube::chunk_map& cm = benchmark_world();
+	cube::chunk_mesh meshes[cube::num_lod_levels];
+	BENCHMARK_LOOP {
+		for(int l = 1; l != cube::num_lod_levels; ++l) {
+			meshes[l].clear();
+			for(auto it = cm.begin(); it != cm.end(); ++it) {
+				cube::mesh_chunk_lod(cube::chunk_neighbourhood(cm, it->second->cx(), it->second->cy(), it->second->cz()), l, meshes[l]);
+			}
+		}
+	}
+	if(!reported) {
+		for(int l = 1; l != cube::num_lod_levels; ++l) {
+			std::cerr << "noise.png level " << l << ": " << meshes[l].vertex_count() << " vertices" << std::endl;
+		}
+		reported = true;
+	}
+}
+
+// Digs out and replaces the top block of a column on a chunk corner, so each
+// edit dirties three chunks, remeshing them as world::update() would.
+BENCHMARK(cube_dig)
+{
+	cube::chunk_map& cm = benchmark_world();
+	const int x = cube::chunk_size - 1, z = cube::chunk_size - 1;
+	int y = 255;
+	while(y > 0 && !cm.is_solid(x, y, z)) {
+		--y;
+	}
+	cube::chunk_mesh mesh;
+	auto remesh = [&](int cx, int cy, int cz) {
+		mesh.clear();
+		cube::mesh_chunk(cube::chunk_neighbourhood(cm, cx, cy, cz), cube::MESH_GREEDY, mesh);
+	};
+	BENCHMARK_LOOP {
+		cm.set_block(x, y, z, cube::empty_block);
+		cube::for_each_chunk_touching(x, y, z, remesh);
+		cm.set_block(x, y, z, 1);
+		cube::for_each_chunk_touching(x, y, z, remesh);
+	}
+}
+
+// Opens a saved copy of the benchmark world and pages in a single chunk,
+// which shouldn't depend on the size of the world.
+BENCHMARK(cube_region_open)
+{
+	static std::string dir;
+	if(dir.empty()) {
+		dir = (boost::filesystem::temp_directory_path() / "a3de_region_benchmark").string();
+		cube::region_store::save(benchmark_world(), dir);
+	}
+	BENCHMARK_LOOP {
+		cube::chunk_map cm;
+		cm.set_store(cube::region_store_ptr(new cube::region_store(dir)));
+		cm.get_block(0, 0, 0);
 	}
 }
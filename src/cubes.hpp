@@ -1,42 +1,248 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <iostream>
+#include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/unordered_map.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <boost/unordered_set.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "chunk.hpp"
+#include "chunk_mesher.hpp"
+#include "chunk_stream.hpp"
+#include "chunk_tree.hpp"
+#include "light_engine.hpp"
+#include "occlusion.hpp"
+#include "pathfinder.hpp"
+#include "region_file.hpp"
 #include "shaders.hpp"
 #include "texture.hpp"
 
+namespace graphics
+{
+	class render;
+}
+
 namespace cube
 {
-	typedef boost::unordered_map<boost::tuple<int,int,int>, uint16_t> block_type;
+	// GL side of a meshed chunk. All the vertices live in one buffer, each
+	// detail level after the last, with the faces for each direction of a
+	// level stored as a consecutive range. Vertex positions are relative to
+	// offset, the world position of the chunk.
+	struct chunk_draw_data
+	{
+		chunk_draw_data();
+
+		boost::shared_array<GLuint> vbo;
+		GLfloat offset[3];
+		GLint first[num_lod_levels][NUM_DIRECTIONS];
+		GLsizei count[num_lod_levels][NUM_DIRECTIONS];
+		// Vertices over all levels.
+		GLsizei total;
+		graphics::aabb box;
+		// Frame the chunk was last drawn in, for choosing what to evict.
+		mutable unsigned last_drawn;
+	};
+
+	// Counts from the last world::draw().
+	struct draw_stats
+	{
+		draw_stats();
+
+		cull_stats culling;
+		size_t vertices_drawn;
+		// Vertices in face buckets skipped for pointing away from the camera.
+		size_t vertices_backfacing;
+		// Chunks inside the frustum which can't be seen through empty space
+		// from the chunk holding the camera.
+		size_t chunks_unreachable;
+		// Chunks inside the frustum but hidden behind the occluders drawn.
+		size_t chunks_occluded;
+		size_t occluders_drawn;
+		// Chunks drawn at each detail level.
+		size_t chunks_at_lod[num_lod_levels];
+	};
+
+	// Memory use and streaming progress as of the last world::update().
+	struct stream_stats
+	{
+		stream_stats();
+
+		// Chunks held in memory, and those with a mesh on the GPU.
+		size_t chunks_resident;
+		size_t chunks_meshed;
+		size_t ram_bytes;
+		size_t vram_bytes;
+		// Chunks inside the stream radius still waiting to be loaded.
+		size_t chunks_queued;
+		// Total chunks evicted to stay within the memory budget.
+		size_t chunks_evicted;
+	};
+
+	// Reads the red channel of an image as a width x depth array of heights.
+	void load_heightmap(const std::string& fname, std::vector<uint8_t>& heights, int& width, int& depth);
+
 	class world
 	{
 	public:
-		enum {
-			FRONT,
-			RIGHT,
-			TOP,
-			BACK,
-			LEFT,
-			BOTTOM,
-		};
-		world(shader::program_object_ptr shader, const std::string& fname);
+		// shader should take chunk_mesh's packed vertices, as data/chunk.vert
+		// does. block_atlas holds a 16x16 grid of tiles, one per block type,
+		// as data/chunk.frag expects.
+		world(shader::program_object_ptr shader, graphics::const_texture_ptr block_atlas, const std::string& fname);
+		// Chunks are paged in from store as they're first needed, so opening
+		// a world from a region_store only reads the region file headers it
+		// touches. Stores which allow concurrent loads, such as a
+		// terrain_generator, are loaded from on the worker threads while
+		// streaming.
+		world(shader::program_object_ptr shader, graphics::const_texture_ptr block_atlas, chunk_source_ptr store);
 		virtual ~world();
 
 		const GLfloat* model() const { return glm::value_ptr(model_); }
-		void draw() const;
+		// Submits the chunks in the view frustum to the render queue, each
+		// skipping the face buckets which can't face the camera. With
+		// occlusion culling on, the nearest solid chunks are first drawn into
+		// a software depth buffer and chunks hidden behind them are skipped.
+		// The draw stats are complete once the queue has been flushed.
+		void draw(graphics::render& render_obj) const;
+		const draw_stats& get_draw_stats() const { return stats_; }
+		void set_occlusion_culling(bool enable) { occlusion_culling_ = enable; }
+		bool get_occlusion_culling() const { return occlusion_culling_; }
+		// Filled by the last draw(), may be used to cull other objects in the
+		// same view.
+		const graphics::occlusion_buffer& occlusion() const { return occlusion_; }
+		// Skips chunks with no path through empty space to the camera, such
+		// as caves behind solid rock. See visibility_graph::flood().
+		void set_visibility_culling(bool enable) { visibility_culling_ = enable; }
+		bool get_visibility_culling() const { return visibility_culling_; }
+		// Chunks nearer the camera than distance, in blocks, are drawn at full
+		// detail. Each doubling of the distance beyond that drops a detail
+		// level, see mesh_chunk_lod(). 0 always draws full detail.
+		void set_lod_distance(float distance) { lod_distance_ = distance; }
+		float get_lod_distance() const { return lod_distance_; }
 
+		// Queues a mesh job on the worker pool for every chunk and returns
+		// straight away. Meshes are uploaded by update() as they complete.
 		void build_world();
-		void add_face(int x, int y, int z, int direction);
+		// Writes every chunk to region files in dir, see region_store::save().
+		void save(const std::string& dir) const;
+		// Remeshes dirty chunks and uploads completed meshes, each step
+		// stopping once its budget for this frame is used up. Must be called
+		// from the thread owning the GL context.
+		void update();
+		size_t pending_meshes() const { return pending_meshes_; }
+		void set_upload_budget(int microseconds) { upload_budget_us_ = microseconds; }
+
+		// Instead of meshing everything up front with build_world(), loads and
+		// meshes the chunks within radius chunks of the focus point, nearest
+		// first, a few each update(). 0 turns streaming off.
+		void set_stream_radius(int radius);
+		int get_stream_radius() const { return stream_.radius(); }
+		// Usually the camera position.
+		void set_focus(const glm::vec3& pos);
+		// When a budget is exceeded, update() evicts the chunks drawn least
+		// recently: meshes are dropped from the GPU for the VRAM budget, and
+		// unmodified chunks paged in from a chunk_source are dropped from
+		// memory for the RAM budget. Chunks outside the stream radius go
+		// first, those inside it are streamed in again. 0 means no limit.
+		void set_memory_budget(size_t ram_bytes, size_t vram_bytes);
+		const stream_stats& get_stream_stats() const { return stream_stats_; }
 
+		// Keeps block and sky light up to date for the chunks in memory, see
+		// light_engine. Turning it on lights them all at once, after which
+		// edits only relight the blocks around them and streamed chunks are
+		// lit as they arrive. Off by default.
+		void set_lighting(bool enable);
+		bool get_lighting() const { return lighting_; }
+		// Should be set before lighting is turned on.
+		void set_light_emission(block_id b, int level) { light_.set_emission(b, level); }
+		const light_engine& light() const { return light_; }
+
+		// Keeps a pathfinder over the chunks in memory, rebuilding the parts
+		// edited or streamed in during update(). Paths may be found from any
+		// thread, but not while update() runs. Off by default.
+		void set_pathfinding(bool enable);
+		bool get_pathfinding() const { return pathfinding_; }
+		const pathfinder& paths() const { return paths_; }
+
+		block_id get_block(int x, int y, int z) const { return chunks_.get_block(x, y, z); }
+		// Changes a single block, marking its chunk dirty along with any
+		// neighbouring chunk whose faces touch the block.
+		void set_block(int x, int y, int z, block_id b);
+		void clear_block(int x, int y, int z) { set_block(x, y, z, empty_block); }
+		// Region edits, see chunk_map::fill_box() and friends. Each marks the
+		// chunks it touches dirty once, however many blocks it changes.
+		void fill_box(const block_box& box, block_id b);
+		void fill_sphere(int x, int y, int z, int radius, block_id b);
+		void copy_box(const block_box& box, block_volume& out) const { chunks_.copy_box(box, out); }
+		void paste(const block_volume& v, int x, int y, int z);
+		// Dirty chunks are remeshed by update() on the calling thread, so edits
+		// show up on the next draw. At least one chunk is remeshed per update(),
+		// more only if they are expected to fit in the budget.
+		size_t dirty_chunks() const { return dirty_queue_.size(); }
+		void set_remesh_budget(int microseconds) { remesh_budget_us_ = microseconds; }
+
+		mesh_mode get_mesh_mode() const { return mesh_mode_; }
+		void set_mesh_mode(mesh_mode mode) { mesh_mode_ = mode; }
+		size_t vertex_count() const;
+
+		const chunk_map& chunks() const { return chunks_; }
+		void memory_report(std::ostream& os) const { chunks_.memory_report(os); }
 	protected:
 		bool is_solid(int x, int y, int z) const;
 	private:
-		shader::program_object_ptr shader_;
-		block_type blocks_;
+		void init();
+		void stream_chunks();
+		// Takes chunks loaded on the worker threads and starts loading more.
+		void load_chunks();
+		// Returns true if the chunk and its neighbours have all been paged
+		// in, otherwise starts loading those which haven't.
+		bool request_neighbourhood(int cx, int cy, int cz);
+		void enforce_memory_budget();
+		void evict_mesh(uint64_t key);
+		void queue_mesh(int cx, int cy, int cz);
+		void draw_chunk(uint64_t key, const glm::vec4& camera) const;
+		void draw_occluders(const graphics::frustum& f, const glm::mat4& mvp, const glm::vec4& camera) const;
+		void mark_dirty(int cx, int cy, int cz);
+		// Marks every chunk overlapping the box grown by a block, so the
+		// faces and ambient occlusion of the neighbours are redone too.
+		void mark_box_dirty(const block_box& box);
+		void remesh_dirty();
+		// Takes num_lod_levels meshes, full detail first.
+		void upload_mesh(uint64_t key, const chunk_mesh* meshes);
+		int select_lod(const chunk_draw_data& dd, const glm::vec4& camera) const;
+
+		// Meshes every detail level of a chunk into meshes, which should be
+		// empty. Chunks with no full detail faces get no reduced ones either.
+		static void mesh_levels(const chunk_neighbourhood& nh, mesh_mode mode, chunk_mesh* meshes);
+
+		struct mesh_result
+		{
+			uint64_t key;
+			unsigned generation;
+			boost::shared_array<chunk_mesh> meshes;
+		};
+		// Shared with the mesh jobs, so jobs still running when the world is
+		// destroyed have somewhere to put their output.
+		struct mesh_queue
+		{
+			boost::mutex guard;
+			std::deque<mesh_result> completed;
+		};
+		static void mesh_job(boost::shared_ptr<mesh_queue> q, chunk_neighbourhood nh, mesh_mode mode, uint64_t key, unsigned generation);
+
+		// Chunks loaded on the worker threads, when the store allows it.
+		struct load_queue
+		{
+			boost::mutex guard;
+			std::deque<std::pair<uint64_t, chunk_ptr> > completed;
+		};
+		static void load_job(boost::shared_ptr<load_queue> q, chunk_source_ptr store, uint64_t key);
+
+		chunk_map chunks_;
 		glm::mat4 model_;
 
 		int size_x_;
@@ -45,16 +251,65 @@ namespace cube
 
 		shader::program_object_ptr shader_;
 		shader::const_actives_map_iterator mm_uniform_it_;
-		shader::const_actives_map_iterator a_position_it_;
-		shader::const_actives_map_iterator a_tex_coord_it_;
+		shader::const_actives_map_iterator chunk_offset_it_;
+		shader::const_actives_map_iterator a_packed_it_;
 		shader::const_actives_map_iterator tex0_it_;
+		graphics::const_texture_ptr block_atlas_;
 
-		boost::shared_array<GLuint> arrays_;
+		mesh_mode mesh_mode_;
 
-		std::vector<GLfloat> vertices_[6];
+		boost::shared_ptr<mesh_queue> completed_meshes_;
+		// Latest mesh requested for each chunk, older results are dropped.
+		boost::unordered_map<uint64_t, unsigned> mesh_generation_;
+		size_t pending_meshes_;
+		int upload_budget_us_;
+
+		// Chunks awaiting a remesh in the order they were edited.
+		std::deque<uint64_t> dirty_queue_;
+		boost::unordered_set<uint64_t> dirty_;
+		int remesh_budget_us_;
+		// Running average of the time taken to remesh and upload one chunk.
+		double remesh_cost_us_;
+		chunk_mesh remesh_scratch_[num_lod_levels];
+
+		typedef boost::unordered_map<uint64_t, chunk_draw_data> draw_map;
+		draw_map draw_data_;
+		// Bounds of every chunk in draw_data_. Mutable since queries update
+		// bounds changed since the last one.
+		mutable chunk_tree tree_;
+		mutable draw_stats stats_;
+
+		// Solid slab at the bottom of each chunk which has one, see
+		// chunk_mesh::solid_height.
+		boost::unordered_map<uint64_t, graphics::aabb> occluder_boxes_;
+		mutable chunk_tree occluder_tree_;
+		mutable graphics::occlusion_buffer occlusion_;
+		bool occlusion_culling_;
+		mutable std::vector<uint64_t> visible_;
+		mutable std::vector<std::pair<float, uint64_t> > occluders_;
+
+		visibility_graph visibility_;
+		bool visibility_culling_;
+		mutable boost::unordered_set<uint64_t> reachable_;
+
+		float lod_distance_;
+
+		stream_queue stream_;
+		size_t ram_budget_;
+		size_t vram_budget_;
+		size_t vram_bytes_;
+		stream_stats stream_stats_;
+		mutable unsigned frame_;
+		boost::shared_ptr<load_queue> completed_loads_;
+		boost::unordered_set<uint64_t> loading_;
+
+		light_engine light_;
+		bool lighting_;
+		pathfinder paths_;
+		bool pathfinding_;
 
-		world() {}
-		world(const world&) {}
+		world();
+		world(const world&);
 	};
 
-}
\ No newline at end of file
+}
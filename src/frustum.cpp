@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cfloat>
+
+#include "frustum.hpp"
+#include "unit_test.hpp"
+
+namespace graphics
+{
+	aabb::aabb()
+		: min(FLT_MAX), max(-FLT_MAX)
+	{
+	}
+
+	aabb::aabb(const glm::vec3& mn, const glm::vec3& mx)
+		: min(mn), max(mx)
+	{
+	}
+
+	void aabb::add(const glm::vec3& p)
+	{
+		for(int n = 0; n != 3; ++n) {
+			min[n] = std::min(min[n], p[n]);
+			max[n] = std::max(max[n], p[n]);
+		}
+	}
+
+	void aabb::add(const aabb& b)
+	{
+		if(!b.empty()) {
+			add(b.min);
+			add(b.max);
+		}
+	}
+
+	frustum::frustum()
+	{
+		// Accepts everything.
+		for(int n = 0; n != 6; ++n) {
+			planes_[n][0] = planes_[n][1] = planes_[n][2] = 0.0f;
+			planes_[n][3] = 1.0f;
+		}
+	}
+
+	frustum::frustum(const glm::mat4& mvp)
+	{
+		// Gribb and Hartmann. Row i of a column major matrix is mvp[0..3][i];
+		// the planes are row 3 plus or minus each of rows 0, 1 and 2.
+		for(int n = 0; n != 6; ++n) {
+			const int row = n / 2;
+			const float sign = n & 1 ? -1.0f : 1.0f;
+			for(int c = 0; c != 4; ++c) {
+				planes_[n][c] = mvp[c][3] + sign * mvp[c][row];
+			}
+		}
+	}
+
+	frustum::intersection frustum::test(const aabb& b) const
+	{
+		if(b.empty()) {
+			return OUTSIDE;
+		}
+		intersection res = INSIDE;
+		for(int n = 0; n != 6; ++n) {
+			const float* p = planes_[n];
+			// Corners furthest along and furthest against the plane normal.
+			float far_dist = p[3], near_dist = p[3];
+			for(int a = 0; a != 3; ++a) {
+				if(p[a] >= 0.0f) {
+					far_dist += p[a] * b.max[a];
+					near_dist += p[a] * b.min[a];
+				} else {
+					far_dist += p[a] * b.min[a];
+					near_dist += p[a] * b.max[a];
+				}
+			}
+			if(far_dist < 0.0f) {
+				return OUTSIDE;
+			} else if(near_dist < 0.0f) {
+				res = INTERSECTS;
+			}
+		}
+		return res;
+	}
+}
+
+UNIT_TEST(frustum)
+{
+	// With an identity matrix the frustum is the clip space cube.
+	graphics::frustum f(glm::mat4(1.0f));
+	CHECK_EQ(f.test(graphics::aabb(glm::vec3(-0.5f), glm::vec3(0.5f))), graphics::frustum::INSIDE);
+	CHECK_EQ(f.test(graphics::aabb(glm::vec3(0.5f), glm::vec3(1.5f))), graphics::frustum::INTERSECTS);
+	CHECK_EQ(f.test(graphics::aabb(glm::vec3(1.5f), glm::vec3(2.5f))), graphics::frustum::OUTSIDE);
+	CHECK_EQ(f.test(graphics::aabb(glm::vec3(-3.0f, 0.0f, 0.0f), glm::vec3(-2.0f, 0.1f, 0.1f))), graphics::frustum::OUTSIDE);
+	CHECK_EQ(f.is_visible(graphics::aabb()), false);
+
+	graphics::aabb b;
+	b.add(glm::vec3(1.0f, 2.0f, 3.0f));
+	b.add(graphics::aabb(glm::vec3(-1.0f), glm::vec3(0.0f)));
+	CHECK_EQ(b.min.x, -1.0f);
+	CHECK_EQ(b.max.z, 3.0f);
+}
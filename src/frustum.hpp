@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace graphics
+{
+	// Axis aligned bounding box. A default constructed box is empty, adding
+	// anything to it makes it non-empty.
+	struct aabb
+	{
+		aabb();
+		aabb(const glm::vec3& mn, const glm::vec3& mx);
+
+		bool empty() const { return min.x > max.x; }
+		void add(const glm::vec3& p);
+		void add(const aabb& b);
+
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	// The six clip planes of a view frustum, facing inwards.
+	class frustum
+	{
+	public:
+		enum intersection
+		{
+			OUTSIDE,
+			INTERSECTS,
+			INSIDE,
+		};
+
+		frustum();
+		// Extracts the planes from a combined projection * view (* model)
+		// matrix. Anything tested must be in the space the matrix transforms
+		// from.
+		explicit frustum(const glm::mat4& mvp);
+
+		intersection test(const aabb& b) const;
+		bool is_visible(const aabb& b) const { return test(b) != OUTSIDE; }
+	private:
+		// a, b, c, d with ax + by + cz + d >= 0 for points inside.
+		float planes_[6][4];
+	};
+}
@@ -0,0 +1,176 @@
+#include "asserts.hpp"
+#include "gl_state.hpp"
+
+namespace graphics
+{
+	namespace state
+	{
+		namespace
+		{
+			// Never a name GL hands out, so whatever is asked for next goes
+			// through.
+			const GLuint unknown = ~GLuint(0);
+			const int max_texture_units = 32;
+
+			GLuint current_program = unknown;
+			GLuint array_buffer = unknown;
+			GLuint element_array_buffer = unknown;
+			GLuint textures[max_texture_units];
+			bool textures_known = false;
+			int active_unit = -1;
+			uint32_t attributes = 0;
+			bool attributes_known = false;
+			GLint max_attributes = 0;
+
+			stats call_stats;
+
+			bool changes(GLuint& shadow, GLuint value)
+			{
+				if(shadow == value) {
+					++call_stats.calls_dropped;
+					return false;
+				}
+				++call_stats.calls;
+				shadow = value;
+				return true;
+			}
+
+			GLuint& buffer_binding(GLenum target)
+			{
+				ASSERT_LOG(target == GL_ARRAY_BUFFER || target == GL_ELEMENT_ARRAY_BUFFER, "state::bind_buffer(): unhandled target " << target);
+				return target == GL_ARRAY_BUFFER ? array_buffer : element_array_buffer;
+			}
+		}
+
+		void use_program(GLuint program)
+		{
+			if(changes(current_program, program)) {
+				glUseProgram(program);
+			}
+		}
+
+		void delete_program(GLuint program)
+		{
+			if(current_program == program) {
+				current_program = unknown;
+			}
+			glDeleteProgram(program);
+		}
+
+		void bind_buffer(GLenum target, GLuint buffer)
+		{
+			if(changes(buffer_binding(target), buffer)) {
+				glBindBuffer(target, buffer);
+			}
+		}
+
+		void delete_buffers(GLsizei n, const GLuint* buffers)
+		{
+			// GL unbinds deleted buffers, leaving 0 bound in their place.
+			for(GLsizei i = 0; i != n; ++i) {
+				if(array_buffer == buffers[i]) {
+					array_buffer = 0;
+				}
+				if(element_array_buffer == buffers[i]) {
+					element_array_buffer = 0;
+				}
+			}
+			glDeleteBuffers(n, buffers);
+		}
+
+		void bind_texture(int unit, GLuint texture)
+		{
+			ASSERT_LOG(unit >= 0 && unit < max_texture_units, "state::bind_texture(): bad texture unit " << unit);
+			if(!textures_known) {
+				for(int n = 0; n != max_texture_units; ++n) {
+					textures[n] = unknown;
+				}
+				textures_known = true;
+			}
+			if(textures[unit] == texture) {
+				++call_stats.calls_dropped;
+				return;
+			}
+			if(active_unit != unit) {
+				glActiveTexture(GL_TEXTURE0 + unit);
+				active_unit = unit;
+				++call_stats.calls;
+			}
+			glBindTexture(GL_TEXTURE_2D, texture);
+			textures[unit] = texture;
+			++call_stats.calls;
+		}
+
+		void delete_textures(GLsizei n, const GLuint* ids)
+		{
+			if(textures_known) {
+				for(GLsizei i = 0; i != n; ++i) {
+					for(int unit = 0; unit != max_texture_units; ++unit) {
+						if(textures[unit] == ids[i]) {
+							textures[unit] = 0;
+						}
+					}
+				}
+			}
+			glDeleteTextures(n, ids);
+		}
+
+		void use_attributes(uint32_t mask)
+		{
+			if(max_attributes == 0) {
+				glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attributes);
+				if(max_attributes > 32) {
+					max_attributes = 32;
+				}
+			}
+			ASSERT_LOG(max_attributes == 32 || (mask >> max_attributes) == 0, "state::use_attributes(): attribute location out of range in " << mask);
+			const uint32_t changed = attributes_known ? attributes ^ mask : ~uint32_t(0);
+			for(GLint location = 0; location != max_attributes; ++location) {
+				if((changed & attribute_bit(location)) == 0) {
+					continue;
+				}
+				if(mask & attribute_bit(location)) {
+					glEnableVertexAttribArray(location);
+				} else {
+					glDisableVertexAttribArray(location);
+				}
+				++call_stats.calls;
+			}
+			if(attributes_known && changed == 0) {
+				++call_stats.calls_dropped;
+			}
+			attributes = mask;
+			attributes_known = true;
+		}
+
+		void invalidate()
+		{
+			current_program = unknown;
+			array_buffer = unknown;
+			element_array_buffer = unknown;
+			textures_known = false;
+			active_unit = -1;
+			attributes_known = false;
+		}
+
+		const stats& get_stats()
+		{
+			return call_stats;
+		}
+
+		void record_call(bool dropped)
+		{
+			if(dropped) {
+				++call_stats.calls_dropped;
+			} else {
+				++call_stats.calls;
+			}
+		}
+
+		void reset_stats()
+		{
+			call_stats.calls = 0;
+			call_stats.calls_dropped = 0;
+		}
+	}
+}
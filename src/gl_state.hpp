@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+	// Shadows the GL state most often changed between draws, dropping calls
+	// which wouldn't change it. Everything which uses a program, binds a
+	// buffer or texture, or enables vertex attributes should go through
+	// here, or call invalidate() afterwards, or the shadow goes stale.
+	// Only for the thread which owns the context.
+	namespace state
+	{
+		void use_program(GLuint program);
+		// Deletes the program, forgetting it if it's in use.
+		void delete_program(GLuint program);
+
+		// GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER.
+		void bind_buffer(GLenum target, GLuint buffer);
+		// Deletes the buffers, forgetting any which are bound.
+		void delete_buffers(GLsizei n, const GLuint* buffers);
+
+		// Binds the GL_TEXTURE_2D texture of the unit, 0 for GL_TEXTURE0 and
+		// so on, making the unit active if it needs changing.
+		void bind_texture(int unit, GLuint texture);
+		void delete_textures(GLsizei n, const GLuint* textures);
+
+		// Enables the vertex attributes whose locations have their bit set
+		// in mask and disables the rest.
+		void use_attributes(uint32_t mask);
+		inline uint32_t attribute_bit(GLint location) { return uint32_t(1) << location; }
+
+		// Forgets everything, so the next call of each kind goes through.
+		void invalidate();
+
+		// Calls made to GL and dropped since the last reset_stats().
+		struct stats
+		{
+			size_t calls;
+			size_t calls_dropped;
+		};
+		const stats& get_stats();
+		// Counts a call shadowed elsewhere, such as a uniform upload.
+		void record_call(bool dropped);
+		void reset_stats();
+	}
+}
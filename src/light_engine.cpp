@@ -0,0 +1,668 @@
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "asserts.hpp"
+#include "light_engine.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		// Chunk columns lit by each job of add_chunks() is at least this
+		// many.
+		const size_t min_columns_per_job = 2;
+
+		// Never a valid chunk_map key, which only uses 63 bits.
+		const uint64_t no_key = ~uint64_t(0);
+
+		int get_channel(uint8_t light, int shift) { return (light >> shift) & 0xf; }
+		void set_channel(uint8_t& light, int shift, int level) { light = uint8_t((light & ~(0xf << shift)) | (level << shift)); }
+
+		// Level passed from a block with the given light to its neighbour in
+		// direction d.
+		int passed_level(int level, int channel_shift, int d)
+		{
+			return channel_shift != 0 && d == BOTTOM && level == max_light ? max_light : level - 1;
+		}
+	}
+
+	struct light_engine::local_batch
+	{
+		// Column n is chunks column_start[n] up to column_start[n + 1].
+		std::vector<size_t> column_start;
+		std::vector<const chunk*> chunks;
+		std::vector<char> sky_open;
+		std::vector<uint8_t*> light;
+
+		boost::mutex guard;
+		boost::condition_variable done;
+		int remaining;
+	};
+
+	light_engine::light_engine(const chunk_map& cm)
+		: chunks_(cm), has_emitters_(false), updated_(0)
+	{
+		reset_cache();
+	}
+
+	light_engine::~light_engine()
+	{
+	}
+
+	void light_engine::set_emission(block_id b, int level)
+	{
+		ASSERT_LOG(level >= 0 && level <= max_light, "Light emission out of range: " << level);
+		ASSERT_LOG(b != empty_block || level == 0, "Empty blocks can't give off light");
+		if(b >= emission_.size()) {
+			emission_.resize(b + 1);
+		}
+		emission_[b] = uint8_t(level);
+		has_emitters_ = std::find_if(emission_.begin(), emission_.end(), [](uint8_t e) { return e != 0; }) != emission_.end();
+	}
+
+	void light_engine::add_chunk(int cx, int cy, int cz)
+	{
+		if(has_chunk(cx, cy, cz)) {
+			return;
+		}
+		reset_cache();
+		updated_ = 0;
+		boost::shared_array<uint8_t> light(new uint8_t[chunk_volume]);
+		light_local(chunks_.resident_chunk(cx, cy, cz), !has_chunk(cx, cy + 1, cz), NULL, light.get(), local_scratch_);
+		light_[chunk_map::key(cx, cy, cz)] = light;
+
+		for(int channel = 0; channel != NUM_CHANNELS; ++channel) {
+			if(channel == SKY_CHANNEL) {
+				cover_sky(cx, cy, cz);
+			}
+			queue_borders(cx, cy, cz, channel);
+			spread(channel);
+		}
+	}
+
+	void light_engine::add_chunks(const std::vector<uint64_t>& keys, threading::pool& p)
+	{
+		reset_cache();
+		updated_ = 0;
+		std::vector<uint64_t> added;
+		for(auto k : keys) {
+			if(light_.count(k) == 0) {
+				light_[k] = boost::shared_array<uint8_t>(new uint8_t[chunk_volume]);
+				added.push_back(k);
+			}
+		}
+		if(added.empty()) {
+			return;
+		}
+
+		// Every chunk is added before any are lit, so those under another
+		// being added aren't lit as if open to the sky.
+		std::vector<uint64_t> order(added);
+		std::sort(order.begin(), order.end(), [](uint64_t a, uint64_t b) {
+			int ax, ay, az, bx, by, bz;
+			chunk_map::from_key(a, ax, ay, az);
+			chunk_map::from_key(b, bx, by, bz);
+			return ax != bx ? ax < bx : (az != bz ? az < bz : ay > by);
+		});
+		local_batch batch;
+		for(size_t n = 0; n != order.size(); ++n) {
+			int cx, cy, cz;
+			chunk_map::from_key(order[n], cx, cy, cz);
+			if(n == 0 || order[n - 1] != chunk_map::key(cx, cy + 1, cz)) {
+				batch.column_start.push_back(n);
+			}
+			batch.chunks.push_back(chunks_.resident_chunk(cx, cy, cz));
+			batch.sky_open.push_back(!has_chunk(cx, cy + 1, cz));
+			batch.light.push_back(light_[order[n]].get());
+		}
+		const size_t columns = batch.column_start.size();
+		batch.column_start.push_back(order.size());
+
+		// The calling thread lights the first part itself.
+		const size_t parts = std::min(size_t(p.num_threads() + 1), (columns + min_columns_per_job - 1) / min_columns_per_job);
+		const size_t per_part = (columns + parts - 1) / parts;
+		batch.remaining = int(parts - 1);
+		for(size_t n = 1; n != parts; ++n) {
+			p.add_job(boost::bind(light_columns_job, this, &batch, n * per_part, std::min(columns, (n + 1) * per_part)));
+		}
+		light_columns(batch, 0, std::min(columns, per_part), local_scratch_);
+		{
+			boost::mutex::scoped_lock lock(batch.guard);
+			while(batch.remaining != 0) {
+				batch.done.wait(lock);
+			}
+		}
+
+		// Then light crosses between chunks one channel at a time.
+		const boost::unordered_set<uint64_t> added_set(added.begin(), added.end());
+		for(int channel = 0; channel != NUM_CHANNELS; ++channel) {
+			if(channel == SKY_CHANNEL) {
+				for(auto k : added) {
+					int cx, cy, cz;
+					chunk_map::from_key(k, cx, cy, cz);
+					if(added_set.count(chunk_map::key(cx, cy - 1, cz)) == 0) {
+						cover_sky(cx, cy, cz);
+					}
+				}
+			}
+			for(auto k : added) {
+				int cx, cy, cz;
+				chunk_map::from_key(k, cx, cy, cz);
+				queue_borders(cx, cy, cz, channel);
+			}
+			spread(channel);
+		}
+	}
+
+	void light_engine::light_columns(local_batch& batch, size_t first, size_t last, local_scratch& scratch) const
+	{
+		for(size_t column = first; column != last; ++column) {
+			for(size_t n = batch.column_start[column]; n != batch.column_start[column + 1]; ++n) {
+				const uint8_t* above = n == batch.column_start[column] ? NULL : batch.light[n - 1];
+				light_local(batch.chunks[n], batch.sky_open[n] != 0, above, batch.light[n], scratch);
+			}
+		}
+	}
+
+	void light_engine::light_columns_job(const light_engine* e, local_batch* batch, size_t first, size_t last)
+	{
+		local_scratch scratch;
+		e->light_columns(*batch, first, last, scratch);
+		boost::mutex::scoped_lock lock(batch->guard);
+		if(--batch->remaining == 0) {
+			batch->done.notify_one();
+		}
+	}
+
+	void light_engine::remove_chunk(int cx, int cy, int cz)
+	{
+		light_.erase(chunk_map::key(cx, cy, cz));
+		reset_cache();
+	}
+
+	void light_engine::clear()
+	{
+		light_.clear();
+		reset_cache();
+	}
+
+	void light_engine::light_local(const chunk* c, bool sky_open, const uint8_t* above, uint8_t* light, local_scratch& scratch) const
+	{
+		std::fill(light, light + chunk_volume, uint8_t(0));
+		if(c != NULL && c->is_uniform() && !c->is_empty()) {
+			// Solid throughout, so nothing spreads.
+			const int level = emission(c->uniform_type());
+			std::fill(light, light + chunk_volume, uint8_t(level));
+			return;
+		}
+
+		// Looking blocks up in the chunk's palette for every step of the
+		// flood fill is slow, so which are solid is noted first.
+		std::vector<uint8_t>& solid = scratch.solid;
+		std::vector<int>& queue = scratch.queue;
+		solid.assign(chunk_volume, 0);
+		queue.clear();
+		if(c != NULL && !c->is_empty()) {
+			for(int n = 0; n != chunk_volume; ++n) {
+				const block_id b = c->get_index(n);
+				if(b != empty_block) {
+					solid[n] = 1;
+					const int level = has_emitters_ ? emission(b) : 0;
+					if(level != 0) {
+						light[n] = uint8_t(level);
+						queue.push_back(n);
+					}
+				}
+			}
+		}
+
+		for(int channel = 0; channel != NUM_CHANNELS; ++channel) {
+			const int shift = channel * 4;
+			if(channel == SKY_CHANNEL && (sky_open || above != NULL)) {
+				queue.clear();
+				for(int z = 0; z != chunk_size; ++z) {
+					for(int x = 0; x != chunk_size; ++x) {
+						if(!sky_open && get_channel(above[chunk::index(x, 0, z)], shift) != max_light) {
+							continue;
+						}
+						for(int y = chunk_mask; y >= 0 && !solid[chunk::index(x, y, z)]; --y) {
+							set_channel(light[chunk::index(x, y, z)], shift, max_light);
+						}
+					}
+				}
+				// Only the edges of the columns lit can spread light sideways.
+				for(int n = 0; n != chunk_volume; ++n) {
+					if(get_channel(light[n], shift) != max_light) {
+						continue;
+					}
+					const int x = n & chunk_mask, z = (n >> chunk_shift) & chunk_mask;
+					if((x != 0 && !solid[n - 1] && get_channel(light[n - 1], shift) != max_light)
+						|| (x != chunk_mask && !solid[n + 1] && get_channel(light[n + 1], shift) != max_light)
+						|| (z != 0 && !solid[n - chunk_size] && get_channel(light[n - chunk_size], shift) != max_light)
+						|| (z != chunk_mask && !solid[n + chunk_size] && get_channel(light[n + chunk_size], shift) != max_light)) {
+						queue.push_back(n);
+					}
+				}
+			} else if(channel == SKY_CHANNEL) {
+				break;
+			}
+
+			for(size_t head = 0; head != queue.size(); ++head) {
+				const int n = queue[head];
+				const int level = get_channel(light[n], shift);
+				const int pos[3] = { n & chunk_mask, n >> (2*chunk_shift), (n >> chunk_shift) & chunk_mask };
+				for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+					const int x = pos[0] + direction_offset[d][0];
+					const int y = pos[1] + direction_offset[d][1];
+					const int z = pos[2] + direction_offset[d][2];
+					if((x | y | z) & ~chunk_mask) {
+						continue;
+					}
+					const int m = chunk::index(x, y, z);
+					const int l = passed_level(level, shift, d);
+					if(get_channel(light[m], shift) >= l || solid[m]) {
+						continue;
+					}
+					set_channel(light[m], shift, l);
+					queue.push_back(m);
+				}
+			}
+		}
+	}
+
+	void light_engine::cover_sky(int cx, int cy, int cz)
+	{
+		if(!has_chunk(cx, cy - 1, cz)) {
+			return;
+		}
+		const int y = cy * chunk_size;
+		for(int z = cz * chunk_size; z != (cz + 1) * chunk_size; ++z) {
+			for(int x = cx * chunk_size; x != (cx + 1) * chunk_size; ++x) {
+				uint8_t* below = light_at(x, y - 1, z);
+				if(get_channel(*below, 4) == max_light && get_channel(*light_at(x, y, z), 4) != max_light) {
+					set_channel(*below, 4, 0);
+					const light_node node = { x, y - 1, z, uint8_t(max_light) };
+					removal_.push_back(node);
+					++updated_;
+				}
+			}
+		}
+		remove(SKY_CHANNEL);
+	}
+
+	void light_engine::queue_borders(int cx, int cy, int cz, int channel)
+	{
+		const int shift = channel * 4;
+		const int x0 = cx * chunk_size, y0 = cy * chunk_size, z0 = cz * chunk_size;
+		for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+			if(!has_chunk(cx + direction_offset[d][0], cy + direction_offset[d][1], cz + direction_offset[d][2])) {
+				continue;
+			}
+			// The face's axis, and the layer of the chunk on that side.
+			const int a = direction_offset[d][0] != 0 ? 0 : (direction_offset[d][1] != 0 ? 1 : 2);
+			const int side = direction_offset[d][a] > 0 ? chunk_mask : 0;
+			const int u = a == 0 ? 1 : 0, v = a == 2 ? 1 : 2;
+			for(int j = 0; j != chunk_size; ++j) {
+				for(int i = 0; i != chunk_size; ++i) {
+					int pos[3];
+					pos[a] = side;
+					pos[u] = i;
+					pos[v] = j;
+					const int x = x0 + pos[0], y = y0 + pos[1], z = z0 + pos[2];
+					const int ox = x + direction_offset[d][0], oy = y + direction_offset[d][1], oz = z + direction_offset[d][2];
+					const int inside = get_channel(*light_at(x, y, z), shift);
+					const int outside = get_channel(*light_at(ox, oy, oz), shift);
+					if(passed_level(inside, shift, d) > outside) {
+						const light_node node = { x, y, z, 0 };
+						increase_.push_back(node);
+					}
+					if(passed_level(outside, shift, opposite_direction(d)) > inside) {
+						const light_node node = { ox, oy, oz, 0 };
+						increase_.push_back(node);
+					}
+				}
+			}
+		}
+	}
+
+	void light_engine::blocks_changed(const block_box& box)
+	{
+		reset_cache();
+		updated_ = 0;
+		for(int channel = 0; channel != NUM_CHANNELS; ++channel) {
+			const int shift = channel * 4;
+
+			// Take out all light in the box and whatever came from it.
+			for(int y = box.y; y != box.y + box.sy; ++y) {
+				for(int z = box.z; z != box.z + box.sz; ++z) {
+					for(int x = box.x; x != box.x + box.sx; ++x) {
+						uint8_t* light = light_at(x, y, z);
+						if(light != NULL && get_channel(*light, shift) != 0) {
+							const light_node node = { x, y, z, uint8_t(get_channel(*light, shift)) };
+							set_channel(*light, shift, 0);
+							removal_.push_back(node);
+							++updated_;
+						}
+					}
+				}
+			}
+			remove(channel);
+
+			// Then spread it back from sources in the box and lit blocks
+			// around it.
+			for(int y = box.y - 1; y != box.y + box.sy + 1; ++y) {
+				for(int z = box.z - 1; z != box.z + box.sz + 1; ++z) {
+					for(int x = box.x - 1; x != box.x + box.sx + 1; ++x) {
+						uint8_t* light = light_at(x, y, z);
+						if(light == NULL) {
+							continue;
+						}
+						const bool inside = x >= box.x && x < box.x + box.sx && y >= box.y && y < box.y + box.sy && z >= box.z && z < box.z + box.sz;
+						int level = 0;
+						if(!inside) {
+							level = get_channel(*light, shift);
+						} else if(channel == BLOCK_CHANNEL) {
+							level = emission(block_at(x, y, z));
+						} else if(is_sky_source(x, y, z)) {
+							level = max_light;
+						}
+						if(level > get_channel(*light, shift)) {
+							set_channel(*light, shift, level);
+							++updated_;
+						}
+						if(level != 0) {
+							const light_node node = { x, y, z, 0 };
+							increase_.push_back(node);
+						}
+					}
+				}
+			}
+			spread(channel);
+		}
+	}
+
+	void light_engine::remove(int channel)
+	{
+		const int shift = channel * 4;
+		for(size_t head = 0; head != removal_.size(); ++head) {
+			const light_node n = removal_[head];
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				const int x = n.x + direction_offset[d][0];
+				const int y = n.y + direction_offset[d][1];
+				const int z = n.z + direction_offset[d][2];
+				uint8_t* light = light_at(x, y, z);
+				if(light == NULL) {
+					continue;
+				}
+				const int level = get_channel(*light, shift);
+				if(level == 0) {
+					continue;
+				}
+				if(level < n.level || (shift != 0 && d == BOTTOM && level == max_light && n.level == max_light)) {
+					// Lit from n, so goes dark too, unless it gives off
+					// light itself.
+					set_channel(*light, shift, 0);
+					const light_node dark = { x, y, z, uint8_t(level) };
+					removal_.push_back(dark);
+					++updated_;
+					const int own = channel == BLOCK_CHANNEL ? emission(block_at(x, y, z)) : 0;
+					if(own != 0) {
+						set_channel(*light, shift, own);
+						const light_node lit = { x, y, z, 0 };
+						increase_.push_back(lit);
+					}
+				} else {
+					// Lit from elsewhere, so may light the blocks removed.
+					const light_node lit = { x, y, z, 0 };
+					increase_.push_back(lit);
+				}
+			}
+		}
+		removal_.clear();
+	}
+
+	void light_engine::spread(int channel)
+	{
+		const int shift = channel * 4;
+		for(size_t head = 0; head != increase_.size(); ++head) {
+			const light_node n = increase_[head];
+			const int level = get_channel(*light_at(n.x, n.y, n.z), shift);
+			if(level <= 1) {
+				continue;
+			}
+			for(int d = 0; d != NUM_DIRECTIONS; ++d) {
+				const int x = n.x + direction_offset[d][0];
+				const int y = n.y + direction_offset[d][1];
+				const int z = n.z + direction_offset[d][2];
+				uint8_t* light = light_at(x, y, z);
+				const int l = passed_level(level, shift, d);
+				if(light == NULL || get_channel(*light, shift) >= l || block_at(x, y, z) != empty_block) {
+					continue;
+				}
+				set_channel(*light, shift, l);
+				const light_node lit = { x, y, z, 0 };
+				increase_.push_back(lit);
+				++updated_;
+			}
+		}
+		increase_.clear();
+	}
+
+	uint8_t light_engine::get_light(int x, int y, int z) const
+	{
+		auto it = light_.find(chunk_map::key(chunk_map::to_chunk(x), chunk_map::to_chunk(y), chunk_map::to_chunk(z)));
+		if(it == light_.end()) {
+			return 0;
+		}
+		return it->second[chunk::index(chunk_map::to_local(x), chunk_map::to_local(y), chunk_map::to_local(z))];
+	}
+
+	uint8_t* light_engine::light_at(int x, int y, int z)
+	{
+		const uint64_t k = chunk_map::key(chunk_map::to_chunk(x), chunk_map::to_chunk(y), chunk_map::to_chunk(z));
+		if(k != light_key_) {
+			auto it = light_.find(k);
+			light_key_ = k;
+			light_chunk_ = it == light_.end() ? NULL : it->second.get();
+		}
+		if(light_chunk_ == NULL) {
+			return NULL;
+		}
+		return light_chunk_ + chunk::index(chunk_map::to_local(x), chunk_map::to_local(y), chunk_map::to_local(z));
+	}
+
+	block_id light_engine::block_at(int x, int y, int z)
+	{
+		const int cx = chunk_map::to_chunk(x), cy = chunk_map::to_chunk(y), cz = chunk_map::to_chunk(z);
+		const uint64_t k = chunk_map::key(cx, cy, cz);
+		if(k != block_key_) {
+			block_key_ = k;
+			block_chunk_ = chunks_.resident_chunk(cx, cy, cz);
+		}
+		return block_chunk_ == NULL ? empty_block : block_chunk_->get(chunk_map::to_local(x), chunk_map::to_local(y), chunk_map::to_local(z));
+	}
+
+	bool light_engine::is_sky_source(int x, int y, int z)
+	{
+		return chunk_map::to_local(y) == chunk_mask
+			&& !has_chunk(chunk_map::to_chunk(x), chunk_map::to_chunk(y) + 1, chunk_map::to_chunk(z))
+			&& block_at(x, y, z) == empty_block;
+	}
+
+	void light_engine::reset_cache()
+	{
+		light_key_ = block_key_ = no_key;
+		light_chunk_ = NULL;
+		block_chunk_ = NULL;
+	}
+
+	size_t light_engine::memory_usage() const
+	{
+		return sizeof(*this) + light_.size() * (chunk_volume + sizeof(uint64_t) + sizeof(boost::shared_array<uint8_t>))
+			+ emission_.capacity() + (increase_.capacity() + removal_.capacity()) * sizeof(light_node)
+			+ local_scratch_.queue.capacity() * sizeof(int) + local_scratch_.solid.capacity();
+	}
+}
+
+namespace
+{
+	const cube::block_id lamp = 5;
+
+	// Chunks -2 to 1 along x and z and -1 to 1 along y, with solid ground
+	// below y = 0 and a lamp in a pit.
+	void light_test_world(cube::chunk_map& cm, std::vector<uint64_t>& keys)
+	{
+		const cube::block_box ground = { -64, -32, -64, 128, 32, 128 };
+		cm.fill_box(ground, 1);
+		const cube::block_box pit = { 8, -6, 8, 5, 6, 5 };
+		cm.fill_box(pit, cube::empty_block);
+		cm.set_block(10, -6, 10, lamp);
+		for(int cy = -1; cy <= 1; ++cy) {
+			for(int cz = -2; cz <= 1; ++cz) {
+				for(int cx = -2; cx <= 1; ++cx) {
+					keys.push_back(cube::chunk_map::key(cx, cy, cz));
+				}
+			}
+		}
+	}
+
+	// True if e has the same light everywhere as lighting cm from scratch.
+	bool matches_fresh_light(const cube::chunk_map& cm, const std::vector<uint64_t>& keys, const cube::light_engine& e)
+	{
+		cube::light_engine fresh(cm);
+		fresh.set_emission(lamp, 14);
+		fresh.add_chunks(keys, threading::get_pool());
+		for(int y = -32; y != 64; ++y) {
+			for(int z = -64; z != 64; ++z) {
+				for(int x = -64; x != 64; ++x) {
+					if(e.block_light(x, y, z) != fresh.block_light(x, y, z) || e.sky_light(x, y, z) != fresh.sky_light(x, y, z)) {
+						std::cerr << "Light differs at " << x << "," << y << "," << z << ": " << e.block_light(x, y, z) << "/" << e.sky_light(x, y, z)
+							<< " but lit from scratch " << fresh.block_light(x, y, z) << "/" << fresh.sky_light(x, y, z) << std::endl;
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+}
+
+UNIT_TEST(light_engine)
+{
+	cube::chunk_map cm;
+	std::vector<uint64_t> keys;
+	light_test_world(cm, keys);
+	cube::light_engine e(cm);
+	e.set_emission(lamp, 14);
+	e.add_chunks(keys, threading::get_pool());
+	CHECK_EQ(e.num_chunks(), keys.size());
+
+	// Light falls off by one per block from the lamp, around corners too.
+	CHECK_EQ(e.block_light(10, -6, 10), 14);
+	CHECK_EQ(e.block_light(10, -5, 10), 13);
+	CHECK_EQ(e.block_light(10, 0, 10), 8);
+	CHECK_EQ(e.block_light(15, 0, 10), 3);
+	CHECK_EQ(e.block_light(10, -7, 10), 0);
+	// Full sky light fills the open air and shines down into the pit.
+	CHECK_EQ(e.sky_light(-50, 40, 20), 15);
+	CHECK_EQ(e.sky_light(0, 0, 0), 15);
+	CHECK_EQ(e.sky_light(9, -5, 9), 15);
+	CHECK_EQ(e.sky_light(0, -1, 0), 0);
+
+	// A roof shades everything below it, and nothing but the blocks under it
+	// is relit.
+	const cube::block_box roof = { -64, 40, -64, 128, 1, 128 };
+	cm.fill_box(roof, 1);
+	e.blocks_changed(roof);
+	CHECK_EQ(e.sky_light(0, 0, 0), 0);
+	CHECK_EQ(e.sky_light(0, 41, 0), 15);
+	CHECK_EQ(matches_fresh_light(cm, keys, e), true);
+
+	// A hole in it lets light in again, spreading out underneath.
+	const cube::block_box hole = { 0, 40, 0, 1, 1, 1 };
+	cm.fill_box(hole, cube::empty_block);
+	e.blocks_changed(hole);
+	CHECK_EQ(e.sky_light(0, 0, 0), 15);
+	CHECK_EQ(e.sky_light(3, 0, 0), 12);
+	CHECK_EQ(matches_fresh_light(cm, keys, e), true);
+
+	// Taking out the lamp puts out its light, and a single block edit only
+	// relights the blocks near it.
+	cm.set_block(10, -6, 10, cube::empty_block);
+	e.block_changed(10, -6, 10);
+	CHECK_EQ(e.block_light(10, 0, 10), 0);
+	CHECK_EQ(e.last_update_blocks() < 8000, true);
+	CHECK_EQ(matches_fresh_light(cm, keys, e), true);
+	cm.set_block(10, -6, 10, lamp);
+	e.block_changed(10, -6, 10);
+	CHECK_EQ(e.block_light(10, 0, 10), 8);
+	CHECK_EQ(matches_fresh_light(cm, keys, e), true);
+
+	// Chunks added one at a time light the same as all at once, including
+	// taking sky light from the chunks below them.
+	cube::light_engine single(cm);
+	single.set_emission(lamp, 14);
+	for(auto it = keys.begin(); it != keys.end(); ++it) {
+		int cx, cy, cz;
+		cube::chunk_map::from_key(*it, cx, cy, cz);
+		single.add_chunk(cx, cy, cz);
+	}
+	CHECK_EQ(matches_fresh_light(cm, keys, single), true);
+}
+
+namespace
+{
+	void light_benchmark_world(cube::chunk_map& cm, std::vector<uint64_t>& keys)
+	{
+		for(int z = -128; z != 128; ++z) {
+			for(int x = -128; x != 128; ++x) {
+				const int height = 40 + ((x * 7 + z * 13) & 15);
+				const cube::block_box column = { x, 0, z, 1, height, 1 };
+				cm.fill_box(column, 1);
+			}
+		}
+		for(int n = 0; n != 64; ++n) {
+			cm.set_block((n * 37) % 256 - 128, 30, (n * 91) % 256 - 128, lamp);
+		}
+		for(int cy = 0; cy != 3; ++cy) {
+			for(int cz = -4; cz != 4; ++cz) {
+				for(int cx = -4; cx != 4; ++cx) {
+					keys.push_back(cube::chunk_map::key(cx, cy, cz));
+				}
+			}
+		}
+	}
+}
+
+// Lighting 8x3x8 chunks of terrain from scratch.
+BENCHMARK(light_chunks)
+{
+	cube::chunk_map cm;
+	std::vector<uint64_t> keys;
+	light_benchmark_world(cm, keys);
+	BENCHMARK_LOOP {
+		cube::light_engine e(cm);
+		e.set_emission(lamp, 14);
+		e.add_chunks(keys, threading::get_pool());
+	}
+}
+
+// Placing and removing a block in open air next to a lamp.
+BENCHMARK(light_block_edit)
+{
+	cube::chunk_map cm;
+	std::vector<uint64_t> keys;
+	light_benchmark_world(cm, keys);
+	cube::light_engine e(cm);
+	e.set_emission(lamp, 14);
+	e.add_chunks(keys, threading::get_pool());
+	cm.set_block(0, 70, 0, lamp);
+	e.block_changed(0, 70, 0);
+	cube::block_id b = 1;
+	BENCHMARK_LOOP {
+		cm.set_block(1, 70, 0, b);
+		e.block_changed(1, 70, 0);
+		b = cube::block_id(1 - b);
+	}
+}
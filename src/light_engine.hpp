@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <boost/shared_array.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "chunk.hpp"
+#include "thread_pool.hpp"
+
+namespace cube
+{
+	const int max_light = 15;
+
+	// Block light and sky light for chunks of a chunk_map, both 0 to
+	// max_light. Each block's light is one byte next to the chunk's blocks,
+	// block light in the low nibble and sky light in the high one. Light
+	// spreads through empty blocks, dropping by one per block, except that
+	// full sky light shines straight down undimmed. Solid blocks stop it.
+	//
+	// Light is held only for the chunks added, which needn't be stored in
+	// the chunk_map: a missing chunk is all empty. A chunk with no chunk
+	// added above it is open to the sky. Updates are flood fills from the
+	// changed blocks, taking light out before spreading it back in, so an
+	// edit only touches the blocks whose light it changes.
+	class light_engine
+	{
+	public:
+		explicit light_engine(const chunk_map& cm);
+		virtual ~light_engine();
+
+		// Light given off by blocks of type b. Should be set before any
+		// chunks are added.
+		void set_emission(block_id b, int level);
+		int emission(block_id b) const { return b < emission_.size() ? emission_[b] : 0; }
+
+		bool has_chunk(int cx, int cy, int cz) const { return light_.count(chunk_map::key(cx, cy, cz)) != 0; }
+		// Lights the chunk from its own blocks, the sky and the chunks around
+		// it, spreading its light into them in turn.
+		void add_chunk(int cx, int cy, int cz);
+		// As add_chunk() for every key. Each chunk is lit on its own in
+		// parallel on the pool, then light is spread between them.
+		void add_chunks(const std::vector<uint64_t>& keys, threading::pool& p);
+		// Light which has already spread out of the chunk is left as it is.
+		void remove_chunk(int cx, int cy, int cz);
+		void clear();
+
+		// Call once the blocks in box have been changed in the chunk_map.
+		void blocks_changed(const block_box& box);
+		void block_changed(int x, int y, int z)
+		{
+			const block_box box = { x, y, z, 1, 1, 1 };
+			blocks_changed(box);
+		}
+
+		// 0 outside the chunks added.
+		int block_light(int x, int y, int z) const { return get_light(x, y, z) & 0xf; }
+		int sky_light(int x, int y, int z) const { return get_light(x, y, z) >> 4; }
+
+		size_t num_chunks() const { return light_.size(); }
+		size_t memory_usage() const;
+		// Blocks whose light changed in the last update.
+		size_t last_update_blocks() const { return updated_; }
+	private:
+		enum { BLOCK_CHANNEL, SKY_CHANNEL, NUM_CHANNELS };
+
+		struct light_node
+		{
+			int x, y, z;
+			uint8_t level;
+		};
+
+		// Working space for lighting a chunk on its own.
+		struct local_scratch
+		{
+			std::vector<int> queue;
+			std::vector<uint8_t> solid;
+		};
+
+		// Lights c, which may be null, without looking outside it. Sky light
+		// comes in from the top if sky_open, or where the light of the chunk
+		// above, if given, is full sky light.
+		void light_local(const chunk* c, bool sky_open, const uint8_t* above, uint8_t* light, local_scratch& scratch) const;
+		// Chunks of add_chunks() are lit a column at a time, top down, so
+		// light from the sky doesn't have to go through the map.
+		struct local_batch;
+		void light_columns(local_batch& batch, size_t first, size_t last, local_scratch& scratch) const;
+		static void light_columns_job(const light_engine* e, local_batch* batch, size_t first, size_t last);
+		// Removes sky light the chunk below took from an open sky, now that
+		// the chunk at cx, cy, cz covers it.
+		void cover_sky(int cx, int cy, int cz);
+		// Queues the blocks either side of each face of the chunk with light
+		// to pass across it.
+		void queue_borders(int cx, int cy, int cz, int channel);
+		void remove(int channel);
+		void spread(int channel);
+
+		uint8_t get_light(int x, int y, int z) const;
+		uint8_t* light_at(int x, int y, int z);
+		block_id block_at(int x, int y, int z);
+		bool is_sky_source(int x, int y, int z);
+		// Chunks may be replaced in the chunk_map between updates.
+		void reset_cache();
+
+		const chunk_map& chunks_;
+		std::vector<uint8_t> emission_;
+		bool has_emitters_;
+		boost::unordered_map<uint64_t, boost::shared_array<uint8_t> > light_;
+
+		// Last chunk looked up by light_at() and block_at().
+		uint64_t light_key_;
+		uint8_t* light_chunk_;
+		uint64_t block_key_;
+		const chunk* block_chunk_;
+
+		std::vector<light_node> increase_;
+		std::vector<light_node> removal_;
+		local_scratch local_scratch_;
+		size_t updated_;
+
+		light_engine();
+		light_engine(const light_engine&);
+	};
+}
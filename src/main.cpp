@@ -2,12 +2,15 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <boost/scoped_ptr.hpp>
 
 #include "btinterface.hpp"
+#include "column_map.hpp"
 #include "cubes.hpp"
 #include "filesystem.hpp"
 #include "fonts.hpp"
 #include "geometry.hpp"
+#include "gl_state.hpp"
 #include "json.hpp"
 #include "module.hpp"
 #include "notify.hpp"
@@ -16,6 +19,7 @@
 #include "render.hpp"
 #include "render_text.hpp"
 #include "shaders.hpp"
+#include "terrain_generator.hpp"
 #include "texture.hpp"
 #include "utils.hpp"
 #include "unit_test.hpp"
@@ -146,6 +150,41 @@ int main(int argc, char* argv[])
 
 	module::load_module("test");
 
+	std::string world_dir;
+	bool column_world = false;
+	bool generated_world = false;
+	for(auto it = args.begin(); it != args.end(); ++it) {
+		const std::string benchmark_arg = "--benchmarks";
+		const std::string world_arg = "--world=";
+		const std::string save_world_arg = "--save-world=";
+		if(*it == benchmark_arg) {
+			test::run_benchmarks();
+			return 0;
+		} else if(it->compare(0, benchmark_arg.size() + 1, benchmark_arg + "=") == 0) {
+			std::vector<std::string> benchmarks = utils::split(it->substr(benchmark_arg.size() + 1), ",");
+			test::run_benchmarks(&benchmarks);
+			return 0;
+		} else if(it->compare(0, world_arg.size(), world_arg) == 0) {
+			world_dir = it->substr(world_arg.size());
+		} else if(*it == "--columns") {
+			// Keeps the heightmap world as runs, paging in chunks from them.
+			column_world = true;
+		} else if(*it == "--generate") {
+			// Generates an unbounded world from the terrain settings in
+			// data/world.cfg.
+			generated_world = true;
+		} else if(it->compare(0, save_world_arg.size(), save_world_arg) == 0) {
+			// Converts the heightmap world to region files.
+			std::vector<uint8_t> heights;
+			int width, depth;
+			cube::load_heightmap(module::map_file("images/noise.png"), heights, width, depth);
+			cube::chunk_map cm;
+			cm.build_from_heightmap(heights, width, depth, 1);
+			cube::region_store::save(cm, it->substr(save_world_arg.size()));
+			return 0;
+		}
+	}
+
 	point window_size = point(1024, 768);
 
 	try {
@@ -181,7 +220,37 @@ int main(int argc, char* argv[])
 			"simple_vertex", "data/simple_color.vert", 
 			"simple_fragment", "data/simple_color.frag");
 
-		cube::world cube_world(shader, module::map_file("images/noise.png"));
+		auto chunk_shader = render_obj.create_shader("chunk", 
+			"chunk_vertex", "data/chunk.vert", 
+			"chunk_fragment", "data/chunk.frag");
+
+		cube::chunk_source_ptr store;
+		if(!world_dir.empty()) {
+			store.reset(new cube::region_store(world_dir));
+		} else if(column_world) {
+			std::vector<uint8_t> heights;
+			int width, depth;
+			cube::load_heightmap(module::map_file("images/noise.png"), heights, width, depth);
+			cube::column_map_ptr cols(new cube::column_map(width, depth));
+			cols->build_from_heightmap(heights, 1);
+			store = cols;
+		} else if(generated_world) {
+			const node::node cfg = json::parse_from_file(module::map_file("data/world.cfg"));
+			store.reset(new cube::terrain_generator(cfg.has_key("terrain") ? cube::terrain_params(cfg["terrain"]) : cube::terrain_params()));
+		}
+		graphics::const_texture_ptr block_atlas = graphics::texture::get(module::map_file("images/blocks.png"));
+		boost::scoped_ptr<cube::world> world_ptr(!store
+			? new cube::world(chunk_shader, block_atlas, module::map_file("images/noise.png"))
+			: new cube::world(chunk_shader, block_atlas, store));
+		cube::world& cube_world = *world_ptr;
+		if(!store) {
+			cube_world.build_world();
+		} else {
+			// Paged in worlds may hold more than fits in memory.
+			cube_world.set_stream_radius(8);
+			cube_world.set_memory_budget(256 * 1024 * 1024, 128 * 1024 * 1024);
+		}
+		render_obj.set_occlusion_buffer(&cube_world.occlusion());
 		
 		notify::manager notifications;
 
@@ -200,15 +269,32 @@ int main(int argc, char* argv[])
 			running = process_events(render_obj);
 
 			double frame_processing_time = ptimer.elapsed_time_microseconds();
-			//render_obj.draw();
-			cube_world.draw();
+			graphics::state::reset_stats();
+			const GLfloat seconds = SDL_GetTicks() / 1000.0f;
+			shader::set_global_uniform("u_time", &seconds, 1);
+			cube_world.set_focus(render_obj.camera_position());
+			cube_world.update();
+			cube_world.draw(render_obj);
+			render_obj.draw();
 			double frame_render_time = ptimer.elapsed_time_microseconds() - frame_processing_time;
 
 			std::stringstream ss1, ss2;
-			ss1 << "Frame draw time (uS): " << std::fixed << frame_render_time;
+			ss1 << "Frame draw time (uS): " << std::fixed << frame_render_time
+				<< ", GL calls: " << graphics::state::get_stats().calls << ", dropped: " << graphics::state::get_stats().calls_dropped;
 			graphics::renderer::text::quick_draw(render_obj, -1.0f, -1.0f, ss1.str(), "Tauri-Regular.ttf", 14, graphics::color(1.0f, 1.0f, 0.5f));
 			ss2 << "Frame process time (uS): " << std::fixed << (frame_processing_time+frame_render_time);
 			graphics::renderer::text::quick_draw(render_obj, 0.0f, -1.0f, ss2.str(), "Tauri-Regular.ttf", 14, graphics::color(1.0f, 1.0f, 0.5f));
+			const cube::draw_stats& stats = cube_world.get_draw_stats();
+			std::stringstream ss3;
+			ss3 << "Chunks drawn: " << (stats.culling.chunks_visible - stats.chunks_unreachable - stats.chunks_occluded) << ", culled: " << stats.culling.chunks_culled << ", unreachable: " << stats.chunks_unreachable << ", occluded: " << stats.chunks_occluded << ", occluders: " << stats.occluders_drawn
+				<< ", per level: " << stats.chunks_at_lod[0] << "/" << stats.chunks_at_lod[1] << "/" << stats.chunks_at_lod[2] << "/" << stats.chunks_at_lod[3];
+			graphics::renderer::text::quick_draw(render_obj, -1.0f, -0.95f, ss3.str(), "Tauri-Regular.ttf", 14, graphics::color(1.0f, 1.0f, 0.5f));
+			const cube::stream_stats& sstats = cube_world.get_stream_stats();
+			std::stringstream ss4;
+			ss4 << "Chunks resident: " << sstats.chunks_resident << ", meshed: " << sstats.chunks_meshed << ", queued: " << sstats.chunks_queued
+				<< ", RAM: " << (sstats.ram_bytes >> 10) << "K, VRAM: " << (sstats.vram_bytes >> 10) << "K";
+			graphics::renderer::text::quick_draw(render_obj, -1.0f, -0.9f, ss4.str(), "Tauri-Regular.ttf", 14, graphics::color(1.0f, 1.0f, 0.5f));
+			render_obj.flush_2d();
 			wm.swap();
 
 			Uint32 delay = SDL_GetTicks() - cycle_start_tick;
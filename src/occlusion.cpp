@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "asserts.hpp"
+#include "occlusion.hpp"
+#include "unit_test.hpp"
+
+namespace graphics
+{
+	namespace
+	{
+		// Points with a smaller clip w than this are treated as crossing the
+		// near plane.
+		const float min_w = 1e-4f;
+
+		// Box corners are numbered with bit 0 for max x, bit 1 for max y and
+		// bit 2 for max z. Two triangles per face.
+		const int box_triangles[12][3] = {
+			{ 0, 2, 3 }, { 0, 3, 1 },
+			{ 4, 5, 7 }, { 4, 7, 6 },
+			{ 0, 1, 5 }, { 0, 5, 4 },
+			{ 2, 6, 7 }, { 2, 7, 3 },
+			{ 0, 4, 6 }, { 0, 6, 2 },
+			{ 1, 3, 7 }, { 1, 7, 5 },
+		};
+
+		glm::vec3 box_corner(const aabb& b, int n)
+		{
+			return glm::vec3(n & 1 ? b.max.x : b.min.x, n & 2 ? b.max.y : b.min.y, n & 4 ? b.max.z : b.min.z);
+		}
+	}
+
+	occlusion_buffer::occlusion_buffer(int width, int height)
+		: width_(width), height_(height), mvp_(1.0f), occluders_drawn_(0)
+	{
+		ASSERT_LOG(width > 0 && height > 0 && width % 4 == 0, "occlusion_buffer: bad size " << width << "x" << height);
+		int w = width, h = height;
+		for(;;) {
+			level_width_.push_back(w);
+			level_height_.push_back(h);
+			levels_.push_back(std::vector<float>(w * h, 1.0f));
+			if(w == 1 && h == 1) {
+				break;
+			}
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+	}
+
+	occlusion_buffer::~occlusion_buffer()
+	{
+	}
+
+	void occlusion_buffer::clear(const glm::mat4& mvp)
+	{
+		mvp_ = mvp;
+		occluders_drawn_ = 0;
+		std::fill(levels_[0].begin(), levels_[0].end(), 1.0f);
+	}
+
+	bool occlusion_buffer::project(const glm::vec3& p, screen_vertex& out) const
+	{
+		const glm::vec4 clip = mvp_ * glm::vec4(p, 1.0f);
+		if(clip.w < min_w) {
+			return false;
+		}
+		out.x = (clip.x / clip.w * 0.5f + 0.5f) * width_;
+		out.y = (clip.y / clip.w * 0.5f + 0.5f) * height_;
+		out.z = clip.z / clip.w * 0.5f + 0.5f;
+		return true;
+	}
+
+	void occlusion_buffer::add_occluder(const aabb& b)
+	{
+		if(b.empty()) {
+			return;
+		}
+		screen_vertex v[8];
+		for(int n = 0; n != 8; ++n) {
+			if(!project(box_corner(b, n), v[n])) {
+				return;
+			}
+		}
+		// Back faces are drawn too; they are behind the front faces so never
+		// win the depth test, and it saves working out which are which.
+		for(int n = 0; n != 12; ++n) {
+			draw_triangle(v[box_triangles[n][0]], v[box_triangles[n][1]], v[box_triangles[n][2]]);
+		}
+		++occluders_drawn_;
+	}
+
+	void occlusion_buffer::draw_triangle(const screen_vertex& a, const screen_vertex& b_in, const screen_vertex& c_in)
+	{
+		// Edge function w = A*x + B*y + C for each edge, positive inside.
+		float area = (b_in.x - a.x) * (c_in.y - a.y) - (b_in.y - a.y) * (c_in.x - a.x);
+		if(std::fabs(area) < 1e-6f) {
+			return;
+		}
+		const screen_vertex& b = area > 0 ? b_in : c_in;
+		const screen_vertex& c = area > 0 ? c_in : b_in;
+		area = std::fabs(area);
+
+		const int min_x = std::max(0, int(std::floor(std::min(a.x, std::min(b.x, c.x)))));
+		const int max_x = std::min(width_ - 1, int(std::ceil(std::max(a.x, std::max(b.x, c.x)))));
+		const int min_y = std::max(0, int(std::floor(std::min(a.y, std::min(b.y, c.y)))));
+		const int max_y = std::min(height_ - 1, int(std::ceil(std::max(a.y, std::max(b.y, c.y)))));
+		if(min_x > max_x || min_y > max_y) {
+			return;
+		}
+
+		const screen_vertex* vtx[3] = { &a, &b, &c };
+		float ea[3], eb[3], ec[3];
+		for(int n = 0; n != 3; ++n) {
+			const screen_vertex& p = *vtx[(n + 1) % 3];
+			const screen_vertex& q = *vtx[(n + 2) % 3];
+			ea[n] = p.y - q.y;
+			eb[n] = q.x - p.x;
+			ec[n] = p.x * q.y - p.y * q.x;
+		}
+		// Depth is linear in screen space: z = za*x + zb*y + zc.
+		const float za = (ea[0] * a.z + ea[1] * b.z + ea[2] * c.z) / area;
+		const float zb = (eb[0] * a.z + eb[1] * b.z + eb[2] * c.z) / area;
+		const float zc = (ec[0] * a.z + ec[1] * b.z + ec[2] * c.z) / area;
+
+		std::vector<float>& depth = levels_[0];
+#if defined(OCCLUSION_USE_SSE2)
+		// Four pixels at a time. The row is a multiple of 4 wide, so the
+		// aligned down start and the extra pixels at the end stay in bounds;
+		// the edge tests mask off anything outside the triangle.
+		const int start_x = min_x & ~3;
+		const __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		const __m128 ea0 = _mm_set1_ps(ea[0]), ea1 = _mm_set1_ps(ea[1]), ea2 = _mm_set1_ps(ea[2]);
+		const __m128 zav = _mm_set1_ps(za);
+		const __m128 zero = _mm_setzero_ps();
+		for(int y = min_y; y <= max_y; ++y) {
+			const float py = y + 0.5f;
+			const __m128 row0 = _mm_set1_ps(eb[0] * py + ec[0]);
+			const __m128 row1 = _mm_set1_ps(eb[1] * py + ec[1]);
+			const __m128 row2 = _mm_set1_ps(eb[2] * py + ec[2]);
+			const __m128 rowz = _mm_set1_ps(zb * py + zc);
+			float* dst = &depth[y * width_];
+			for(int x = start_x; x <= max_x; x += 4) {
+				const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), step);
+				const __m128 w0 = _mm_add_ps(_mm_mul_ps(ea0, px), row0);
+				const __m128 w1 = _mm_add_ps(_mm_mul_ps(ea1, px), row1);
+				const __m128 w2 = _mm_add_ps(_mm_mul_ps(ea2, px), row2);
+				const __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+				if(_mm_movemask_ps(inside) == 0) {
+					continue;
+				}
+				const __m128 z = _mm_add_ps(_mm_mul_ps(zav, px), rowz);
+				const __m128 old_z = _mm_loadu_ps(dst + x);
+				const __m128 new_z = _mm_min_ps(old_z, z);
+				_mm_storeu_ps(dst + x, _mm_or_ps(_mm_and_ps(inside, new_z), _mm_andnot_ps(inside, old_z)));
+			}
+		}
+#else
+		for(int y = min_y; y <= max_y; ++y) {
+			const float py = y + 0.5f;
+			float* dst = &depth[y * width_];
+			for(int x = min_x; x <= max_x; ++x) {
+				const float px = x + 0.5f;
+				if(ea[0] * px + eb[0] * py + ec[0] < 0.0f
+					|| ea[1] * px + eb[1] * py + ec[1] < 0.0f
+					|| ea[2] * px + eb[2] * py + ec[2] < 0.0f) {
+					continue;
+				}
+				dst[x] = std::min(dst[x], za * px + zb * py + zc);
+			}
+		}
+#endif
+	}
+
+	void occlusion_buffer::build_pyramid()
+	{
+		for(size_t level = 1; level < levels_.size(); ++level) {
+			const std::vector<float>& src = levels_[level - 1];
+			const int sw = level_width_[level - 1], sh = level_height_[level - 1];
+			std::vector<float>& dst = levels_[level];
+			const int w = level_width_[level], h = level_height_[level];
+			for(int y = 0; y != h; ++y) {
+				const int y0 = y * 2, y1 = std::min(y * 2 + 1, sh - 1);
+				for(int x = 0; x != w; ++x) {
+					const int x0 = x * 2, x1 = std::min(x * 2 + 1, sw - 1);
+					dst[y * w + x] = std::max(std::max(src[y0 * sw + x0], src[y0 * sw + x1]),
+						std::max(src[y1 * sw + x0], src[y1 * sw + x1]));
+				}
+			}
+		}
+	}
+
+	bool occlusion_buffer::is_visible(const aabb& b) const
+	{
+		if(b.empty()) {
+			return false;
+		}
+		float min_x = float(width_), max_x = 0.0f, min_y = float(height_), max_y = 0.0f, min_z = 1.0f;
+		for(int n = 0; n != 8; ++n) {
+			screen_vertex v;
+			if(!project(box_corner(b, n), v)) {
+				return true;
+			}
+			min_x = std::min(min_x, v.x);
+			max_x = std::max(max_x, v.x);
+			min_y = std::min(min_y, v.y);
+			max_y = std::max(max_y, v.y);
+			min_z = std::min(min_z, v.z);
+		}
+		if(max_x < 0.0f || max_y < 0.0f || min_x >= width_ || min_y >= height_) {
+			// Off screen, which the frustum test ought to have caught.
+			return false;
+		}
+		const int x0 = std::max(0, int(min_x)), x1 = std::min(width_ - 1, int(max_x));
+		const int y0 = std::max(0, int(min_y)), y1 = std::min(height_ - 1, int(max_y));
+
+		// Pick the level where the bounds cover at most about 4x4 texels.
+		size_t level = 0;
+		while(level + 1 < levels_.size() && std::max(x1 - x0, y1 - y0) >> level > 3) {
+			++level;
+		}
+		const std::vector<float>& depth = levels_[level];
+		const int w = level_width_[level];
+		for(int y = y0 >> level; y <= y1 >> level; ++y) {
+			for(int x = x0 >> level; x <= x1 >> level; ++x) {
+				if(min_z <= depth[y * w + x]) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+}
+
+UNIT_TEST(occlusion_buffer)
+{
+	// Perspective projection looking down -z, near plane 1, far plane 100.
+	const float n = 1.0f, f = 100.0f;
+	glm::mat4 proj(0.0f);
+	proj[0][0] = 1.0f;
+	proj[1][1] = 1.0f;
+	proj[2][2] = -(f + n) / (f - n);
+	proj[2][3] = -1.0f;
+	proj[3][2] = -2.0f * f * n / (f - n);
+
+	graphics::occlusion_buffer ob(64, 64);
+	ob.clear(proj);
+	CHECK_EQ(ob.is_visible(graphics::aabb(glm::vec3(-0.5f, -0.5f, -11.0f), glm::vec3(0.5f, 0.5f, -10.0f))), true);
+
+	// A wall filling the middle of the view at z = -5.
+	ob.add_occluder(graphics::aabb(glm::vec3(-2.0f, -2.0f, -6.0f), glm::vec3(2.0f, 2.0f, -5.0f)));
+	CHECK_EQ(ob.occluders_drawn(), 1);
+	ob.build_pyramid();
+	CHECK_LT(ob.depth(32, 32), 1.0f);
+	CHECK_EQ(ob.depth(1, 1), 1.0f);
+
+	// Behind the wall.
+	CHECK_EQ(ob.is_visible(graphics::aabb(glm::vec3(-0.5f, -0.5f, -11.0f), glm::vec3(0.5f, 0.5f, -10.0f))), false);
+	// Behind, but off to the side where the wall doesn't reach.
+	CHECK_EQ(ob.is_visible(graphics::aabb(glm::vec3(5.0f, -0.5f, -11.0f), glm::vec3(6.0f, 0.5f, -10.0f))), true);
+	// In front of the wall.
+	CHECK_EQ(ob.is_visible(graphics::aabb(glm::vec3(-0.5f, -0.5f, -3.0f), glm::vec3(0.5f, 0.5f, -2.0f))), true);
+	// Crossing the near plane.
+	CHECK_EQ(ob.is_visible(graphics::aabb(glm::vec3(-0.5f, -0.5f, -20.0f), glm::vec3(0.5f, 0.5f, 1.0f))), true);
+
+	// Occluders crossing the near plane are skipped.
+	ob.add_occluder(graphics::aabb(glm::vec3(-2.0f, -2.0f, -6.0f), glm::vec3(2.0f, 2.0f, 2.0f)));
+	CHECK_EQ(ob.occluders_drawn(), 1);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+namespace graphics
+{
+	// Low resolution depth buffer rendered on the CPU, for occlusion culling
+	// without relying on the GPU. Boxes known to be solid are rasterised into
+	// it as occluders, then a depth pyramid holding the farthest depth under
+	// each texel lets bounds be tested against just a few texels.
+	//
+	// Per frame: clear(), add_occluder() for the nearest large occluders,
+	// build_pyramid(), then is_visible() for anything to be drawn.
+	class occlusion_buffer
+	{
+	public:
+		// width must be a multiple of 4.
+		occlusion_buffer(int width, int height);
+		virtual ~occlusion_buffer();
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+
+		// mvp transforms occluders and tested bounds into clip space.
+		void clear(const glm::mat4& mvp);
+		// Boxes crossing the near plane are skipped, which is conservative.
+		void add_occluder(const aabb& b);
+		void build_pyramid();
+		bool is_visible(const aabb& b) const;
+
+		// Depth in [0, 1] at the given texel of the full resolution buffer.
+		float depth(int x, int y) const { return levels_[0][y * width_ + x]; }
+		size_t occluders_drawn() const { return occluders_drawn_; }
+	private:
+		struct screen_vertex
+		{
+			float x, y, z;
+		};
+		// Returns false if the point is too close to, or behind, the eye.
+		bool project(const glm::vec3& p, screen_vertex& out) const;
+		void draw_triangle(const screen_vertex& a, const screen_vertex& b, const screen_vertex& c);
+
+		int width_;
+		int height_;
+		glm::mat4 mvp_;
+		size_t occluders_drawn_;
+
+		// Level 0 is the full resolution buffer, each following level halves
+		// both dimensions, rounding up.
+		std::vector<std::vector<float> > levels_;
+		std::vector<int> level_width_;
+		std::vector<int> level_height_;
+
+		occlusion_buffer();
+		occlusion_buffer(const occlusion_buffer&);
+	};
+}
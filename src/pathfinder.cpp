@@ -0,0 +1,894 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <queue>
+#include <boost/bind.hpp>
+
+#include "asserts.hpp"
+#include "pathfinder.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		const uint16_t no_path = 0xffff;
+		// Never a valid key, which only uses 63 bits.
+		const uint64_t no_key = ~uint64_t(0);
+
+		// Steps in each direction along x or z, each climbing, staying level
+		// or dropping: step m goes along step_dx[m / 3], step_dz[m / 3] and
+		// m % 3 - 1 up.
+		const int step_dx[4] = { 0, 1, 0, -1 };
+		const int step_dz[4] = { 1, 0, -1, 0 };
+		const int num_steps = 12;
+
+		// Runs of steps across a border longer than this give several
+		// entrances, so paths needn't detour through the middle of a wide
+		// opening.
+		const size_t max_entrance_width = 8;
+
+		// Paths found by each job of find_paths() is at least this many.
+		const size_t min_paths_per_job = 8;
+
+		// Reads blocks straight from the chunks already in a chunk_map,
+		// remembering the last chunk looked at.
+		class block_reader
+		{
+		public:
+			explicit block_reader(const chunk_map& cm) : cm_(cm), key_(no_key), chunk_(NULL) {}
+
+			bool is_solid(int x, int y, int z)
+			{
+				const int cx = chunk_map::to_chunk(x), cy = chunk_map::to_chunk(y), cz = chunk_map::to_chunk(z);
+				const uint64_t k = chunk_map::key(cx, cy, cz);
+				if(k != key_) {
+					key_ = k;
+					chunk_ = cm_.resident_chunk(cx, cy, cz);
+				}
+				return chunk_ != NULL && chunk_->get(chunk_map::to_local(x), chunk_map::to_local(y), chunk_map::to_local(z)) != empty_block;
+			}
+			bool can_stand(int x, int y, int z)
+			{
+				return !is_solid(x, y, z) && !is_solid(x, y + 1, z) && is_solid(x, y - 1, z);
+			}
+			// Bit m is set for each step m possible from p, which should be
+			// somewhere an agent can stand. Each column stepped to is read
+			// once for all three heights.
+			unsigned steps_from(const path_point& p)
+			{
+				const bool headroom = !is_solid(p.x, p.y + 2, p.z);
+				unsigned mask = 0;
+				for(int d = 0; d != 4; ++d) {
+					const int x = p.x + step_dx[d], z = p.z + step_dz[d];
+					const bool below2 = is_solid(x, p.y - 2, z), below = is_solid(x, p.y - 1, z);
+					const bool level = is_solid(x, p.y, z), above = is_solid(x, p.y + 1, z);
+					if(above) {
+						continue;
+					}
+					// Dropping needs headroom above where the step ends,
+					// climbing above where it starts.
+					if(below2 && !below && !level) {
+						mask |= 1 << (d * 3);
+					}
+					if(below && !level) {
+						mask |= 1 << (d * 3 + 1);
+					}
+					if(level && headroom && !is_solid(x, p.y + 2, z)) {
+						mask |= 1 << (d * 3 + 2);
+					}
+				}
+				return mask;
+			}
+		private:
+			const chunk_map& cm_;
+			uint64_t key_;
+			const chunk* chunk_;
+		};
+
+		path_point step_to(const path_point& p, int m)
+		{
+			const path_point to = { p.x + step_dx[m / 3], p.y + m % 3 - 1, p.z + step_dz[m / 3] };
+			return to;
+		}
+
+		uint64_t point_key(const path_point& p) { return chunk_map::key(p.x, p.y, p.z); }
+		path_point key_point(uint64_t k)
+		{
+			path_point p;
+			chunk_map::from_key(k, p.x, p.y, p.z);
+			return p;
+		}
+		uint64_t chunk_key(const path_point& p)
+		{
+			return chunk_map::key(chunk_map::to_chunk(p.x), chunk_map::to_chunk(p.y), chunk_map::to_chunk(p.z));
+		}
+		int local_index(const path_point& p)
+		{
+			return chunk::index(chunk_map::to_local(p.x), chunk_map::to_local(p.y), chunk_map::to_local(p.z));
+		}
+		path_point cluster_point(uint64_t chunk, int n)
+		{
+			path_point p;
+			chunk_map::from_key(chunk, p.x, p.y, p.z);
+			p.x = p.x * chunk_size + (n & chunk_mask);
+			p.y = p.y * chunk_size + (n >> (2*chunk_shift));
+			p.z = p.z * chunk_size + ((n >> chunk_shift) & chunk_mask);
+			return p;
+		}
+
+		// Never more than the steps needed, since each step moves one block
+		// along x or z and at most one along y.
+		unsigned estimate(const path_point& a, const path_point& b)
+		{
+			return unsigned(std::max(std::abs(a.x - b.x) + std::abs(a.z - b.z), std::abs(a.y - b.y)));
+		}
+
+		bool touching(uint64_t a, uint64_t b)
+		{
+			const path_point p = key_point(a), q = key_point(b);
+			return std::abs(p.x - q.x) <= 1 && std::abs(p.y - q.y) <= 1 && std::abs(p.z - q.z) <= 1;
+		}
+
+		int find_root(std::vector<size_t>& parent, size_t n)
+		{
+			while(parent[n] != n) {
+				n = parent[n] = parent[parent[n]];
+			}
+			return int(n);
+		}
+
+		// Open nodes are ordered by estimated length, then the furthest along
+		// first, which saves exploring every equally good route across open
+		// ground.
+		unsigned open_order(unsigned steps, unsigned estimated) { return ((steps + estimated) << 16) | (0xffff - steps); }
+		uint64_t graph_order(unsigned steps, unsigned estimated) { return (uint64_t(steps + estimated) << 32) | (0xffffffff - steps); }
+
+		typedef std::pair<unsigned, int> local_entry;
+		typedef std::pair<uint64_t, uint64_t> graph_entry;
+	}
+
+	struct pathfinder::search_scratch
+	{
+		explicit search_scratch(const chunk_map& cm) : reader(cm), steps(chunk_volume, no_path), parent(chunk_volume) {}
+
+		// Only the blocks a search reached are put back afterwards.
+		void reset_steps(const std::vector<int>& reached)
+		{
+			for(auto it = reached.begin(); it != reached.end(); ++it) {
+				steps[*it] = no_path;
+			}
+		}
+
+		block_reader reader;
+		std::vector<uint16_t> steps;
+		std::vector<uint16_t> parent;
+		std::vector<local_entry> open;
+		std::vector<int> queue;
+		std::vector<path_point> reversed;
+	};
+
+	struct pathfinder::job_batch
+	{
+		boost::mutex guard;
+		boost::condition_variable done;
+		int remaining;
+	};
+
+	pathfinder::pathfinder(const chunk_map& cm)
+		: chunks_(cm)
+	{
+	}
+
+	pathfinder::~pathfinder()
+	{
+	}
+
+	void pathfinder::add_chunk(int cx, int cy, int cz)
+	{
+		if(has_chunk(cx, cy, cz)) {
+			return;
+		}
+		clusters_[chunk_map::key(cx, cy, cz)];
+		mark_dirty(cx, cy, cz, 1, 1);
+	}
+
+	void pathfinder::remove_chunk(int cx, int cy, int cz)
+	{
+		const uint64_t key = chunk_map::key(cx, cy, cz);
+		if(clusters_.erase(key) != 0) {
+			mark_dirty(cx, cy, cz, 1, 1);
+			dirty_.erase(key);
+		}
+	}
+
+	void pathfinder::clear()
+	{
+		clusters_.clear();
+		dirty_.clear();
+	}
+
+	void pathfinder::blocks_changed(const block_box& box)
+	{
+		// Whether an agent can stand on a block depends on the block below
+		// and the two above, so the chunks above and below have their steps
+		// across borders changed too.
+		for(int cy = chunk_map::to_chunk(box.y); cy <= chunk_map::to_chunk(box.y + box.sy - 1); ++cy) {
+			for(int cz = chunk_map::to_chunk(box.z); cz <= chunk_map::to_chunk(box.z + box.sz - 1); ++cz) {
+				for(int cx = chunk_map::to_chunk(box.x); cx <= chunk_map::to_chunk(box.x + box.sx - 1); ++cx) {
+					mark_dirty(cx, cy, cz, 2, 2);
+				}
+			}
+		}
+	}
+
+	void pathfinder::mark_dirty(int cx, int cy, int cz, int below, int above)
+	{
+		for(int y = cy - below; y <= cy + above; ++y) {
+			for(int z = cz - 1; z <= cz + 1; ++z) {
+				for(int x = cx - 1; x <= cx + 1; ++x) {
+					const uint64_t key = chunk_map::key(x, y, z);
+					if(clusters_.count(key) != 0) {
+						dirty_.insert(key);
+					}
+				}
+			}
+		}
+	}
+
+	void pathfinder::update(threading::pool& p)
+	{
+		if(dirty_.empty()) {
+			return;
+		}
+		const std::vector<uint64_t> keys(dirty_.begin(), dirty_.end());
+		std::vector<cluster> built(keys.size());
+
+		// Clusters only read the chunk_map and which clusters exist, so are
+		// built side by side. The calling thread builds the first part.
+		const size_t parts = std::min(size_t(p.num_threads() + 1), keys.size());
+		const size_t per_part = (keys.size() + parts - 1) / parts;
+		job_batch batch;
+		batch.remaining = int(parts - 1);
+		for(size_t n = 1; n != parts; ++n) {
+			p.add_job(boost::bind(build_job, this, &keys, &built, n * per_part, std::min(keys.size(), (n + 1) * per_part), &batch));
+		}
+		for(size_t n = 0; n != std::min(keys.size(), per_part); ++n) {
+			build_cluster(keys[n], built[n]);
+		}
+		{
+			boost::mutex::scoped_lock lock(batch.guard);
+			while(batch.remaining != 0) {
+				batch.done.wait(lock);
+			}
+		}
+
+		for(size_t n = 0; n != keys.size(); ++n) {
+			clusters_[keys[n]].cells.swap(built[n].cells);
+			clusters_[keys[n]].links.swap(built[n].links);
+			clusters_[keys[n]].distances.swap(built[n].distances);
+		}
+		dirty_.clear();
+	}
+
+	void pathfinder::build_job(const pathfinder* pf, const std::vector<uint64_t>* keys, std::vector<cluster>* built, size_t first, size_t last, job_batch* batch)
+	{
+		for(size_t n = first; n != last; ++n) {
+			pf->build_cluster((*keys)[n], (*built)[n]);
+		}
+		boost::mutex::scoped_lock lock(batch->guard);
+		if(--batch->remaining == 0) {
+			batch->done.notify_one();
+		}
+	}
+
+	void pathfinder::build_cluster(uint64_t key, cluster& out) const
+	{
+		int cx, cy, cz;
+		chunk_map::from_key(key, cx, cy, cz);
+		block_reader reader(chunks_);
+
+		// Steps which stay inside the chunk, as a mask per block, and those
+		// which cross into each neighbouring cluster.
+		std::vector<uint16_t> steps(chunk_volume, 0);
+		typedef std::pair<uint64_t, uint64_t> crossing;
+		std::map<uint64_t, std::vector<crossing> > crossings;
+		for(int n = 0; n != chunk_volume; ++n) {
+			const path_point p = cluster_point(key, n);
+			if(!reader.can_stand(p.x, p.y, p.z)) {
+				continue;
+			}
+			const unsigned mask = reader.steps_from(p);
+			for(int m = 0; m != num_steps; ++m) {
+				if((mask & (1 << m)) == 0) {
+					continue;
+				}
+				const path_point to = step_to(p, m);
+				const uint64_t to_chunk = chunk_key(to);
+				if(to_chunk == key) {
+					steps[n] |= uint16_t(1 << m);
+				} else if(clusters_.count(to_chunk) != 0) {
+					crossings[to_chunk].push_back(std::make_pair(point_key(p), point_key(to)));
+				}
+			}
+		}
+
+		// Both clusters either side of a border must pick the same entrances,
+		// so the steps across it are ordered and grouped as seen from the
+		// cluster with the lower key.
+		std::map<int, std::vector<uint64_t> > nodes;
+		for(auto it = crossings.begin(); it != crossings.end(); ++it) {
+			const bool lower = key < it->first;
+			std::vector<crossing>& c = it->second;
+			if(!lower) {
+				for(auto s = c.begin(); s != c.end(); ++s) {
+					std::swap(s->first, s->second);
+				}
+			}
+			std::sort(c.begin(), c.end());
+
+			// Steps whose blocks touch on both sides are one entrance.
+			std::vector<size_t> parent(c.size());
+			for(size_t i = 0; i != c.size(); ++i) {
+				parent[i] = i;
+			}
+			for(size_t i = 0; i != c.size(); ++i) {
+				for(size_t j = i + 1; j != c.size(); ++j) {
+					if(touching(c[i].first, c[j].first) && touching(c[i].second, c[j].second)) {
+						parent[find_root(parent, j)] = find_root(parent, i);
+					}
+				}
+			}
+			std::map<int, std::vector<size_t> > entrances;
+			for(size_t i = 0; i != c.size(); ++i) {
+				entrances[find_root(parent, i)].push_back(i);
+			}
+
+			for(auto e = entrances.begin(); e != entrances.end(); ++e) {
+				const std::vector<size_t>& steps_in = e->second;
+				for(size_t first = 0; first < steps_in.size(); first += max_entrance_width) {
+					const size_t last = std::min(steps_in.size(), first + max_entrance_width);
+					const crossing& middle = c[steps_in[(first + last) / 2]];
+					const uint64_t inside = lower ? middle.first : middle.second;
+					const uint64_t outside = lower ? middle.second : middle.first;
+					nodes[local_index(key_point(inside))].push_back(outside);
+				}
+			}
+		}
+
+		out.cells.clear();
+		out.links.clear();
+		for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+			out.cells.push_back(it->first);
+			out.links.push_back(it->second);
+		}
+
+		// Distances between the nodes, a breadth first search from each.
+		const size_t count = out.cells.size();
+		out.distances.assign(count * count, no_path);
+		std::vector<int> node_at(chunk_volume, -1);
+		for(size_t i = 0; i != count; ++i) {
+			node_at[out.cells[i]] = int(i);
+		}
+		std::vector<uint16_t> dist(chunk_volume);
+		std::vector<int> queue;
+		for(size_t i = 0; i != count; ++i) {
+			std::fill(dist.begin(), dist.end(), no_path);
+			queue.clear();
+			queue.push_back(out.cells[i]);
+			dist[out.cells[i]] = 0;
+			size_t found = 0;
+			for(size_t head = 0; head != queue.size() && found != count; ++head) {
+				const int n = queue[head];
+				if(node_at[n] >= 0) {
+					out.distances[i * count + node_at[n]] = dist[n];
+					++found;
+				}
+				const int x = n & chunk_mask, y = n >> (2*chunk_shift), z = (n >> chunk_shift) & chunk_mask;
+				for(int m = 0; m != num_steps; ++m) {
+					if((steps[n] & (1 << m)) == 0) {
+						continue;
+					}
+					const int to = chunk::index(x + step_dx[m / 3], y + m % 3 - 1, z + step_dz[m / 3]);
+					if(dist[to] == no_path) {
+						dist[to] = uint16_t(dist[n] + 1);
+						queue.push_back(to);
+					}
+				}
+			}
+		}
+	}
+
+	bool pathfinder::can_stand(int x, int y, int z) const
+	{
+		block_reader reader(chunks_);
+		return reader.can_stand(x, y, z);
+	}
+
+	bool pathfinder::find_path(const path_point& from, const path_point& to, std::vector<path_point>& path) const
+	{
+		path.clear();
+		search_scratch s(chunks_);
+		// Within one chunk the path usually stays inside it.
+		if(chunk_key(from) == chunk_key(to) && clusters_.count(chunk_key(from)) != 0
+			&& s.reader.can_stand(from.x, from.y, from.z) && s.reader.can_stand(to.x, to.y, to.z)) {
+			path.push_back(from);
+			if(from == to || local_path(from, to, s, path)) {
+				return true;
+			}
+			path.clear();
+		}
+
+		// Otherwise each leg of the route is refined, either a step across
+		// a border or a path within one chunk.
+		std::vector<path_point> waypoints;
+		if(!route(from, to, s, waypoints)) {
+			return false;
+		}
+		path.push_back(from);
+		for(size_t n = 1; n < waypoints.size(); ++n) {
+			const path_point& prev = waypoints[n - 1];
+			const path_point& next = waypoints[n];
+			if(chunk_key(prev) != chunk_key(next)) {
+				path.push_back(next);
+			} else if(prev != next && !local_path(prev, next, s, path)) {
+				path.clear();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool pathfinder::find_route(const path_point& from, const path_point& to, std::vector<path_point>& waypoints) const
+	{
+		search_scratch s(chunks_);
+		return route(from, to, s, waypoints);
+	}
+
+	bool pathfinder::route(const path_point& from, const path_point& to, search_scratch& s, std::vector<path_point>& waypoints) const
+	{
+		waypoints.clear();
+		if(!s.reader.can_stand(from.x, from.y, from.z) || !s.reader.can_stand(to.x, to.y, to.z)) {
+			return false;
+		}
+		const uint64_t start_chunk = chunk_key(from), goal_chunk = chunk_key(to);
+		auto start_it = clusters_.find(start_chunk), goal_it = clusters_.find(goal_chunk);
+		if(start_it == clusters_.end() || goal_it == clusters_.end()) {
+			return false;
+		}
+		waypoints.push_back(from);
+		if(from == to) {
+			return true;
+		}
+
+		std::vector<uint16_t> start_steps, goal_steps;
+		uint16_t direct = no_path, unused;
+		node_distances(from, start_it->second, to, s, start_steps, direct);
+		node_distances(to, goal_it->second, from, s, goal_steps, unused);
+
+		// A* over the entrance nodes, keyed by position, with from and to as
+		// two extra nodes.
+		const uint64_t start_key = no_key, goal_key = no_key - 1;
+		struct visit
+		{
+			unsigned steps;
+			uint64_t parent;
+			bool closed;
+		};
+		boost::unordered_map<uint64_t, visit> visits;
+		std::priority_queue<graph_entry, std::vector<graph_entry>, std::greater<graph_entry> > open;
+		auto relax = [&](uint64_t k, unsigned steps, uint64_t parent) {
+			auto it = visits.find(k);
+			if(it != visits.end() && it->second.steps <= steps) {
+				return;
+			}
+			const visit v = { steps, parent, false };
+			visits[k] = v;
+			open.push(graph_entry(graph_order(steps, k == goal_key ? 0 : estimate(key_point(k), to)), k));
+		};
+		const cluster& start_cluster = start_it->second;
+		for(size_t i = 0; i != start_cluster.cells.size(); ++i) {
+			if(start_steps[i] != no_path) {
+				relax(point_key(cluster_point(start_chunk, start_cluster.cells[i])), start_steps[i], start_key);
+			}
+		}
+		if(direct != no_path) {
+			relax(goal_key, direct, start_key);
+		}
+
+		bool found = false;
+		while(!open.empty()) {
+			const uint64_t k = open.top().second;
+			open.pop();
+			visit& v = visits[k];
+			if(v.closed) {
+				continue;
+			}
+			v.closed = true;
+			if(k == goal_key) {
+				found = true;
+				break;
+			}
+			const unsigned steps = v.steps;
+			const path_point p = key_point(k);
+			const uint64_t c = chunk_key(p);
+			auto cit = clusters_.find(c);
+			if(cit == clusters_.end()) {
+				continue;
+			}
+			const cluster& cl = cit->second;
+			auto node = std::lower_bound(cl.cells.begin(), cl.cells.end(), local_index(p));
+			if(node == cl.cells.end() || *node != local_index(p)) {
+				continue;
+			}
+			const size_t i = node - cl.cells.begin(), count = cl.cells.size();
+			if(c == goal_chunk && goal_steps[i] != no_path) {
+				relax(goal_key, steps + goal_steps[i], k);
+			}
+			for(size_t j = 0; j != count; ++j) {
+				const uint16_t d = cl.distances[i * count + j];
+				if(d != no_path && j != i) {
+					relax(point_key(cluster_point(c, cl.cells[j])), steps + d, k);
+				}
+			}
+			for(auto link = cl.links[i].begin(); link != cl.links[i].end(); ++link) {
+				relax(*link, steps + 1, k);
+			}
+		}
+		if(!found) {
+			waypoints.clear();
+			return false;
+		}
+
+		const size_t first = waypoints.size();
+		for(uint64_t k = visits[goal_key].parent; k != start_key; k = visits[k].parent) {
+			waypoints.push_back(key_point(k));
+		}
+		std::reverse(waypoints.begin() + first, waypoints.end());
+		waypoints.push_back(to);
+		return true;
+	}
+
+	bool pathfinder::local_path(const path_point& from, const path_point& to, search_scratch& s, std::vector<path_point>& path) const
+	{
+		const uint64_t c = chunk_key(from);
+		s.open.clear();
+		s.queue.clear();
+		const int start = local_index(from), goal = local_index(to);
+		s.steps[start] = 0;
+		s.queue.push_back(start);
+		s.open.push_back(local_entry(open_order(0, estimate(from, to)), start));
+		while(!s.open.empty()) {
+			std::pop_heap(s.open.begin(), s.open.end(), std::greater<local_entry>());
+			const local_entry e = s.open.back();
+			s.open.pop_back();
+			const int n = e.second;
+			if(n == goal) {
+				break;
+			}
+			const path_point p = cluster_point(c, n);
+			if(e.first != open_order(s.steps[n], estimate(p, to))) {
+				continue;
+			}
+			const unsigned mask = s.reader.steps_from(p);
+			for(int m = 0; m != num_steps; ++m) {
+				if((mask & (1 << m)) == 0) {
+					continue;
+				}
+				const path_point q = step_to(p, m);
+				if(chunk_key(q) != c) {
+					continue;
+				}
+				const int next = local_index(q);
+				if(s.steps[n] + 1 < s.steps[next]) {
+					if(s.steps[next] == no_path) {
+						s.queue.push_back(next);
+					}
+					s.steps[next] = uint16_t(s.steps[n] + 1);
+					s.parent[next] = uint16_t(n);
+					s.open.push_back(local_entry(open_order(s.steps[next], estimate(q, to)), next));
+					std::push_heap(s.open.begin(), s.open.end(), std::greater<local_entry>());
+				}
+			}
+		}
+		const bool found = s.steps[goal] != no_path;
+		s.reset_steps(s.queue);
+		if(!found) {
+			return false;
+		}
+
+		s.reversed.clear();
+		for(int n = goal; n != start; n = s.parent[n]) {
+			s.reversed.push_back(cluster_point(c, n));
+		}
+		path.insert(path.end(), s.reversed.rbegin(), s.reversed.rend());
+		return true;
+	}
+
+	void pathfinder::node_distances(const path_point& p, const cluster& cl, const path_point& target, search_scratch& s,
+		std::vector<uint16_t>& out, uint16_t& target_steps) const
+	{
+		out.assign(cl.cells.size(), no_path);
+		target_steps = no_path;
+		const uint64_t c = chunk_key(p);
+		const int target_index = chunk_key(target) == c ? local_index(target) : -1;
+		s.queue.clear();
+		s.queue.push_back(local_index(p));
+		s.steps[local_index(p)] = 0;
+		size_t found = 0;
+		const size_t wanted = cl.cells.size() + (target_index >= 0 ? 1 : 0);
+		for(size_t head = 0; head != s.queue.size() && found != wanted; ++head) {
+			const int n = s.queue[head];
+			auto node = std::lower_bound(cl.cells.begin(), cl.cells.end(), n);
+			if(node != cl.cells.end() && *node == n) {
+				out[node - cl.cells.begin()] = s.steps[n];
+				++found;
+			}
+			if(n == target_index) {
+				target_steps = s.steps[n];
+				++found;
+			}
+			const path_point from = cluster_point(c, n);
+			const unsigned mask = s.reader.steps_from(from);
+			for(int m = 0; m != num_steps; ++m) {
+				if((mask & (1 << m)) == 0) {
+					continue;
+				}
+				const path_point q = step_to(from, m);
+				if(chunk_key(q) != c) {
+					continue;
+				}
+				const int next = local_index(q);
+				if(s.steps[next] == no_path) {
+					s.steps[next] = uint16_t(s.steps[n] + 1);
+					s.queue.push_back(next);
+				}
+			}
+		}
+		s.reset_steps(s.queue);
+	}
+
+	void pathfinder::find_paths(const std::vector<path_request>& requests, std::vector<std::vector<path_point> >& paths, threading::pool& p) const
+	{
+		paths.resize(requests.size());
+		const size_t parts = std::min(size_t(p.num_threads() + 1), (requests.size() + min_paths_per_job - 1) / min_paths_per_job);
+		if(parts <= 1) {
+			for(size_t n = 0; n != requests.size(); ++n) {
+				find_path(requests[n].from, requests[n].to, paths[n]);
+			}
+			return;
+		}
+
+		// The calling thread finds the first part itself.
+		job_batch batch;
+		batch.remaining = int(parts - 1);
+		const size_t per_part = (requests.size() + parts - 1) / parts;
+		for(size_t n = 1; n != parts; ++n) {
+			p.add_job(boost::bind(find_job, this, &requests, &paths, n * per_part, std::min(requests.size(), (n + 1) * per_part), &batch));
+		}
+		for(size_t n = 0; n != per_part; ++n) {
+			find_path(requests[n].from, requests[n].to, paths[n]);
+		}
+
+		boost::mutex::scoped_lock lock(batch.guard);
+		while(batch.remaining != 0) {
+			batch.done.wait(lock);
+		}
+	}
+
+	void pathfinder::find_job(const pathfinder* pf, const std::vector<path_request>* requests, std::vector<std::vector<path_point> >* paths,
+		size_t first, size_t last, job_batch* batch)
+	{
+		for(size_t n = first; n != last; ++n) {
+			pf->find_path((*requests)[n].from, (*requests)[n].to, (*paths)[n]);
+		}
+		boost::mutex::scoped_lock lock(batch->guard);
+		if(--batch->remaining == 0) {
+			batch->done.notify_one();
+		}
+	}
+
+	size_t pathfinder::num_entrances() const
+	{
+		size_t count = 0;
+		for(auto it = clusters_.begin(); it != clusters_.end(); ++it) {
+			count += it->second.cells.size();
+		}
+		return count;
+	}
+
+	size_t pathfinder::memory_usage() const
+	{
+		size_t bytes = sizeof(*this) + dirty_.size() * sizeof(uint64_t);
+		for(auto it = clusters_.begin(); it != clusters_.end(); ++it) {
+			const cluster& c = it->second;
+			bytes += sizeof(uint64_t) + sizeof(cluster) + c.cells.capacity() * sizeof(int) + c.distances.capacity() * sizeof(uint16_t);
+			for(auto link = c.links.begin(); link != c.links.end(); ++link) {
+				bytes += sizeof(*link) + link->capacity() * sizeof(uint64_t);
+			}
+		}
+		return bytes;
+	}
+}
+
+namespace
+{
+	// True if every point of path is one step on from the last.
+	bool is_walkable(const cube::chunk_map& cm, const std::vector<cube::path_point>& path)
+	{
+		cube::block_reader reader(cm);
+		for(size_t n = 1; n < path.size(); ++n) {
+			bool stepped = false;
+			const unsigned mask = reader.steps_from(path[n - 1]);
+			for(int m = 0; m != cube::num_steps && !stepped; ++m) {
+				stepped = (mask & (1 << m)) != 0 && cube::step_to(path[n - 1], m) == path[n];
+			}
+			if(!stepped) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Ground at y = 0 over chunks -1 to 1 along x and z, with the layer of
+	// chunks above it added to pf.
+	void path_test_world(cube::chunk_map& cm, cube::pathfinder& pf)
+	{
+		const cube::block_box ground = { -32, -1, -32, 96, 1, 96 };
+		cm.fill_box(ground, 1);
+		for(int cy = -1; cy <= 0; ++cy) {
+			for(int cz = -1; cz <= 1; ++cz) {
+				for(int cx = -1; cx <= 1; ++cx) {
+					pf.add_chunk(cx, cy, cz);
+				}
+			}
+		}
+	}
+}
+
+UNIT_TEST(pathfinder)
+{
+	cube::chunk_map cm;
+	cube::pathfinder pf(cm);
+	path_test_world(cm, pf);
+	pf.update(threading::get_pool());
+	CHECK_EQ(pf.dirty_clusters(), 0);
+	CHECK_EQ(pf.num_entrances() > 0, true);
+
+	// Across open ground, and from corner to corner, paths take the fewest
+	// steps there are.
+	std::vector<cube::path_point> path;
+	const cube::path_point a = { -20, 0, -20 }, b = { 50, 0, 50 }, c = { -20, 0, 50 };
+	CHECK_EQ(pf.find_path(a, c, path), true);
+	CHECK_EQ(path.size(), 71);
+	CHECK_EQ(is_walkable(cm, path), true);
+	CHECK_EQ(pf.find_path(a, b, path), true);
+	CHECK_EQ(path.front() == a && path.back() == b, true);
+	CHECK_EQ(path.size(), 141);
+	CHECK_EQ(is_walkable(cm, path), true);
+
+	// The route passes through entrances, and refining it a leg at a time
+	// gives a path as short.
+	std::vector<cube::path_point> route, leg;
+	CHECK_EQ(pf.find_route(a, b, route), true);
+	CHECK_EQ(route.size() > 2 && route.front() == a && route.back() == b, true);
+	size_t steps = 0;
+	for(size_t n = 1; n != route.size(); ++n) {
+		CHECK_EQ(pf.find_path(route[n - 1], route[n], leg), true);
+		steps += leg.size() - 1;
+	}
+	CHECK_EQ(steps, 140);
+
+	// A wall with a gap is gone round, crossing it only at the gap.
+	const cube::block_box wall = { 10, 0, -32, 1, 3, 96 };
+	cm.fill_box(wall, 1);
+	const cube::block_box gap = { 10, 0, 40, 1, 3, 2 };
+	cm.fill_box(gap, cube::empty_block);
+	pf.blocks_changed(wall);
+	pf.update(threading::get_pool());
+	CHECK_EQ(pf.find_path(a, b, path), true);
+	CHECK_EQ(is_walkable(cm, path), true);
+	for(auto it = path.begin(); it != path.end(); ++it) {
+		if(it->x == 10) {
+			CHECK_EQ(it->z == 40 || it->z == 41, true);
+		}
+	}
+
+	// Closing the gap leaves no way through, until a stair is built over.
+	cm.fill_box(gap, 1);
+	pf.blocks_changed(gap);
+	pf.update(threading::get_pool());
+	CHECK_EQ(pf.find_path(a, b, path), false);
+	CHECK_EQ(path.empty(), true);
+	const cube::block_box stair = { 8, 0, 0, 5, 1, 1 }, upper = { 9, 1, 0, 3, 1, 1 };
+	cm.fill_box(stair, 1);
+	cm.fill_box(upper, 1);
+	pf.blocks_changed(stair);
+	pf.blocks_changed(upper);
+	pf.update(threading::get_pool());
+	CHECK_EQ(pf.find_path(a, b, path), true);
+	CHECK_EQ(is_walkable(cm, path), true);
+
+	// Somewhere no one can stand, or outside the clusters, has no path.
+	const cube::path_point in_wall = { 10, 0, 5 }, outside = { 100, 0, 0 };
+	CHECK_EQ(pf.find_path(a, in_wall, path), false);
+	CHECK_EQ(pf.find_path(a, outside, path), false);
+
+	// Batches give the same paths as one at a time.
+	std::vector<cube::path_request> requests;
+	for(int n = 0; n != 20; ++n) {
+		const cube::path_request r = { { -30 + n, 0, -30 }, { 60 - n, 0, 60 } };
+		requests.push_back(r);
+	}
+	std::vector<std::vector<cube::path_point> > paths;
+	pf.find_paths(requests, paths, threading::get_pool());
+	CHECK_EQ(paths.size(), requests.size());
+	for(size_t n = 0; n != requests.size(); ++n) {
+		CHECK_EQ(pf.find_path(requests[n].from, requests[n].to, path), true);
+		CHECK_EQ(paths[n] == path, true);
+	}
+}
+
+namespace
+{
+	// Rolling ground over 512x512 blocks, rising and falling a block at a
+	// time.
+	void path_benchmark_world(cube::chunk_map& cm, cube::pathfinder& pf)
+	{
+		for(int z = 0; z != 512; ++z) {
+			for(int x = 0; x != 512; ++x) {
+				const int height = 8 + std::abs(((x >> 3) + (z >> 3)) % 6 - 3);
+				const cube::block_box column = { x, 0, z, 1, height, 1 };
+				cm.fill_box(column, 1);
+			}
+		}
+		for(int cz = 0; cz != 16; ++cz) {
+			for(int cx = 0; cx != 16; ++cx) {
+				pf.add_chunk(cx, 0, cz);
+			}
+		}
+	}
+}
+
+// Building the graph for 16x16 chunks.
+BENCHMARK(pathfinder_build)
+{
+	cube::chunk_map cm;
+	cube::pathfinder pf(cm);
+	path_benchmark_world(cm, pf);
+	BENCHMARK_LOOP {
+		pf.clear();
+		path_benchmark_world(cm, pf);
+		pf.update(threading::get_pool());
+	}
+}
+
+// Corner to corner across 512x512 blocks, as a route of entrances and as
+// every step.
+BENCHMARK(pathfinder_route)
+{
+	cube::chunk_map cm;
+	cube::pathfinder pf(cm);
+	path_benchmark_world(cm, pf);
+	pf.update(threading::get_pool());
+	const cube::path_point from = { 2, 8 + 3, 2 };
+	const cube::path_point to = { 509, 8 + std::abs(((509 >> 3) * 2) % 6 - 3), 509 };
+	std::vector<cube::path_point> route;
+	BENCHMARK_LOOP {
+		pf.find_route(from, to, route);
+	}
+}
+
+BENCHMARK(pathfinder_query)
+{
+	cube::chunk_map cm;
+	cube::pathfinder pf(cm);
+	path_benchmark_world(cm, pf);
+	pf.update(threading::get_pool());
+	const cube::path_point from = { 2, 8 + 3, 2 };
+	const cube::path_point to = { 509, 8 + std::abs(((509 >> 3) * 2) % 6 - 3), 509 };
+	std::vector<cube::path_point> path;
+	BENCHMARK_LOOP {
+		pf.find_path(from, to, path);
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
+#include "chunk.hpp"
+#include "thread_pool.hpp"
+
+namespace cube
+{
+	// An empty block with an empty block above it and a solid one below,
+	// where an agent two blocks tall can stand.
+	struct path_point
+	{
+		int x, y, z;
+
+		bool operator==(const path_point& p) const { return x == p.x && y == p.y && z == p.z; }
+		bool operator!=(const path_point& p) const { return !(*this == p); }
+	};
+
+	struct path_request
+	{
+		path_point from, to;
+	};
+
+	// Hierarchical path finding (HPA*) over the blocks of a chunk_map. Agents
+	// step one block along x or z, climbing or dropping at most one block,
+	// with headroom for their height along the way.
+	//
+	// Each chunk added is a cluster of the abstract graph. Where agents can
+	// step between two clusters, each run of neighbouring steps across the
+	// border gives an entrance, one node either side, and the distance
+	// between every pair of entrance nodes within a cluster is cached. Paths
+	// are found with A* over the entrances, then refined a cluster at a time
+	// with A* over its blocks.
+	class pathfinder
+	{
+	public:
+		explicit pathfinder(const chunk_map& cm);
+		virtual ~pathfinder();
+
+		// Paths only cross the chunks added, which needn't be stored in the
+		// chunk_map: a missing chunk is all empty.
+		void add_chunk(int cx, int cy, int cz);
+		void remove_chunk(int cx, int cy, int cz);
+		bool has_chunk(int cx, int cy, int cz) const { return clusters_.count(chunk_map::key(cx, cy, cz)) != 0; }
+		void clear();
+
+		// Call once the blocks in box have been changed in the chunk_map. The
+		// clusters whose entrances or distances may have changed are rebuilt
+		// by the next update().
+		void blocks_changed(const block_box& box);
+		void block_changed(int x, int y, int z)
+		{
+			const block_box box = { x, y, z, 1, 1, 1 };
+			blocks_changed(box);
+		}
+		// Rebuilds clusters added or changed since the last update, spread
+		// across the pool's threads. Mustn't run alongside find_path().
+		void update(threading::pool& p);
+		size_t dirty_clusters() const { return dirty_.size(); }
+
+		// Fills path with the points from from to to inclusive, returning
+		// false, with path empty, if there's no way there. Only reads the
+		// graph and chunks already in the chunk_map, so any number of
+		// threads may find paths at once while neither is modified.
+		bool find_path(const path_point& from, const path_point& to, std::vector<path_point>& path) const;
+		// Fills waypoints with from, the entrances the path passes through
+		// and to. Each waypoint is either a step across a chunk border from
+		// the one before, or in the same chunk, and find_path() between the
+		// two stays inside it. Far cheaper than find_path() for long paths,
+		// which agents can refine a leg at a time as they go.
+		bool find_route(const path_point& from, const path_point& to, std::vector<path_point>& waypoints) const;
+		// Finds every path, in batches spread across the pool's threads and
+		// the calling one. paths is resized to match, with an empty path
+		// for each request which has none.
+		void find_paths(const std::vector<path_request>& requests, std::vector<std::vector<path_point> >& paths, threading::pool& p) const;
+
+		bool can_stand(int x, int y, int z) const;
+
+		size_t num_clusters() const { return clusters_.size(); }
+		size_t num_entrances() const;
+		size_t memory_usage() const;
+	private:
+		struct cluster
+		{
+			// Local indices of the entrance nodes within the chunk, in
+			// ascending order.
+			std::vector<int> cells;
+			// For each node, the points across the border it steps to, packed
+			// with chunk_map::key().
+			std::vector<std::vector<uint64_t> > links;
+			// Steps between each pair of nodes, cells.size() squared, with
+			// no_path where one can't be reached from the other.
+			std::vector<uint16_t> distances;
+		};
+		struct search_scratch;
+		struct job_batch;
+
+		void mark_dirty(int cx, int cy, int cz, int below, int above);
+		void build_cluster(uint64_t key, cluster& out) const;
+		static void build_job(const pathfinder* pf, const std::vector<uint64_t>* keys, std::vector<cluster>* built, size_t first, size_t last, job_batch* batch);
+		bool route(const path_point& from, const path_point& to, search_scratch& s, std::vector<path_point>& waypoints) const;
+		// A* from from to to without leaving the chunk, appending the points
+		// after from to path.
+		bool local_path(const path_point& from, const path_point& to, search_scratch& s, std::vector<path_point>& path) const;
+		// Steps from p to each entrance node of its cluster, and to target
+		// if it's in the same chunk, or no_path.
+		void node_distances(const path_point& p, const cluster& c, const path_point& target, search_scratch& s,
+			std::vector<uint16_t>& out, uint16_t& target_steps) const;
+		static void find_job(const pathfinder* pf, const std::vector<path_request>* requests, std::vector<std::vector<path_point> >* paths,
+			size_t first, size_t last, job_batch* batch);
+
+		const chunk_map& chunks_;
+		boost::unordered_map<uint64_t, cluster> clusters_;
+		boost::unordered_set<uint64_t> dirty_;
+
+		pathfinder();
+		pathfinder(const pathfinder&);
+	};
+}
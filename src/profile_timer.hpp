@@ -78,5 +78,23 @@ namespace profile
 			std::cerr << name << ":" << elapsedTime << std::endl;
 		}
 	};
+
+	struct timer
+	{
+		timeval t1;
+		double elapsedTime;
+
+		timer()
+		{
+			gettimeofday(&t1, NULL);
+		}
+
+		double elapsed_time_microseconds()
+		{
+			timeval t2;
+			gettimeofday(&t2, NULL);
+			return elapsedTime = (t2.tv_sec - t1.tv_sec) * 1000000.0 + (t2.tv_usec - t1.tv_usec);
+		}
+	};
 #endif
 }
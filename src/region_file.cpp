@@ -0,0 +1,349 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/unordered_set.hpp>
+
+#include "asserts.hpp"
+#include "region_file.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		const char region_magic[4] = { 'C', 'R', 'G', 'N' };
+		const uint32_t region_version = 1;
+		// Magic, version and region co-ordinates.
+		const size_t header_size = 20;
+		// An offset and size per chunk, an offset of 0 means no chunk.
+		const size_t index_entry_size = 8;
+		const size_t index_size = region_chunks * index_entry_size;
+
+		// Files are little endian whatever the host.
+		void put_u16(std::vector<uint8_t>& out, uint16_t v)
+		{
+			out.push_back(uint8_t(v));
+			out.push_back(uint8_t(v >> 8));
+		}
+
+		void put_u32(uint8_t* p, uint32_t v)
+		{
+			p[0] = uint8_t(v);
+			p[1] = uint8_t(v >> 8);
+			p[2] = uint8_t(v >> 16);
+			p[3] = uint8_t(v >> 24);
+		}
+
+		uint16_t get_u16(const uint8_t* p)
+		{
+			return uint16_t(p[0] | (p[1] << 8));
+		}
+
+		uint32_t get_u32(const uint8_t* p)
+		{
+			return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+		}
+	}
+
+	void encode_chunk(const chunk& c, std::vector<uint8_t>& out)
+	{
+		// Each run is a 16-bit length followed by a 16-bit block_id. A whole
+		// chunk is 32768 blocks, so a run never needs splitting.
+		int n = 0;
+		while(n != chunk_volume) {
+			const block_id b = c.get_index(n);
+			int end = n + 1;
+			while(end != chunk_volume && c.get_index(end) == b) {
+				++end;
+			}
+			put_u16(out, uint16_t(end - n));
+			put_u16(out, b);
+			n = end;
+		}
+	}
+
+	chunk_ptr decode_chunk(int cx, int cy, int cz, const uint8_t* data, size_t size)
+	{
+		ASSERT_LOG(size % 4 == 0, "decode_chunk(): bad size " << size << " for chunk " << cx << "," << cy << "," << cz);
+		chunk_ptr c(new chunk(cx, cy, cz));
+		int n = 0;
+		for(size_t pos = 0; pos != size; pos += 4) {
+			const int len = get_u16(data + pos);
+			ASSERT_LOG(len > 0 && n + len <= chunk_volume, "decode_chunk(): bad run for chunk " << cx << "," << cy << "," << cz);
+			c->fill_range(n, n + len, get_u16(data + pos + 2));
+			n += len;
+		}
+		ASSERT_LOG(n == chunk_volume, "decode_chunk(): chunk " << cx << "," << cy << "," << cz << " has " << n << " blocks");
+		return c;
+	}
+
+	region_file::region_file(const std::string& fname)
+		: file_(fname.c_str(), boost::interprocess::read_only),
+		region_(file_, boost::interprocess::read_only)
+	{
+		data_ = static_cast<const uint8_t*>(region_.get_address());
+		size_ = region_.get_size();
+		ASSERT_LOG(size_ >= header_size + index_size && std::memcmp(data_, region_magic, sizeof(region_magic)) == 0,
+			"Not a region file: " << fname);
+		ASSERT_LOG(get_u32(data_ + 4) == region_version, "Unsupported region file version " << get_u32(data_ + 4) << ": " << fname);
+		rx_ = int(get_u32(data_ + 8));
+		ry_ = int(get_u32(data_ + 12));
+		rz_ = int(get_u32(data_ + 16));
+	}
+
+	region_file::~region_file()
+	{
+	}
+
+	int region_file::slot(int cx, int cy, int cz) const
+	{
+		ASSERT_LOG((cx >> region_shift) == rx_ && (cy >> region_shift) == ry_ && (cz >> region_shift) == rz_,
+			"Chunk " << cx << "," << cy << "," << cz << " isn't in region " << rx_ << "," << ry_ << "," << rz_);
+		return ((cy & region_mask) << (2 * region_shift)) | ((cz & region_mask) << region_shift) | (cx & region_mask);
+	}
+
+	uint32_t region_file::index_entry(int slot, int field) const
+	{
+		return get_u32(data_ + header_size + slot * index_entry_size + field * 4);
+	}
+
+	bool region_file::has_chunk(int cx, int cy, int cz) const
+	{
+		return index_entry(slot(cx, cy, cz), 0) != 0;
+	}
+
+	chunk_ptr region_file::load_chunk(int cx, int cy, int cz) const
+	{
+		const int n = slot(cx, cy, cz);
+		const uint32_t offset = index_entry(n, 0), size = index_entry(n, 1);
+		if(offset == 0) {
+			return chunk_ptr();
+		}
+		ASSERT_LOG(offset >= header_size + index_size && size_t(offset) + size <= size_,
+			"Region " << rx_ << "," << ry_ << "," << rz_ << " has a bad index entry for chunk " << cx << "," << cy << "," << cz);
+		return decode_chunk(cx, cy, cz, data_ + offset, size);
+	}
+
+	void region_file::chunk_keys(std::vector<uint64_t>& keys) const
+	{
+		for(int n = 0; n != region_chunks; ++n) {
+			if(index_entry(n, 0) != 0) {
+				keys.push_back(chunk_map::key((rx_ << region_shift) | (n & region_mask),
+					(ry_ << region_shift) | (n >> (2 * region_shift)),
+					(rz_ << region_shift) | ((n >> region_shift) & region_mask)));
+			}
+		}
+	}
+
+	void region_file::save(const std::string& fname, int rx, int ry, int rz, const std::vector<const_chunk_ptr>& chunks)
+	{
+		std::vector<uint8_t> data(header_size + index_size);
+		std::memcpy(&data[0], region_magic, sizeof(region_magic));
+		put_u32(&data[4], region_version);
+		put_u32(&data[8], uint32_t(rx));
+		put_u32(&data[12], uint32_t(ry));
+		put_u32(&data[16], uint32_t(rz));
+		for(auto it = chunks.begin(); it != chunks.end(); ++it) {
+			const chunk& c = **it;
+			ASSERT_LOG((c.cx() >> region_shift) == rx && (c.cy() >> region_shift) == ry && (c.cz() >> region_shift) == rz,
+				"region_file::save(): chunk " << c.cx() << "," << c.cy() << "," << c.cz() << " isn't in region " << rx << "," << ry << "," << rz);
+			const int n = ((c.cy() & region_mask) << (2 * region_shift)) | ((c.cz() & region_mask) << region_shift) | (c.cx() & region_mask);
+			const size_t offset = data.size();
+			encode_chunk(c, data);
+			put_u32(&data[header_size + n * index_entry_size], uint32_t(offset));
+			put_u32(&data[header_size + n * index_entry_size + 4], uint32_t(data.size() - offset));
+		}
+
+		std::ofstream file(fname.c_str(), std::ios_base::binary | std::ios_base::trunc);
+		ASSERT_LOG(file.is_open(), "Couldn't write region file: " << fname);
+		file.write(reinterpret_cast<const char*>(&data[0]), data.size());
+	}
+
+	region_store::region_store(const std::string& dir)
+		: dir_(dir)
+	{
+		ASSERT_LOG(boost::filesystem::is_directory(dir), "region_store: not a directory: " << dir);
+	}
+
+	region_store::~region_store()
+	{
+	}
+
+	std::string region_store::temp_name(const std::string& name)
+	{
+		// Not matched by chunk_keys() while it's being written.
+		return boost::filesystem::path(name).replace_extension(".tmp").string();
+	}
+
+	std::string region_store::region_name(int rx, int ry, int rz)
+	{
+		std::stringstream ss;
+		ss << "r." << rx << "." << ry << "." << rz << ".rgn";
+		return ss.str();
+	}
+
+	boost::shared_ptr<region_file> region_store::get_region(int rx, int ry, int rz)
+	{
+		const uint64_t key = chunk_map::key(rx, ry, rz);
+		auto it = regions_.find(key);
+		if(it != regions_.end()) {
+			return it->second;
+		}
+		boost::shared_ptr<region_file> res;
+		const boost::filesystem::path p = boost::filesystem::path(dir_) / region_name(rx, ry, rz);
+		if(boost::filesystem::is_regular_file(p)) {
+			res.reset(new region_file(p.string()));
+		}
+		regions_[key] = res;
+		return res;
+	}
+
+	chunk_ptr region_store::load_chunk(int cx, int cy, int cz)
+	{
+		boost::shared_ptr<region_file> r = get_region(cx >> region_shift, cy >> region_shift, cz >> region_shift);
+		return r ? r->load_chunk(cx, cy, cz) : chunk_ptr();
+	}
+
+	void region_store::chunk_keys(std::vector<uint64_t>& keys)
+	{
+		for(auto it = boost::filesystem::directory_iterator(dir_); it != boost::filesystem::directory_iterator(); ++it) {
+			int rx, ry, rz;
+			char tail;
+			if(std::sscanf(it->path().filename().string().c_str(), "r.%d.%d.%d.rg%c", &rx, &ry, &rz, &tail) == 4 && tail == 'n') {
+				boost::shared_ptr<region_file> r = get_region(rx, ry, rz);
+				if(r) {
+					r->chunk_keys(keys);
+				}
+			}
+		}
+	}
+
+	void region_store::save(const chunk_map& cm, const std::string& dir)
+	{
+		boost::filesystem::create_directories(dir);
+
+		std::vector<uint64_t> keys;
+		cm.keys(keys);
+		boost::unordered_map<uint64_t, std::vector<uint64_t> > regions;
+		for(auto it = keys.begin(); it != keys.end(); ++it) {
+			int cx, cy, cz;
+			chunk_map::from_key(*it, cx, cy, cz);
+			regions[chunk_map::key(cx >> region_shift, cy >> region_shift, cz >> region_shift)].push_back(*it);
+		}
+
+		// Only one region's chunks are held at once beyond those already in
+		// cm. Nothing is replaced until every region has been read, since
+		// the store may be reading from dir.
+		boost::unordered_set<std::string> written;
+		for(auto it = regions.begin(); it != regions.end(); ++it) {
+			std::vector<const_chunk_ptr> chunks;
+			for(auto k = it->second.begin(); k != it->second.end(); ++k) {
+				int cx, cy, cz;
+				chunk_map::from_key(*k, cx, cy, cz);
+				const_chunk_ptr c = cm.is_paged_in(cx, cy, cz) ? cm.get_chunk(cx, cy, cz) : cm.store()->load_chunk(cx, cy, cz);
+				if(c && !c->is_empty()) {
+					chunks.push_back(c);
+				}
+			}
+			if(chunks.empty()) {
+				continue;
+			}
+			int rx, ry, rz;
+			chunk_map::from_key(it->first, rx, ry, rz);
+			const std::string name = region_name(rx, ry, rz);
+			region_file::save((boost::filesystem::path(dir) / temp_name(name)).string(), rx, ry, rz, chunks);
+			written.insert(name);
+		}
+
+		if(cm.store()) {
+			cm.store()->close_files();
+		}
+		std::vector<boost::filesystem::path> stale;
+		for(auto it = boost::filesystem::directory_iterator(dir); it != boost::filesystem::directory_iterator(); ++it) {
+			if(it->path().extension() == ".rgn" && written.count(it->path().filename().string()) == 0) {
+				stale.push_back(it->path());
+			}
+		}
+		for(auto it = stale.begin(); it != stale.end(); ++it) {
+			boost::filesystem::remove(*it);
+		}
+		for(auto it = written.begin(); it != written.end(); ++it) {
+			const boost::filesystem::path p = boost::filesystem::path(dir) / *it;
+			boost::filesystem::rename(p.parent_path() / temp_name(*it), p);
+		}
+	}
+}
+
+UNIT_TEST(region_file)
+{
+	std::vector<uint8_t> data;
+	cube::encode_chunk(cube::chunk(1, 2, 3, 7), data);
+	CHECK_EQ(data.size(), 4);
+	cube::chunk_ptr c = cube::decode_chunk(1, 2, 3, &data[0], data.size());
+	CHECK_EQ(c->is_uniform(), true);
+	CHECK_EQ(c->uniform_type(), 7);
+
+	cube::chunk mixed(0, 0, 0);
+	mixed.fill_column(3, 4, 0, 10, 5);
+	mixed.set(31, 31, 31, 300);
+	data.clear();
+	cube::encode_chunk(mixed, data);
+	c = cube::decode_chunk(0, 0, 0, &data[0], data.size());
+	for(int n = 0; n != cube::chunk_volume; ++n) {
+		CHECK_EQ(c->get_index(n), mixed.get_index(n));
+	}
+}
+
+UNIT_TEST(region_store_round_trip)
+{
+	const std::string dir = (boost::filesystem::temp_directory_path() / "a3de_region_test").string();
+
+	cube::chunk_map cm;
+	cube::chunk_ptr mixed = cm.get_or_create_chunk(-1, -2, -33);
+	mixed->fill_column(3, 4, 0, 10, 5);
+	mixed->set(31, 31, 31, 300);
+	cm.get_or_create_chunk(2, 0, -17)->fill(7);
+	cube::region_store::save(cm, dir);
+
+	{
+		cube::region_store store(dir);
+		cube::chunk_ptr c = store.load_chunk(-1, -2, -33);
+		CHECK_EQ(c.get() != NULL, true);
+		CHECK_EQ(c->cx(), -1);
+		CHECK_EQ(c->cy(), -2);
+		CHECK_EQ(c->cz(), -33);
+		for(int n = 0; n != cube::chunk_volume; ++n) {
+			CHECK_EQ(c->get_index(n), mixed->get_index(n));
+		}
+
+		c = store.load_chunk(2, 0, -17);
+		CHECK_EQ(c.get() != NULL, true);
+		CHECK_EQ(c->is_uniform(), true);
+		CHECK_EQ(c->uniform_type(), 7);
+
+		CHECK_EQ(store.load_chunk(-1, -2, -32).get() == NULL, true);
+	}
+
+	// Saving a world back over the store it pages in from keeps the chunks
+	// which were never paged in, without paging them in.
+	{
+		cube::chunk_map paged;
+		paged.set_store(cube::region_store_ptr(new cube::region_store(dir)));
+		paged.set_block(-32, -64, -33 * 32, 9);
+		cube::region_store::save(paged, dir);
+		CHECK_EQ(paged.is_paged_in(2, 0, -17), false);
+		CHECK_EQ(boost::filesystem::exists(boost::filesystem::path(dir) / "r.-1.-1.-3.tmp"), false);
+	}
+	{
+		cube::region_store store(dir);
+		cube::chunk_ptr c = store.load_chunk(-1, -2, -33);
+		CHECK_EQ(c->get(0, 0, 0), 9);
+		CHECK_EQ(c->get(3, 5, 4), 5);
+		c = store.load_chunk(2, 0, -17);
+		CHECK_EQ(c.get() != NULL, true);
+		CHECK_EQ(c->uniform_type(), 7);
+	}
+	boost::filesystem::remove_all(dir);
+}
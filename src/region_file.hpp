@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "chunk.hpp"
+
+namespace cube
+{
+	// Worlds are saved as a directory of region files, each holding up to
+	// region_size chunks along each axis.
+	const int region_shift = 4;
+	const int region_size = 1 << region_shift;
+	const int region_mask = region_size - 1;
+	const int region_chunks = region_size * region_size * region_size;
+
+	// Run length encodes the blocks of c, in index order, appending to out.
+	void encode_chunk(const chunk& c, std::vector<uint8_t>& out);
+	// Decodes a chunk written by encode_chunk().
+	chunk_ptr decode_chunk(int cx, int cy, int cz, const uint8_t* data, size_t size);
+
+	// A single memory mapped region file. The file is a header, followed by
+	// an index giving the offset and size of each chunk's encoded blocks,
+	// followed by the encoded blocks. Opening one reads only the header;
+	// the pages holding a chunk are read when it is loaded.
+	class region_file
+	{
+	public:
+		explicit region_file(const std::string& fname);
+		virtual ~region_file();
+
+		int rx() const { return rx_; }
+		int ry() const { return ry_; }
+		int rz() const { return rz_; }
+
+		// Chunk co-ordinates must lie inside this region. Returns a null
+		// pointer if the chunk isn't stored.
+		chunk_ptr load_chunk(int cx, int cy, int cz) const;
+		bool has_chunk(int cx, int cy, int cz) const;
+		// Appends the chunk_map key of every chunk stored.
+		void chunk_keys(std::vector<uint64_t>& keys) const;
+
+		// Writes the given chunks, which must all be in region rx, ry, rz.
+		static void save(const std::string& fname, int rx, int ry, int rz, const std::vector<const_chunk_ptr>& chunks);
+	private:
+		int slot(int cx, int cy, int cz) const;
+		uint32_t index_entry(int slot, int field) const;
+
+		boost::interprocess::file_mapping file_;
+		boost::interprocess::mapped_region region_;
+		const uint8_t* data_;
+		size_t size_;
+
+		int rx_;
+		int ry_;
+		int rz_;
+
+		region_file();
+		region_file(const region_file&);
+	};
+
+	// Directory of region files. Regions are opened the first time one of
+	// their chunks is asked for.
+	class region_store : public chunk_source
+	{
+	public:
+		explicit region_store(const std::string& dir);
+		virtual ~region_store();
+
+		const std::string& dir() const { return dir_; }
+		// Returns a null pointer if the chunk isn't stored.
+		virtual chunk_ptr load_chunk(int cx, int cy, int cz);
+		// Appends the chunk_map key of every chunk stored. This opens every
+		// region in the directory.
+		virtual void chunk_keys(std::vector<uint64_t>& keys);
+		size_t regions_open() const { return regions_.size(); }
+		virtual void close_files() { regions_.clear(); }
+
+		static std::string region_name(int rx, int ry, int rz);
+		// Writes every chunk in cm to region files in dir, replacing any
+		// already there. dir may be the directory cm pages chunks in from:
+		// chunks not yet paged in are read from the store a region at a
+		// time, without being added to cm, and each region is written to a
+		// temporary file which replaces the old one once all are written.
+		static void save(const chunk_map& cm, const std::string& dir);
+	private:
+		// Name a region file is written under before it replaces name.
+		static std::string temp_name(const std::string& name);
+		// Null if there is no file for the region.
+		boost::shared_ptr<region_file> get_region(int rx, int ry, int rz);
+
+		std::string dir_;
+		boost::unordered_map<uint64_t, boost::shared_ptr<region_file> > regions_;
+
+		region_store();
+		region_store(const region_store&);
+	};
+	typedef boost::shared_ptr<region_store> region_store_ptr;
+}
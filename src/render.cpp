@@ -1,15 +1,22 @@
+#include <cmath>
+#include <map>
 #include <sstream>
 #include <iomanip>
 #include <vector>
 #include <glm/gtc/matrix_transform.hpp>
+#include <boost/bind.hpp>
 #include <boost/shared_array.hpp>
 
 #include "asserts.hpp"
 #include "filesystem.hpp"
+#include "gl_state.hpp"
 #include "graphics.hpp"
+#include "occlusion.hpp"
 #include "profile_timer.hpp"
 #include "render.hpp"
 #include "render_text.hpp"
+#include "stream_buffer.hpp"
+#include "unit_test.hpp"
 
 
 namespace graphics
@@ -102,110 +109,214 @@ namespace graphics
 			}
 		};
 
-		static const int num_array_buffers = 2;
-
-		boost::shared_array<GLuint>& cube_array_buffer()
-		{
-			static boost::shared_array<GLuint> res;
-			if(res == NULL) {
-				res = boost::shared_array<GLuint>(new GLuint[num_array_buffers], vbo_deleter(num_array_buffers));
-				glGenBuffers(num_array_buffers, &res[0]);
-				glBindBuffer(GL_ARRAY_BUFFER, res[0]);
-				glBufferData(GL_ARRAY_BUFFER, sizeof(cube_face_varray), cube_face_varray, GL_STATIC_DRAW);
-				glBindBuffer(GL_ARRAY_BUFFER, res[1]);
-				glBufferData(GL_ARRAY_BUFFER, sizeof(cube_face_tarray), cube_face_tarray, GL_STATIC_DRAW);
-			}
-			return res;
-		}
+		// Triangles of a face from its four vertices, in the order of the
+		// strip above.
+		static const GLuint cube_face_indices[6] = { 0, 1, 2, 2, 1, 3 };
 	}
 
-	class cube
+	// Every visible face of a shader's cubes in one interleaved, indexed
+	// vertex buffer. Positions are in world space and texture coordinates
+	// are into an atlas of all the cubes' textures, so the whole list draws
+	// with a single call.
+	class cube_batch
 	{
 	public:
-		cube(shader::program_object_ptr shader)
-			: shader_(shader)
+		explicit cube_batch(shader::program_object_ptr shader)
+			: shader_(shader), buffers_(new GLuint[2], vbo_deleter(2))
 		{
 			mm_uniform_it_ = shader->get_uniform_iterator("model_matrix");
 			a_position_it_ = shader->get_attribute_iterator("a_position");
 			a_tex_coord_it_ = shader->get_attribute_iterator("a_tex_coord");
 			tex0_it_ = shader->get_uniform_iterator("u_tex0");
-
-			array_buffers_ = cube_array_buffer();
+			glGenBuffers(2, buffers_.get());
 		}
 
-		virtual ~cube()
+		virtual ~cube_batch()
 		{}
 
-		void prepare_draw()
+		void build(const std::vector<cube_model_ptr>& cubes)
 		{
-			glEnableVertexAttribArray(a_position_it_->second.location);
-			glEnableVertexAttribArray(a_tex_coord_it_->second.location);
-
-			glBindBuffer(GL_ARRAY_BUFFER, array_buffers_[0]);
-			glVertexAttribPointer(
-				a_position_it_->second.location, // The attribute we want to configure
-				3,                  // size
-				GL_FLOAT,           // type
-				GL_FALSE,           // normalized?
-				0,  // stride
-				0            // array buffer offset
-			);
+			// Each texture gets one area of the atlas, however many cubes use
+			// it. The names are in order, so the atlas only has to be made
+			// again when the set of textures changes.
+			std::map<std::string, size_t> texture_area;
+			built_.clear();
+			built_.reserve(cubes.size());
+			for(auto it = cubes.begin(); it != cubes.end(); ++it) {
+				const_texture_ptr tex = (*it)->get_texture();
+				ASSERT_LOG(tex != NULL && !tex->name().empty(), "cube_batch: cubes need a texture loaded from a file to be batched.");
+				texture_area.insert(std::make_pair(tex->name(), 0));
+				built_.push_back(cube_state(**it));
+			}
+			std::vector<std::string> fnames;
+			for(auto it = texture_area.begin(); it != texture_area.end(); ++it) {
+				it->second = fnames.size();
+				fnames.push_back(it->first);
+			}
+			if(fnames != atlas_fnames_) {
+				atlas_ = fnames.empty() ? const_texture_ptr() : texture::get_atlas(fnames, atlas_areas_);
+				atlas_fnames_.swap(fnames);
+			}
+
+			std::vector<vertex> vertices;
+			std::vector<GLuint> indices;
+			bounds_ = aabb();
+			first_index_.clear();
+			first_index_.reserve(cubes.size() + 1);
+			for(size_t n = 0; n != cubes.size(); ++n) {
+				first_index_.push_back(GLuint(indices.size()));
+				const cube_model& cm = *cubes[n];
+				if(cm.is_fully_occluded()) {
+					continue;
+				}
+				bounds_.add(cm.bounds());
+				const rect& area = atlas_areas_[texture_area[cm.get_texture()->name()]];
+				for(int f = cube_model::FRONT; f <= cube_model::BOTTOM; ++f) {
+					if(!cm.should_draw_face(f)) {
+						continue;
+					}
+					const GLuint base = GLuint(vertices.size());
+					for(int t = 0; t != 4; ++t) {
+						const glm::vec4 p = cm.model() * glm::vec4(cube_face_varray[f][t][0],
+							cube_face_varray[f][t][1], cube_face_varray[f][t][2], 1.0f);
+						const vertex v = { p.x, p.y, p.z,
+							area.xf() + cube_face_tarray[f][t*2+0] * area.wf(),
+							area.yf() + cube_face_tarray[f][t*2+1] * area.hf() };
+						vertices.push_back(v);
+					}
+					for(int i = 0; i != 6; ++i) {
+						indices.push_back(base + cube_face_indices[i]);
+					}
+				}
+			}
+			first_index_.push_back(GLuint(indices.size()));
+
+			state::bind_buffer(GL_ARRAY_BUFFER, buffers_[0]);
+			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+			state::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers_[1]);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
 		}
 
-		void end_draw()
+		// False if cubes isn't the list the batch was built from, or any of
+		// them has since been moved or had its neighbours changed.
+		bool is_current(const std::vector<cube_model_ptr>& cubes) const
 		{
-			glDisableVertexAttribArray(a_position_it_->second.location);
-			glDisableVertexAttribArray(a_tex_coord_it_->second.location);
+			if(cubes.size() != built_.size()) {
+				return false;
+			}
+			for(size_t n = 0; n != cubes.size(); ++n) {
+				if(!(cube_state(*cubes[n]) == built_[n])) {
+					return false;
+				}
+			}
+			return true;
 		}
 
-		void draw(cube_model_ptr cm) const
+		// cubes should be the list the batch was built from. Those which the
+		// occlusion buffer, if any, reports as hidden are skipped, drawing
+		// each run of visible cubes in between with one call.
+		void draw(const std::vector<cube_model_ptr>& cubes, const occlusion_buffer* occlusion) const
 		{
-			if(cm->is_fully_occluded()) {
+			ASSERT_LOG(first_index_.size() == cubes.size() + 1, "cube_batch::draw() called with a different list of cubes to the one it was built from.");
+			if(first_index_.back() == 0) {
 				return;
 			}
-			//profile::manager pmain("cube::draw()");
-
-			shader_->set_uniform(mm_uniform_it_, &cm->model()[0][0]);
+			shader_->make_active();
+			static const glm::mat4 identity(1.0f);
+			shader_->set_uniform(mm_uniform_it_, &identity[0][0]);
+
+			state::bind_texture(0, atlas_->id());
+			const GLint tex_unit = 0;
+			shader_->set_uniform(tex0_it_, &tex_unit);
+
+			state::use_attributes(state::attribute_bit(a_position_it_->second.location) | state::attribute_bit(a_tex_coord_it_->second.location));
+			state::bind_buffer(GL_ARRAY_BUFFER, buffers_[0]);
+			glVertexAttribPointer(a_position_it_->second.location, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), 0);
+			glVertexAttribPointer(a_tex_coord_it_->second.location, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)(sizeof(GLfloat)*3));
+			state::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers_[1]);
+
+			if(occlusion == NULL) {
+				draw_range(0, first_index_.back());
+			} else {
+				GLuint first = 0;
+				for(size_t n = 0; n != cubes.size(); ++n) {
+					if(first_index_[n] != first_index_[n+1] && !occlusion->is_visible(cubes[n]->bounds())) {
+						draw_range(first, first_index_[n]);
+						first = first_index_[n+1];
+					}
+				}
+				draw_range(first, first_index_.back());
+			}
+		}
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, cm->tex_id());
-			glUniform1i(tex0_it_->second.location, 0);
+		// Empty if nothing is drawn.
+		const aabb& bounds() const { return bounds_; }
+		GLuint atlas_id() const { return atlas_ ? atlas_->id() : 0; }
+		GLuint buffer_id() const { return buffers_[0]; }
+	private:
+		struct vertex
+		{
+			GLfloat x, y, z;
+			GLfloat u, v;
+		};
 
-			for(int i = cube_model::FRONT; i <= cube_model::BOTTOM; ++i) {
-				if(!cm->should_draw_face(i)) {
-					continue;
+		// Everything build() reads from a cube.
+		struct cube_state
+		{
+			explicit cube_state(const cube_model& cm)
+				: model(cm.model()), tex(cm.get_texture()), faces(0)
+			{
+				for(int f = cube_model::FRONT; f <= cube_model::BOTTOM; ++f) {
+					faces |= cm.should_draw_face(f) ? 1 << f : 0;
 				}
+			}
+			bool operator==(const cube_state& other) const
+			{
+				return model == other.model && tex == other.tex && faces == other.faces;
+			}
+			glm::mat4 model;
+			const_texture_ptr tex;
+			int faces;
+		};
 
-				glBindBuffer(GL_ARRAY_BUFFER, array_buffers_[1]);
-				glVertexAttribPointer(
-					a_tex_coord_it_->second.location, // The attribute we want to configure
-					2,                            // size : U+V => 2
-					GL_FLOAT,                     // type
-					GL_FALSE,                     // normalized?
-					0,			// stride
-					(void*)(sizeof(GLfloat)*i*8)                      // array buffer offset
-				);
-
-				glDrawArrays(GL_TRIANGLE_STRIP, 4, 0);
+		static void draw_range(GLuint first, GLuint last)
+		{
+			if(last != first) {
+				glDrawElements(GL_TRIANGLES, last - first, GL_UNSIGNED_INT, (void*)(sizeof(GLuint)*first));
 			}
 		}
-	protected:
-	private:
+
 		shader::program_object_ptr shader_;
 		shader::const_actives_map_iterator mm_uniform_it_;
 		shader::const_actives_map_iterator a_position_it_;
 		shader::const_actives_map_iterator a_tex_coord_it_;
 		shader::const_actives_map_iterator tex0_it_;
 
-		boost::shared_array<GLuint> array_buffers_;
+		const_texture_ptr atlas_;
+		// Images in the atlas, in order, and the area of each.
+		std::vector<std::string> atlas_fnames_;
+		std::vector<rect> atlas_areas_;
+		aabb bounds_;
+		// Vertices and indices.
+		boost::shared_array<GLuint> buffers_;
+		// Where each cube's indices start, and one past the last cube's.
+		std::vector<GLuint> first_index_;
+		std::vector<cube_state> built_;
+
+		cube_batch();
+		cube_batch(const cube_batch&);
 	};
 
 	cube_model::cube_model()
+		: pos_x_neighbour_(0), neg_x_neighbour_(0), pos_y_neighbour_(0),
+		neg_y_neighbour_(0), pos_z_neighbour_(0), neg_z_neighbour_(0)
 	{
 		model_ = glm::mat4(1.0f);
 	}
 
 	cube_model::cube_model(const std::string& texname)
+		: pos_x_neighbour_(0), neg_x_neighbour_(0), pos_y_neighbour_(0),
+		neg_y_neighbour_(0), pos_z_neighbour_(0), neg_z_neighbour_(0)
 	{
 		tex_ = texture::get(texname);
 		model_ = glm::mat4(1.0f);
@@ -231,6 +342,18 @@ namespace graphics
 		return model_; 
 	}
 
+	aabb cube_model::bounds() const
+	{
+		aabb b;
+		for(int n = 0; n != 8; ++n) {
+			// The cube runs back from its front face at z = 0 to z = -1, see
+			// cube_face_varray.
+			const glm::vec4 p = model_ * glm::vec4(GLfloat(n & 1), GLfloat((n >> 1) & 1), -GLfloat((n >> 2) & 1), 1.0f);
+			b.add(glm::vec3(p.x, p.y, p.z));
+		}
+		return b;
+	}
+
 	GLuint cube_model::tex_id() const 
 	{ 
 		ASSERT_LOG(tex_ != NULL, "Call of cube_model::tex_id() when texture is null.");
@@ -247,20 +370,20 @@ namespace graphics
 		neg_z_neighbour_ = nz;
 	}
 
-	bool cube_model::should_draw_face(int f)
+	bool cube_model::should_draw_face(int f) const
 	{
 		switch(f) {
 			case FRONT: return pos_z_neighbour_ == false;
 			case RIGHT:	return pos_x_neighbour_ == false;
 			case TOP:	return pos_y_neighbour_ == false;
-			case BACK:	return pos_z_neighbour_ == true;
-			case LEFT:	return pos_x_neighbour_ == true;
-			case BOTTOM:return pos_y_neighbour_ == true;
+			case BACK:	return neg_z_neighbour_ == false;
+			case LEFT:	return neg_x_neighbour_ == false;
+			case BOTTOM:return neg_y_neighbour_ == false;
 		}
 		return false;
 	}
 
-	bool cube_model::is_fully_occluded()
+	bool cube_model::is_fully_occluded() const
 	{
 		return pos_x_neighbour_ && neg_x_neighbour_ 
 			&& pos_y_neighbour_ && neg_y_neighbour_ 
@@ -275,16 +398,64 @@ namespace graphics
 		shader::const_actives_map_iterator tex2d_a_texcoord_it;
 
 		shader::program_object_ptr poly_shader;
-		shader::const_actives_map_iterator poly_u_color_it;
 		shader::const_actives_map_iterator poly_a_position_it;
-		
-		
-		boost::shared_array<GLuint> generic_vbo;
-		const int num_generic_vbo = 2;
+		shader::const_actives_map_iterator poly_a_color_it;
+
+		const float near_plane = 0.1f;
+		const float far_plane = 100.0f;
+
+		// 2D quads wait here until the texture changes, between textured and
+		// untextured quads, or render::flush_2d(), and are drawn together.
+		struct sprite_vertex
+		{
+			GLfloat x, y;
+			GLfloat u, v;
+			GLfloat color[4];
+		};
+		const size_t max_sprite_vertices = 6 * 4096;
+		const size_t sprite_stream_size = 1024 * 1024;
+
+		boost::shared_ptr<stream_buffer> sprite_stream;
+		std::vector<sprite_vertex> sprite_vertices;
+		// Null for untextured quads.
+		const_texture_ptr sprite_texture;
+		bool sprite_textured = false;
+
+		void begin_sprite(const_texture_ptr tex)
+		{
+			const bool textured = tex != NULL;
+			if(!sprite_vertices.empty() && (textured != sprite_textured || sprite_texture != tex
+				|| sprite_vertices.size() >= max_sprite_vertices)) {
+				render::flush_2d();
+			}
+			sprite_texture = tex;
+			sprite_textured = textured;
+		}
+
+		void add_sprite(GLfloat x, GLfloat y, GLfloat w, GLfloat h, const float* color)
+		{
+			// Two triangles, texture coordinates flipped to match the rows
+			// of surfaces.
+			static const GLfloat corners[6][4] = {
+				{ 0, 0, 0, 1 }, { 1, 0, 1, 1 }, { 0, 1, 0, 0 },
+				{ 0, 1, 0, 0 }, { 1, 0, 1, 1 }, { 1, 1, 1, 0 },
+			};
+			for(int n = 0; n != 6; ++n) {
+				sprite_vertex v;
+				v.x = x + corners[n][0] * w;
+				v.y = y + corners[n][1] * h;
+				v.u = corners[n][2];
+				v.v = corners[n][3];
+				for(int c = 0; c != 4; ++c) {
+					v.color[c] = color[c];
+				}
+				sprite_vertices.push_back(v);
+			}
+		}
 	}
 
 	render::render(graphics::window_manager& wm, int w, int h) 
-			: wm_(wm), width_(w), height_(h)
+			: wm_(wm), width_(w), height_(h), occlusion_(NULL)
 	{
 		//view_ = glm::lookAt(glm::vec3(4.0f,3.0f,10.0f), 
 		//	glm::vec3(0.0f, 0.0f, 0.0f), 
@@ -292,6 +463,7 @@ namespace graphics
 		//projection_ = glm::perspective(45.0f, float(w)/float(h), 0.1f, 10.0f);
 		view_ = glm::mat4();
 		projection_ = glm::mat4();
+		set_global_matrices();
 
 		tex2d_shader.reset(new shader::program_object("texture_shader_2d",
 			shader::shader(GL_VERTEX_SHADER, "texture_2d_vert", sys::read_file("data/texture_2d.vert")),
@@ -304,15 +476,19 @@ namespace graphics
 		poly_shader.reset(new shader::program_object("poly_shader_2d",
 			shader::shader(GL_VERTEX_SHADER, "poly_2d_vert", sys::read_file("data/simple_poly.vert")),
 			shader::shader(GL_FRAGMENT_SHADER, "poly_2d_frag", sys::read_file("data/simple_poly.frag"))));
-		poly_u_color_it = poly_shader->get_uniform_iterator("u_color");
 		poly_a_position_it = poly_shader->get_attribute_iterator("a_position");
-		
-		generic_vbo.reset(new GLuint[num_generic_vbo], vbo_deleter(num_generic_vbo));
-		glGenBuffers(num_generic_vbo, generic_vbo.get());
+		poly_a_color_it = poly_shader->get_attribute_iterator("a_color");
+
+		sprite_stream.reset(new stream_buffer(GL_ARRAY_BUFFER, sprite_stream_size));
 	}
 
 	render::~render()
 	{
+		// Leaves nothing for static destruction to free after the context
+		// has gone.
+		sprite_vertices.clear();
+		sprite_texture.reset();
+		sprite_stream.reset();
 	}
 
 	namespace
@@ -339,14 +515,7 @@ namespace graphics
 			get_shader_map()[name] = new_shader;
 
 			cube_shader_object cso;
-			cso.cube_.reset(new cube(new_shader));
-			cso.vm_uniform_it = new_shader->get_uniform_iterator("view_matrix");
-			cso.pm_uniform_it = new_shader->get_uniform_iterator("projection_matrix");
-
-			new_shader->make_active();
-			new_shader->set_uniform(cso.vm_uniform_it, view());
-			new_shader->set_uniform(cso.pm_uniform_it, projection());
-
+			cso.batch_.reset(new cube_batch(new_shader));
 			cube_shader_map_[new_shader] = cso;
 			return new_shader;
 		}
@@ -358,36 +527,15 @@ namespace graphics
 		auto it = cube_shader_map_.find(shader);
 		ASSERT_LOG(it != cube_shader_map_.end(), "render::add_cube() was passed a shader object not created by us.");
 		it->second.cube_draw_list_.push_back(obj);
+		it->second.batch_dirty_ = true;
 	}
 
 	void render::post_process_scene()
 	{
 		for(auto it = cube_shader_map_.begin(); it != cube_shader_map_.end(); ++it) {
-			if(it->second.cube_draw_list_.size() != 0) {
-				it->second.vbo_ = boost::shared_array<GLuint>(new GLuint[3], vbo_deleter(3));				
-
-				std::vector<GLfloat> varray;
-				varray.resize(it->second.cube_draw_list_.size()*6*4*3);
-
-				size_t cnt = 0;
-				for(auto obj = it->second.cube_draw_list_.begin(); 
-					obj != it->second.cube_draw_list_.end(); 
-					++obj, ++cnt) {
-					//cube_face_indexed_varray
-					for(int n = cube_model::FRONT; n <= cube_model::BOTTOM; ++n) {
-						for(int t = 0; t < 4; t++) {
-							glm::vec4 tmp = (*obj)->model() * glm::vec4(cube_face_varray[n][t][0], 
-								cube_face_varray[n][t][1], cube_face_varray[n][t][2], 1.0f);
-							varray[cnt*72+n*12+t*3+0] = tmp.x;
-							varray[cnt*72+n*12+t*3+1] = tmp.y;
-							varray[cnt*72+n*12+t*3+2] = tmp.z;
-						}
-					}
-				}
-				glBindBuffer(GL_ARRAY_BUFFER, it->second.vbo_[0]);
-				glBufferData(GL_ARRAY_BUFFER, sizeof(varray), &varray[0], GL_STATIC_DRAW);
-				glBindBuffer(GL_ARRAY_BUFFER, it->second.vbo_[2]);
-				glBufferData(GL_ARRAY_BUFFER, sizeof(cube_face_tarray), cube_face_tarray, GL_STATIC_DRAW);
+			if(it->second.batch_dirty_ || !it->second.batch_->is_current(it->second.cube_draw_list_)) {
+				it->second.batch_->build(it->second.cube_draw_list_);
+				it->second.batch_dirty_ = false;
 			}
 		}
 	}
@@ -400,32 +548,22 @@ namespace graphics
 
 		for(auto it = cube_shader_map_.begin(); it != cube_shader_map_.end(); ++it) {
 			if(it->second.cube_draw_list_.size() != 0) {
-				it->first->make_active();
-				it->first->set_uniform(it->second.vm_uniform_it, view());
-				it->first->set_uniform(it->second.pm_uniform_it, projection());
-
-				// XXX: todo
-				it->second.cube_->prepare_draw();
-
-				glBindBuffer(GL_ARRAY_BUFFER, it->second.vbo_[0]);
-				glVertexAttribPointer(
-					a_position_it_->second.location, // The attribute we want to configure
-					3,                  // size
-					GL_FLOAT,           // type
-					GL_FALSE,           // normalized?
-					0,  // stride
-					0            // array buffer offset
-				);
-				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-				it->second.cube_->end_draw();
-
-				//it->second.cube_->prepare_draw();
-				//for(auto obj = it->second.cube_draw_list_.begin(); obj != it->second.cube_draw_list_.end(); ++obj) {
-				//	it->second.cube_->draw(*obj);
-				//}
-				//it->second.cube_->end_draw();
+				if(it->second.batch_dirty_) {
+					it->second.batch_->build(it->second.cube_draw_list_);
+					it->second.batch_dirty_ = false;
+				}
+				const cube_batch& batch = *it->second.batch_;
+				if(batch.bounds().empty()) {
+					continue;
+				}
+				const float depth = glm::distance(camera_position_, (batch.bounds().min + batch.bounds().max) * 0.5f);
+				queue_.submit(queue_.opaque_key(it->first->get(), batch.atlas_id(), batch.buffer_id(), depth),
+					boost::bind(&cube_batch::draw, &batch, boost::cref(it->second.cube_draw_list_), occlusion_));
 			}
 		}
+		queue_.flush();
+		// Any 2D still waiting goes over the scene, not under the clear.
+		flush_2d();
 		
 		//draw_rect(rect(-0.5f, -0.5f, 1.0f, 1.0f), color(0, 255, 0));
 	}
@@ -433,76 +571,76 @@ namespace graphics
 	void render::set_view(float fov, const glm::vec3& position, const glm::vec3& direction, const glm::vec3& up)
 	{
 		view_ = glm::lookAt(position, position+direction, up);
-		projection_ = glm::perspective(fov, float(width_)/float(height_), 0.1f, 100.0f);
+		camera_position_ = position;
+		projection_ = glm::perspective(fov, float(width_)/float(height_), near_plane, far_plane);
+		queue_.set_far_distance(far_plane);
+		set_global_matrices();
+	}
+
+	void render::set_global_matrices()
+	{
+		shader::set_global_uniform("view_matrix", view(), 16);
+		shader::set_global_uniform("projection_matrix", projection(), 16);
 	}
 
 	void render::draw_rect(const rect& r, const color& c)
 	{
-		GLfloat vc_array[] = {
-			r.xf(), r.yf(),
-			r.xf()+r.wf(), r.yf(),
-			r.xf(), r.yf()+r.hf(),
-			r.xf()+r.wf(), r.yf()+r.hf(),
-		};
-		poly_shader->make_active();
-		poly_shader->set_uniform(poly_u_color_it, c.as_gl_color());
-
-		glEnableVertexAttribArray(poly_a_position_it->second.location);
-		glBindBuffer(GL_ARRAY_BUFFER, generic_vbo[0]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vc_array), vc_array, GL_DYNAMIC_DRAW);
-		glVertexAttribPointer(poly_a_position_it->second.location, 2, GL_FLOAT, GL_FALSE, 0, 0);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-		glDisableVertexAttribArray(poly_a_position_it->second.location);
+		begin_sprite(const_texture_ptr());
+		add_sprite(r.xf(), r.yf(), r.wf(), r.hf(), c.as_gl_color());
 	}
 
 	void render::blit_2d_texture(const_texture_ptr tex, GLfloat x, GLfloat y)
 	{
-		GLfloat w = 2.0f*tex->width()/width_;
-		GLfloat h = 2.0f*tex->height()/height_;
-		static const GLfloat tc_array[] = {
-			0.0f, 1.0f,
-			1.0f, 1.0f,
-			0.0f, 0.0f,
-			1.0f, 0.0f,
-		};
-		GLfloat vc_array[] = {
-			x, y,
-			x+w, y,
-			x, y+h,
-			x+w, y+h,
-		};
-		tex2d_shader->make_active();
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, tex->id());
-		glUniform1i(tex2d_u_texmap_it->second.location, 0);
-
-		glEnableVertexAttribArray(tex2d_a_position_it->second.location);
-		glBindBuffer(GL_ARRAY_BUFFER, generic_vbo[0]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vc_array), vc_array, GL_DYNAMIC_DRAW);
-		glVertexAttribPointer(
-			tex2d_a_position_it->second.location, // The attribute we want to configure
-			2,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			0					// array buffer offset
-		);
-
-		glEnableVertexAttribArray(tex2d_a_texcoord_it->second.location);
-		glBindBuffer(GL_ARRAY_BUFFER, generic_vbo[1]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(tc_array), tc_array, GL_DYNAMIC_DRAW);
-		glVertexAttribPointer(
-			tex2d_a_texcoord_it->second.location, // The attribute we want to configure
-			2,                            // size : U+V => 2
-			GL_FLOAT,                     // type
-			GL_FALSE,                     // normalized?
-			0,                            // stride
-			0							  // array buffer offset
-		);
-
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-		glDisableVertexAttribArray(tex2d_a_position_it->second.location);
-		glDisableVertexAttribArray(tex2d_a_texcoord_it->second.location);
+		static const float white[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		begin_sprite(tex);
+		add_sprite(x, y, 2.0f*tex->width()/width_, 2.0f*tex->height()/height_, white);
+	}
+
+	void render::flush_2d()
+	{
+		if(sprite_vertices.empty()) {
+			return;
+		}
+		const size_t offset = sprite_stream->write(&sprite_vertices[0], sprite_vertices.size() * sizeof(sprite_vertex));
+		const GLsizei stride = sizeof(sprite_vertex);
+		if(sprite_textured) {
+			tex2d_shader->make_active();
+			state::bind_texture(0, sprite_texture->id());
+			const GLint tex_unit = 0;
+			tex2d_shader->set_uniform(tex2d_u_texmap_it, &tex_unit);
+			state::use_attributes(state::attribute_bit(tex2d_a_position_it->second.location) | state::attribute_bit(tex2d_a_texcoord_it->second.location));
+			glVertexAttribPointer(tex2d_a_position_it->second.location, 2, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+			glVertexAttribPointer(tex2d_a_texcoord_it->second.location, 2, GL_FLOAT, GL_FALSE, stride, (void*)(offset + sizeof(GLfloat)*2));
+		} else {
+			poly_shader->make_active();
+			state::use_attributes(state::attribute_bit(poly_a_position_it->second.location) | state::attribute_bit(poly_a_color_it->second.location));
+			glVertexAttribPointer(poly_a_position_it->second.location, 2, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+			glVertexAttribPointer(poly_a_color_it->second.location, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + sizeof(GLfloat)*4));
+		}
+		glDrawArrays(GL_TRIANGLES, 0, GLsizei(sprite_vertices.size()));
+		sprite_vertices.clear();
+		sprite_texture.reset();
+	}
+}
+
+UNIT_TEST(cube_model_bounds)
+{
+	graphics::cube_model cm;
+	cm.translate(3.0f, -2.0f, 5.0f);
+	cm.rotate(30.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+	const graphics::aabb b = cm.bounds();
+
+	// The bounds should be exactly those of the vertices drawn.
+	graphics::aabb drawn;
+	for(int f = graphics::cube_model::FRONT; f <= graphics::cube_model::BOTTOM; ++f) {
+		for(int t = 0; t != 4; ++t) {
+			const glm::vec4 p = cm.model() * glm::vec4(graphics::cube_face_varray[f][t][0],
+				graphics::cube_face_varray[f][t][1], graphics::cube_face_varray[f][t][2], 1.0f);
+			drawn.add(glm::vec3(p.x, p.y, p.z));
+		}
+	}
+	for(int a = 0; a != 3; ++a) {
+		CHECK_LT(std::abs(b.min[a] - drawn.min[a]), 1e-4f);
+		CHECK_LT(std::abs(b.max[a] - drawn.max[a]), 1e-4f);
 	}
 }
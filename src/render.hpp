@@ -4,9 +4,12 @@
 #include <glm/glm.hpp>
 
 #include "color.hpp"
+#include "frustum.hpp"
 #include "geometry.hpp"
+#include "gl_state.hpp"
 #include "graphics.hpp"
 #include "ref_counted_ptr.hpp"
+#include "render_queue.hpp"
 #include "shaders.hpp"
 #include "texture.hpp"
 #include "wm.hpp"
@@ -20,14 +23,15 @@ namespace graphics
 
 		void operator()(GLuint* d) 
 		{
-			glDeleteBuffers(n_, d);
-			delete [n_] d;
+			state::delete_buffers(n_, d);
+			delete[] d;
 		}
 
 		int n_;
 	};
 
-	class cube;
+	class cube_batch;
+	class occlusion_buffer;
 
 	class cube_model : public reference_counted_ptr
 	{
@@ -46,10 +50,14 @@ namespace graphics
 		void translate(float dx, float dy, float dz);
 		void rotate(float angle, const glm::vec3& axis);
 		glm::mat4& model() const;
+		// World space bounds of the transformed unit cube.
+		aabb bounds() const;
 		GLuint tex_id() const;
+		const_texture_ptr get_texture() const { return tex_; }
+		// Which faces have a solid neighbour, hiding them.
 		void set_neighbourhood(int px, int nx, int py, int ny, int pz, int nz);
-		bool is_fully_occluded();
-		bool should_draw_face(int f);
+		bool is_fully_occluded() const;
+		bool should_draw_face(int f) const;
 	private:
 		mutable glm::mat4 model_;
 		const_texture_ptr tex_;
@@ -76,36 +84,55 @@ namespace graphics
 			const std::string& ffname);
 
 		void add_cube(shader::program_object_ptr shader, cube_model_ptr obj);
+		// Anything drawn with the scene should be submitted here before
+		// draw(), which clears the screen then runs the queue sorted.
+		render_queue& queue() { return queue_; }
 		void draw();
+		// When set, cubes which the buffer reports as hidden aren't drawn. It
+		// should have been filled for the current view before draw() is called.
+		void set_occlusion_buffer(const occlusion_buffer* ob) { occlusion_ = ob; }
+		// Also sets the view_matrix and projection_matrix global uniforms.
 		void set_view(float fov, const glm::vec3& position, const glm::vec3& direction, const glm::vec3& up);
-		const float* view() { return &view_[0][0]; }
-		const float* projection() { return &projection_[0][0]; }
+		const float* view() const { return &view_[0][0]; }
+		const float* projection() const { return &projection_[0][0]; }
+		const glm::vec3& camera_position() const { return camera_position_; }
 		int width() const { return width_; }
 		int height() const { return height_; }
+		// Rebuilds the batches of the shaders whose cubes have been added,
+		// moved or had their neighbours changed since they were last built.
+		// draw() only notices added cubes, so call this after changing any.
 		void post_process_scene();
 
+		// 2D quads are batched while they share a texture, or have none,
+		// and drawn from a streamed vertex buffer when that changes, or
+		// by flush_2d(), which should be called before the frame is shown.
+		// They should be added after draw(), which clears the screen, and
+		// anything still batched when it's called is drawn over the scene.
 		void blit_2d_texture(const_texture_ptr tex, GLfloat x, GLfloat y);
 		static void draw_rect(const rect& r, const color& c);
+		static void flush_2d();
 	protected:
 	private:
+		void set_global_matrices();
+
 		int width_;
 		int height_;
 
 		glm::mat4 view_;
 		glm::mat4 projection_;
+		glm::vec3 camera_position_;
+		const occlusion_buffer* occlusion_;
+		render_queue queue_;
 
 		graphics::window_manager& wm_;
 
 		struct cube_shader_object
 		{
-			boost::shared_ptr<cube> cube_;
-			shader::const_actives_map_iterator vm_uniform_it;
-			shader::const_actives_map_iterator pm_uniform_it;
-			shader::const_actives_map_iterator a_position_it_;
-			shader::const_actives_map_iterator a_tex_coord_it_;
+			cube_shader_object() : batch_dirty_(false)
+			{}
+			boost::shared_ptr<cube_batch> batch_;
 			std::vector<cube_model_ptr> cube_draw_list_;
-
-			boost::shared_array<GLuint> vbo_;
+			bool batch_dirty_;
 		};
 		std::map<shader::program_object_ptr, cube_shader_object> cube_shader_map_;
 	};
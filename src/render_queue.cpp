@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cstdlib>
+#include <boost/bind.hpp>
+
+#include "asserts.hpp"
+#include "render_queue.hpp"
+#include "unit_test.hpp"
+
+namespace graphics
+{
+	namespace
+	{
+		const int pass_shift = 62;
+		const int state_bits = 12;
+		const uint64_t state_mask = (uint64_t(1) << state_bits) - 1;
+		const int depth_bits = 26;
+		const uint64_t depth_mask = (uint64_t(1) << depth_bits) - 1;
+
+		uint64_t state_key(GLuint shader, GLuint texture, GLuint buffer)
+		{
+			return (uint64_t(shader) & state_mask) << (state_bits * 2)
+				| (uint64_t(texture) & state_mask) << state_bits
+				| (uint64_t(buffer) & state_mask);
+		}
+	}
+
+	void radix_sort(std::vector<sort_item>& items, std::vector<sort_item>& scratch)
+	{
+		const size_t n = items.size();
+		if(n < 2) {
+			return;
+		}
+		// Every byte's histogram from one pass over the keys.
+		size_t counts[8][256] = {};
+		for(size_t i = 0; i != n; ++i) {
+			const uint64_t key = items[i].key;
+			for(int b = 0; b != 8; ++b) {
+				++counts[b][(key >> (b * 8)) & 0xff];
+			}
+		}
+		scratch.resize(n);
+		for(int b = 0; b != 8; ++b) {
+			size_t* count = counts[b];
+			if(count[(items[0].key >> (b * 8)) & 0xff] == n) {
+				continue;
+			}
+			size_t offset = 0;
+			for(int d = 0; d != 256; ++d) {
+				const size_t c = count[d];
+				count[d] = offset;
+				offset += c;
+			}
+			for(size_t i = 0; i != n; ++i) {
+				scratch[count[(items[i].key >> (b * 8)) & 0xff]++] = items[i];
+			}
+			items.swap(scratch);
+		}
+	}
+
+	render_queue::render_queue()
+		: far_distance_(100.0f), overlay_order_(0), last_flushed_(0)
+	{
+	}
+
+	uint64_t render_queue::quantise_depth(float depth) const
+	{
+		const float d = std::min(std::max(depth / far_distance_, 0.0f), 1.0f);
+		return uint64_t(d * float(depth_mask)) & depth_mask;
+	}
+
+	uint64_t render_queue::opaque_key(GLuint shader, GLuint texture, GLuint buffer, float depth) const
+	{
+		return uint64_t(OPAQUE_PASS) << pass_shift
+			| state_key(shader, texture, buffer) << depth_bits
+			| quantise_depth(depth);
+	}
+
+	uint64_t render_queue::translucent_key(GLuint shader, GLuint texture, GLuint buffer, float depth) const
+	{
+		return uint64_t(TRANSLUCENT_PASS) << pass_shift
+			| (depth_mask - quantise_depth(depth)) << (state_bits * 3)
+			| state_key(shader, texture, buffer);
+	}
+
+	uint64_t render_queue::overlay_key(GLuint shader, GLuint texture, GLuint buffer)
+	{
+		return uint64_t(OVERLAY_PASS) << pass_shift
+			| (uint64_t(overlay_order_++) & depth_mask) << (state_bits * 3)
+			| state_key(shader, texture, buffer);
+	}
+
+	void render_queue::submit(uint64_t key, const command& cmd)
+	{
+		const sort_item item = { key, uint32_t(commands_.size()) };
+		items_.push_back(item);
+		commands_.push_back(cmd);
+	}
+
+	void render_queue::flush()
+	{
+		radix_sort(items_, scratch_);
+		for(auto it = items_.begin(); it != items_.end(); ++it) {
+			commands_[it->index]();
+		}
+		last_flushed_ = items_.size();
+		items_.clear();
+		commands_.clear();
+		overlay_order_ = 0;
+	}
+}
+
+namespace
+{
+	bool key_less(const graphics::sort_item& a, const graphics::sort_item& b)
+	{
+		return a.key < b.key;
+	}
+
+	void push_order(std::vector<int>* order, int n)
+	{
+		order->push_back(n);
+	}
+
+	void random_items(std::vector<graphics::sort_item>& items, size_t n, int seed)
+	{
+		srand(seed);
+		items.resize(n);
+		for(size_t i = 0; i != n; ++i) {
+			// Few distinct values in some bytes, so equal keys and skipped
+			// bytes both turn up.
+			items[i].key = uint64_t(rand() & 3) << 62 | uint64_t(rand() & 0xfff) << 26 | uint64_t(rand() % 50);
+			items[i].index = uint32_t(i);
+		}
+	}
+}
+
+UNIT_TEST(render_queue)
+{
+	std::vector<graphics::sort_item> items, expected, scratch;
+	random_items(items, 5000, 1);
+	expected = items;
+	std::stable_sort(expected.begin(), expected.end(), key_less);
+	graphics::radix_sort(items, scratch);
+	for(size_t i = 0; i != items.size(); ++i) {
+		CHECK_EQ(items[i].key, expected[i].key);
+		CHECK_EQ(items[i].index, expected[i].index);
+	}
+
+	graphics::render_queue q;
+	q.set_far_distance(100.0f);
+	// Opaque sorts by state then near to far, translucent far to near after
+	// every opaque, overlays last in the order given.
+	const uint64_t overlay = q.overlay_key(1, 1, 1);
+	CHECK_LT(q.opaque_key(1, 2, 3, 10.0f), q.opaque_key(1, 2, 3, 20.0f));
+	CHECK_LT(q.opaque_key(1, 2, 3, 90.0f), q.opaque_key(2, 0, 0, 0.0f));
+	CHECK_LT(q.opaque_key(9, 9, 9, 500.0f), q.translucent_key(0, 0, 0, 0.0f));
+	CHECK_LT(q.translucent_key(5, 0, 0, 50.0f), q.translucent_key(1, 0, 0, 10.0f));
+	CHECK_LT(q.translucent_key(0, 0, 0, 0.0f), overlay);
+	CHECK_LT(overlay, q.overlay_key(0, 0, 0));
+
+	std::vector<int> order;
+	q.submit(q.overlay_key(0, 0, 0), boost::bind(push_order, &order, 4));
+	q.submit(q.translucent_key(0, 0, 0, 5.0f), boost::bind(push_order, &order, 3));
+	q.submit(q.opaque_key(1, 0, 0, 5.0f), boost::bind(push_order, &order, 1));
+	q.submit(q.translucent_key(0, 0, 0, 50.0f), boost::bind(push_order, &order, 2));
+	q.submit(q.opaque_key(0, 0, 0, 50.0f), boost::bind(push_order, &order, 0));
+	q.flush();
+	CHECK_EQ(order.size(), 5);
+	for(int n = 0; n != 5; ++n) {
+		CHECK_EQ(order[n], n);
+	}
+	CHECK_EQ(q.size(), 0);
+	CHECK_EQ(q.last_flushed(), 5);
+}
+
+BENCHMARK(render_queue_sort)
+{
+	std::vector<graphics::sort_item> source, items, scratch;
+	random_items(source, 100000, 2);
+	BENCHMARK_LOOP {
+		items = source;
+		graphics::radix_sort(items, scratch);
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <boost/function.hpp>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+	struct sort_item
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	// Stable least significant digit radix sort by key, a byte at a time,
+	// skipping the bytes every key has the same. scratch is working space,
+	// kept by the caller so it needn't be allocated each time.
+	void radix_sort(std::vector<sort_item>& items, std::vector<sort_item>& scratch);
+
+	// Draw commands submitted in any order with a 64 bit key, then sorted
+	// and run in key order. Keys hold, from the top bit down:
+	//   opaque:      pass, shader, texture, buffer, depth
+	//   translucent: pass, far to near depth, shader, texture, buffer
+	//   overlay:     pass, submission order, shader, texture, buffer
+	// so opaque draws are grouped by state and go front to back within each
+	// group, translucent ones go back to front and overlays are drawn last
+	// in the order given. GL names are cut down to fit, which only costs
+	// some grouping when they collide.
+	class render_queue
+	{
+	public:
+		enum pass
+		{
+			OPAQUE_PASS,
+			TRANSLUCENT_PASS,
+			OVERLAY_PASS,
+		};
+		typedef boost::function<void()> command;
+
+		render_queue();
+
+		// Depths are distances from the camera, those beyond far all sorting
+		// the same.
+		void set_far_distance(float far_distance) { far_distance_ = far_distance; }
+
+		uint64_t opaque_key(GLuint shader, GLuint texture, GLuint buffer, float depth) const;
+		uint64_t translucent_key(GLuint shader, GLuint texture, GLuint buffer, float depth) const;
+		uint64_t overlay_key(GLuint shader, GLuint texture, GLuint buffer);
+
+		void submit(uint64_t key, const command& cmd);
+		// Sorts and runs everything submitted since the last flush.
+		void flush();
+
+		size_t size() const { return commands_.size(); }
+		// Commands run by the last flush().
+		size_t last_flushed() const { return last_flushed_; }
+	private:
+		uint64_t quantise_depth(float depth) const;
+
+		std::vector<command> commands_;
+		std::vector<sort_item> items_;
+		std::vector<sort_item> scratch_;
+		float far_distance_;
+		uint32_t overlay_order_;
+		size_t last_flushed_;
+
+		render_queue(const render_queue&);
+	};
+}
@@ -1,6 +1,8 @@
+#include <cstring>
 #include <vector>
 
 #include "asserts.hpp"
+#include "gl_state.hpp"
 #include "shaders.hpp"
 
 namespace shader
@@ -46,11 +48,80 @@ namespace shader
 		return true;
 	}
 
+	namespace
+	{
+		struct global_uniform
+		{
+			std::string name;
+			std::vector<GLfloat> value;
+			// global_version when last set.
+			unsigned version;
+		};
+
+		std::vector<global_uniform>& global_uniforms()
+		{
+			static std::vector<global_uniform> res;
+			return res;
+		}
+
+		// Bumped each time a global uniform is set, so programs which have
+		// seen the latest version can skip looking through them.
+		unsigned global_version = 0;
+
+		// Values the set_uniform() call for the uniform uploads.
+		size_t uniform_components(const actives& u)
+		{
+			switch(u.type) {
+			case GL_FLOAT:
+			case GL_INT:
+			case GL_BOOL:
+			case GL_SAMPLER_2D:
+			case GL_SAMPLER_CUBE:
+				return 1;
+			case GL_INT_VEC2:
+			case GL_BOOL_VEC2:
+				return 2;
+			case GL_FLOAT_VEC2:		return 2 * u.num_elements;
+			case GL_INT_VEC3:
+			case GL_BOOL_VEC3:
+			case GL_FLOAT_VEC3:		return 3 * u.num_elements;
+			case GL_INT_VEC4:
+			case GL_BOOL_VEC4:
+			case GL_FLOAT_VEC4:
+			case GL_FLOAT_MAT2:		return 4 * u.num_elements;
+			case GL_FLOAT_MAT3:		return 9 * u.num_elements;
+			case GL_FLOAT_MAT4:		return 16 * u.num_elements;
+			}
+			return 0;
+		}
+	}
+
+	void set_global_uniform(const std::string& name, const GLfloat* value, size_t count)
+	{
+		std::vector<global_uniform>& globals = global_uniforms();
+		auto it = globals.begin();
+		while(it != globals.end() && it->name != name) {
+			++it;
+		}
+		if(it == globals.end()) {
+			global_uniform g;
+			g.name = name;
+			g.version = 0;
+			it = globals.insert(globals.end(), g);
+		} else if(it->value.size() == count && std::equal(value, value + count, it->value.begin())) {
+			return;
+		}
+		it->value.assign(value, value + count);
+		it->version = ++global_version;
+	}
+
 	program_object::program_object()
+		: object_(0), globals_checked_(0), global_version_(0)
 	{
 	}
 
 	program_object::program_object(const std::string& name, const shader& vs, const shader& fs)
+		: object_(0), globals_checked_(0), global_version_(0)
 	{
 		init(name, vs, fs);
 	}
@@ -94,7 +165,7 @@ namespace shader
 	bool program_object::link()
 	{
 		if(object_) {
-			glDeleteProgram(object_);
+			graphics::state::delete_program(object_);
 			object_ = 0;
 		}
 		object_ = glCreateProgram();
@@ -114,7 +185,7 @@ namespace shader
 				std::string s(info_log.begin(), info_log.end());
 				std::cerr << "Error linking object: " << s << std::endl;
 			}
-			glDeleteProgram(object_);
+			graphics::state::delete_program(object_);
 			object_ = 0;
 			return false;
 		}
@@ -124,6 +195,10 @@ namespace shader
 
 	bool program_object::queryUniforms()
 	{
+		shadows_.clear();
+		globals_.clear();
+		globals_checked_ = 0;
+		global_version_ = 0;
 		GLint active_uniforms;
 		glGetProgramiv(object_, GL_ACTIVE_UNIFORMS, &active_uniforms);
 		GLint uniform_max_len;
@@ -137,6 +212,11 @@ namespace shader
 			u.name = std::string(&name[0], &name[size]);
 			u.location = glGetUniformLocation(object_, u.name.c_str());
 			ASSERT_LOG(u.location >= 0, "Unable to determine the location of the uniform: " << u.name);
+			u.shadow = int(shadows_.size());
+			uniform_shadow shadow;
+			shadow.value.resize(uniform_components(u) * 4);
+			shadow.valid = false;
+			shadows_.push_back(shadow);
 			uniforms_[u.name] = u;
 		}
 		return true;
@@ -157,6 +237,7 @@ namespace shader
 			a.name = std::string(&name[0], &name[size]);
 			a.location = glGetAttribLocation(object_, a.name.c_str());
 			ASSERT_LOG(a.location >= 0, "Unable to determine the location of the attribute: " << a.name);
+			a.shadow = -1;
 			attribs_[a.name] = a;
 		}
 		return true;
@@ -164,13 +245,54 @@ namespace shader
 
 	void program_object::make_active()
 	{
-		glUseProgram(object_);
+		graphics::state::use_program(object_);
+		if(global_version_ != global_version) {
+			update_globals();
+		}
+	}
+
+	void program_object::update_globals()
+	{
+		const std::vector<global_uniform>& globals = global_uniforms();
+		for(; globals_checked_ != globals.size(); ++globals_checked_) {
+			const_actives_map_iterator it = uniforms_.find(globals[globals_checked_].name);
+			if(it != uniforms_.end()) {
+				globals_.push_back(std::make_pair(globals_checked_, it));
+			}
+		}
+		for(auto it = globals_.begin(); it != globals_.end(); ++it) {
+			const global_uniform& g = globals[it->first];
+			if(g.version > global_version_) {
+				ASSERT_LOG(g.value.size() >= uniform_components(it->second->second), "Global uniform " << g.name << " has too few values for program " << name_);
+				set_uniform(it->second, &g.value[0]);
+			}
+		}
+		global_version_ = global_version;
+	}
+
+	bool program_object::unchanged(const actives& u, const void* value)
+	{
+		uniform_shadow& shadow = shadows_[u.shadow];
+		if(shadow.value.empty()) {
+			return false;
+		}
+		if(shadow.valid && std::memcmp(&shadow.value[0], value, shadow.value.size()) == 0) {
+			graphics::state::record_call(true);
+			return true;
+		}
+		std::memcpy(&shadow.value[0], value, shadow.value.size());
+		shadow.valid = true;
+		graphics::state::record_call(false);
+		return false;
 	}
 
 	void program_object::set_uniform(const_actives_map_iterator it, const GLint* value)
 	{
 		const actives& u = it->second;
 		ASSERT_LOG(value != NULL, "set_uniform(): value is NULL");
+		if(unchanged(u, value)) {
+			return;
+		}
 		switch(u.type) {
 		case GL_INT:
 		case GL_BOOL:
@@ -199,6 +321,9 @@ namespace shader
 	{
 		const actives& u = it->second;
 		ASSERT_LOG(value != NULL, "set_uniform(): value is NULL");
+		if(unchanged(u, value)) {
+			return;
+		}
 		switch(u.type) {
 		case GL_FLOAT: {
 			glUniform1f(u.location, *value);
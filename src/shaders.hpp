@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "graphics.hpp"
 #include "ref_counted_ptr.hpp"
@@ -36,6 +38,9 @@ namespace shader
 		GLsizei num_elements;
 		// Location of the active uniform/attribute
 		GLint location;
+		// Index of the uniform's shadow copy in its program, -1 for
+		// attributes.
+		int shadow;
 	};
 
 	typedef std::map<std::string, actives> actives_map;
@@ -51,14 +56,19 @@ namespace shader
 		{}
 		void init(const std::string& name, const shader& vs, const shader& fs);
 		std::string name() const { return name_; }
+		GLuint get() const { return object_; }
 		GLuint get_attribute(const std::string& attr) const;
 		GLuint get_uniform(const std::string& attr) const;
 		const_actives_map_iterator get_attribute_iterator(const std::string& attr) const;
 		const_actives_map_iterator get_uniform_iterator(const std::string& attr) const;
 
+		// The program must be active. Values the same as the last set are
+		// skipped.
 		void set_uniform(const_actives_map_iterator it, const GLfloat*);
 		void set_uniform(const_actives_map_iterator it, const GLint*);
 
+		// Also uploads any global uniforms the program has which have been
+		// set since it was last made active.
 		void make_active();
 	protected:
 		bool link();
@@ -73,8 +83,31 @@ namespace shader
 		GLuint object_;
 		actives_map attribs_;
 		actives_map uniforms_;
+
+		// Returns true if value matches the last uploaded to the uniform,
+		// otherwise keeps it for next time.
+		bool unchanged(const actives& u, const void* value);
+		void update_globals();
+
+		struct uniform_shadow
+		{
+			std::vector<uint8_t> value;
+			bool valid;
+		};
+		std::vector<uniform_shadow> shadows_;
+		// Global uniforms this program has, by their index, and how many
+		// globals have been looked for.
+		std::vector<std::pair<size_t, const_actives_map_iterator> > globals_;
+		size_t globals_checked_;
+		// Global version when the globals were last uploaded.
+		unsigned global_version_;
 	};
 
 	typedef boost::intrusive_ptr<program_object> program_object_ptr;
 	typedef boost::intrusive_ptr<const program_object> const_program_object_ptr;
+
+	// Sets a uniform for every program with one of the name, such as the
+	// view and projection matrices or the time. Each program uploads it
+	// when next made active, and only if it has changed since.
+	void set_global_uniform(const std::string& name, const GLfloat* value, size_t count);
 }
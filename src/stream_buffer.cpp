@@ -0,0 +1,53 @@
+#include "asserts.hpp"
+#include "gl_state.hpp"
+#include "stream_buffer.hpp"
+
+namespace graphics
+{
+	namespace
+	{
+		// Writes start on a boundary the attribute pointers into them are
+		// happy with.
+		const size_t write_alignment = 16;
+	}
+
+	stream_buffer::stream_buffer(GLenum target, size_t size)
+		: target_(target), buffer_(0), size_(size), used_(0), orphans_(0)
+	{
+		ASSERT_LOG(size > 0, "stream_buffer: size must be greater than zero.");
+		glGenBuffers(1, &buffer_);
+		state::bind_buffer(target_, buffer_);
+		glBufferData(target_, size_, NULL, GL_STREAM_DRAW);
+	}
+
+	stream_buffer::~stream_buffer()
+	{
+		state::delete_buffers(1, &buffer_);
+	}
+
+	void stream_buffer::orphan()
+	{
+		glBufferData(target_, size_, NULL, GL_STREAM_DRAW);
+		used_ = 0;
+		++orphans_;
+	}
+
+	size_t stream_buffer::write(const void* data, size_t bytes)
+	{
+		state::bind_buffer(target_, buffer_);
+		if(bytes > size_) {
+			while(size_ < bytes) {
+				size_ *= 2;
+			}
+			orphan();
+		}
+		size_t offset = (used_ + write_alignment - 1) & ~(write_alignment - 1);
+		if(offset + bytes > size_) {
+			orphan();
+			offset = 0;
+		}
+		glBufferSubData(target_, offset, bytes, data);
+		used_ = offset + bytes;
+		return offset;
+	}
+}
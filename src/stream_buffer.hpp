@@ -0,0 +1,41 @@
+#pragma once
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+	// A large GL buffer filled front to back with data which is drawn once,
+	// such as vertices built each frame. When data won't fit in what's
+	// left, the buffer is orphaned, respecified without data so the driver
+	// can hand over fresh storage instead of waiting for draws still
+	// reading the old, and filling starts again from the front.
+	class stream_buffer
+	{
+	public:
+		// target is GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER.
+		stream_buffer(GLenum target, size_t size);
+		virtual ~stream_buffer();
+
+		// Copies bytes of data into the buffer, leaving it bound, and
+		// returns the offset written to. The buffer grows if it's smaller
+		// than bytes.
+		size_t write(const void* data, size_t bytes);
+
+		GLuint id() const { return buffer_; }
+		size_t size() const { return size_; }
+		// Times the buffer has been orphaned, a rough measure of how many
+		// times over it's been filled.
+		size_t orphans() const { return orphans_; }
+	private:
+		void orphan();
+
+		GLenum target_;
+		GLuint buffer_;
+		size_t size_;
+		size_t used_;
+		size_t orphans_;
+
+		stream_buffer();
+		stream_buffer(const stream_buffer&);
+	};
+}
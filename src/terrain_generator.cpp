@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_GENERATOR_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "asserts.hpp"
+#include "terrain_generator.hpp"
+#include "unit_test.hpp"
+
+namespace cube
+{
+	namespace
+	{
+		// Each octave is a different noise field.
+		inline uint32_t octave_seed(uint32_t seed, int octave)
+		{
+			return seed + uint32_t(octave) * 0x9e3779b9u;
+		}
+
+		inline uint32_t hash(int ix, int iz, uint32_t seed)
+		{
+			uint32_t h = (uint32_t(ix) * 0x8da6b343u) ^ (uint32_t(iz) * 0xd8163841u) ^ (seed * 0xcb1ab31fu);
+			h ^= h >> 15;
+			h *= 0x2c1b3c6du;
+			h ^= h >> 12;
+			return h;
+		}
+
+		// Dot product with one of the four diagonal gradients picked by h.
+		inline float grad(uint32_t h, float dx, float dz)
+		{
+			return ((h & 1) ? -dx : dx) + ((h & 2) ? -dz : dz);
+		}
+
+		inline float fade(float t)
+		{
+			return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+		}
+
+		inline float clamp_unit(float v)
+		{
+			return std::min(1.0f, std::max(-1.0f, v));
+		}
+
+#ifdef TERRAIN_GENERATOR_USE_SSE2
+		// SSE2 has no 32-bit multiply keeping the low half.
+		inline __m128i mullo_epi32(__m128i a, __m128i b)
+		{
+			const __m128i even = _mm_mul_epu32(a, b);
+			const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+			return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+		}
+
+		// The same operations as the scalar versions, four lanes at once, so
+		// the results are identical.
+		inline __m128i hash4(__m128i ix, __m128i iz, uint32_t seed)
+		{
+			__m128i h = _mm_xor_si128(mullo_epi32(ix, _mm_set1_epi32(int(0x8da6b343u))),
+				_mm_xor_si128(mullo_epi32(iz, _mm_set1_epi32(int(0xd8163841u))), _mm_set1_epi32(int(seed * 0xcb1ab31fu))));
+			h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+			h = mullo_epi32(h, _mm_set1_epi32(0x2c1b3c6d));
+			return _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+		}
+
+		inline __m128 grad4(__m128i h, __m128 dx, __m128 dz)
+		{
+			const __m128i one = _mm_set1_epi32(1);
+			const __m128 sx = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, one), 31));
+			const __m128 sz = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(h, 1), one), 31));
+			return _mm_add_ps(_mm_xor_ps(dx, sx), _mm_xor_ps(dz, sz));
+		}
+
+		inline __m128 fade4(__m128 t)
+		{
+			const __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+			return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+		}
+
+		inline __m128 floor4(__m128 v)
+		{
+			const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+			return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+		}
+
+		inline __m128 gradient_noise4(__m128 x, __m128 z, uint32_t seed)
+		{
+			const __m128 fx0 = floor4(x), fz0 = floor4(z);
+			const __m128i ix = _mm_cvttps_epi32(fx0), iz = _mm_cvttps_epi32(fz0);
+			const __m128i ix1 = _mm_add_epi32(ix, _mm_set1_epi32(1)), iz1 = _mm_add_epi32(iz, _mm_set1_epi32(1));
+			const __m128 dx = _mm_sub_ps(x, fx0), dz = _mm_sub_ps(z, fz0);
+			const __m128 dx1 = _mm_sub_ps(dx, _mm_set1_ps(1.0f)), dz1 = _mm_sub_ps(dz, _mm_set1_ps(1.0f));
+			const __m128 u = fade4(dx), v = fade4(dz);
+			const __m128 n00 = grad4(hash4(ix, iz, seed), dx, dz);
+			const __m128 n10 = grad4(hash4(ix1, iz, seed), dx1, dz);
+			const __m128 n01 = grad4(hash4(ix, iz1, seed), dx, dz1);
+			const __m128 n11 = grad4(hash4(ix1, iz1, seed), dx1, dz1);
+			const __m128 a = _mm_add_ps(n00, _mm_mul_ps(u, _mm_sub_ps(n10, n00)));
+			const __m128 b = _mm_add_ps(n01, _mm_mul_ps(u, _mm_sub_ps(n11, n01)));
+			return _mm_add_ps(a, _mm_mul_ps(v, _mm_sub_ps(b, a)));
+		}
+#endif
+	}
+
+	terrain_params::terrain_params()
+		: seed(1), frequency(1.0f / 256.0f), octaves(5), persistence(0.5f), lacunarity(2.0f),
+		base_height(64), amplitude(48), block(1), surface_block(1), surface_depth(1)
+	{
+	}
+
+	terrain_params::terrain_params(const node::node& n)
+		: seed(1), frequency(1.0f / 256.0f), octaves(5), persistence(0.5f), lacunarity(2.0f),
+		base_height(64), amplitude(48), block(1), surface_block(1), surface_depth(1)
+	{
+		if(n.has_key("seed")) {
+			seed = uint32_t(n["seed"].as_int());
+		}
+		if(n.has_key("frequency")) {
+			frequency = n["frequency"].as_float();
+		}
+		if(n.has_key("octaves")) {
+			octaves = int(n["octaves"].as_int());
+		}
+		if(n.has_key("persistence")) {
+			persistence = n["persistence"].as_float();
+		}
+		if(n.has_key("lacunarity")) {
+			lacunarity = n["lacunarity"].as_float();
+		}
+		if(n.has_key("base_height")) {
+			base_height = int(n["base_height"].as_int());
+		}
+		if(n.has_key("amplitude")) {
+			amplitude = int(n["amplitude"].as_int());
+		}
+		if(n.has_key("block")) {
+			block = block_id(n["block"].as_int());
+		}
+		if(n.has_key("surface_block")) {
+			surface_block = block_id(n["surface_block"].as_int());
+		}
+		if(n.has_key("surface_depth")) {
+			surface_depth = int(n["surface_depth"].as_int());
+		}
+	}
+
+	float gradient_noise(float x, float z, uint32_t seed)
+	{
+		const float fx0 = std::floor(x), fz0 = std::floor(z);
+		const int ix = int(fx0), iz = int(fz0);
+		const float dx = x - fx0, dz = z - fz0;
+		const float dx1 = dx - 1.0f, dz1 = dz - 1.0f;
+		const float u = fade(dx), v = fade(dz);
+		const float n00 = grad(hash(ix, iz, seed), dx, dz);
+		const float n10 = grad(hash(ix + 1, iz, seed), dx1, dz);
+		const float n01 = grad(hash(ix, iz + 1, seed), dx, dz1);
+		const float n11 = grad(hash(ix + 1, iz + 1, seed), dx1, dz1);
+		const float a = n00 + u * (n10 - n00);
+		const float b = n01 + u * (n11 - n01);
+		return a + v * (b - a);
+	}
+
+	terrain_generator::terrain_generator(const terrain_params& p)
+		: params_(p), weight_sum_(0.0f)
+	{
+		ASSERT_LOG(p.octaves > 0 && p.frequency > 0.0f && p.amplitude >= 0 && p.surface_depth >= 0,
+			"terrain_generator: bad parameters, octaves " << p.octaves << ", frequency " << p.frequency
+			<< ", amplitude " << p.amplitude << ", surface_depth " << p.surface_depth);
+		float w = 1.0f;
+		for(int o = 0; o != p.octaves; ++o) {
+			weight_sum_ += w;
+			w *= p.persistence;
+		}
+	}
+
+	terrain_generator::~terrain_generator()
+	{
+	}
+
+	int terrain_generator::surface_height(int x, int z) const
+	{
+		float sum = 0.0f, f = params_.frequency, w = 1.0f;
+		for(int o = 0; o != params_.octaves; ++o) {
+			sum += w * gradient_noise(float(x) * f, float(z) * f, octave_seed(params_.seed, o));
+			f *= params_.lacunarity;
+			w *= params_.persistence;
+		}
+		return params_.base_height + int(std::floor(float(params_.amplitude) * clamp_unit(sum / weight_sum_)));
+	}
+
+	void terrain_generator::chunk_heights(int cx, int cz, int* heights) const
+	{
+		const int x0 = cx * chunk_size, z0 = cz * chunk_size;
+#ifdef TERRAIN_GENERATOR_USE_SSE2
+		const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		const __m128 amplitude = _mm_set1_ps(float(params_.amplitude));
+		const __m128 weight_sum = _mm_set1_ps(weight_sum_);
+		for(int z = 0; z != chunk_size; ++z) {
+			for(int x = 0; x != chunk_size; x += 4) {
+				const __m128 wx = _mm_add_ps(_mm_set1_ps(float(x0 + x)), lane);
+				const __m128 wz = _mm_set1_ps(float(z0 + z));
+				__m128 sum = _mm_setzero_ps();
+				float f = params_.frequency, w = 1.0f;
+				for(int o = 0; o != params_.octaves; ++o) {
+					const __m128 vf = _mm_set1_ps(f);
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w),
+						gradient_noise4(_mm_mul_ps(wx, vf), _mm_mul_ps(wz, vf), octave_seed(params_.seed, o))));
+					f *= params_.lacunarity;
+					w *= params_.persistence;
+				}
+				const __m128 n = _mm_min_ps(_mm_set1_ps(1.0f), _mm_max_ps(_mm_set1_ps(-1.0f), _mm_div_ps(sum, weight_sum)));
+				const __m128i h = _mm_add_epi32(_mm_set1_epi32(params_.base_height), _mm_cvttps_epi32(floor4(_mm_mul_ps(amplitude, n))));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(heights + z * chunk_size + x), h);
+			}
+		}
+#else
+		for(int z = 0; z != chunk_size; ++z) {
+			for(int x = 0; x != chunk_size; ++x) {
+				heights[z * chunk_size + x] = surface_height(x0 + x, z0 + z);
+			}
+		}
+#endif
+	}
+
+	chunk_ptr terrain_generator::load_chunk(int cx, int cy, int cz)
+	{
+		// The surface lies within amplitude of base_height, so chunks well
+		// above or below it need no noise at all.
+		const int y0 = cy * chunk_size;
+		if(y0 >= params_.base_height + params_.amplitude) {
+			return chunk_ptr();
+		}
+		if(y0 + chunk_size <= params_.base_height - params_.amplitude - params_.surface_depth) {
+			return chunk_ptr(new chunk(cx, cy, cz, params_.block));
+		}
+
+		int heights[chunk_area];
+		chunk_heights(cx, cz, heights);
+		if(*std::max_element(heights, heights + chunk_area) <= y0) {
+			return chunk_ptr();
+		}
+		chunk_ptr c(new chunk(cx, cy, cz));
+		// Layers below every column's surface blocks are filled in one go.
+		const int solid = std::max(0, std::min(*std::min_element(heights, heights + chunk_area) - y0 - params_.surface_depth, chunk_size));
+		c->fill_range(0, chunk::index(0, solid, 0), params_.block);
+		for(int z = 0; z != chunk_size; ++z) {
+			for(int x = 0; x != chunk_size; ++x) {
+				const int h = heights[z * chunk_size + x] - y0;
+				const int top = std::max(0, std::min(h, chunk_size));
+				const int surface = std::max(0, std::min(h - params_.surface_depth, chunk_size));
+				if(surface > solid) {
+					c->fill_column(x, z, solid, surface, params_.block);
+				}
+				if(top > surface) {
+					c->fill_column(x, z, surface, top, params_.surface_block);
+				}
+			}
+		}
+		c->compact();
+		return c;
+	}
+
+	void terrain_generator::chunk_keys(std::vector<uint64_t>&)
+	{
+		// An unbounded generator has no finite list of keys to append.
+	}
+}
+
+UNIT_TEST(terrain_generator)
+{
+	// Noise is zero at lattice points and stays in range.
+	CHECK_EQ(cube::gradient_noise(3.0f, -7.0f, 5), 0.0f);
+	for(int n = 0; n != 1000; ++n) {
+		const float v = cube::gradient_noise(n * 0.37f - 100.0f, n * 0.11f, 9);
+		CHECK_LE(std::abs(v), 1.0f);
+	}
+
+	cube::terrain_params p;
+	p.seed = 1234;
+	p.surface_block = 2;
+	p.surface_depth = 3;
+	cube::terrain_generator gen(p);
+
+	// Chunk heights, vectorised or not, match the per column ones.
+	int heights[cube::chunk_area];
+	gen.chunk_heights(-3, 2, heights);
+	for(int z = 0; z != cube::chunk_size; ++z) {
+		for(int x = 0; x != cube::chunk_size; ++x) {
+			CHECK_EQ(heights[z * cube::chunk_size + x], gen.surface_height(-3 * cube::chunk_size + x, 2 * cube::chunk_size + z));
+		}
+	}
+
+	// Chunks across the surface line up with the heights, and the same seed
+	// generates the same chunks.
+	cube::terrain_generator again(p);
+	for(int cy = 0; cy != 4; ++cy) {
+		cube::chunk_ptr c = gen.load_chunk(-3, cy, 2);
+		cube::chunk_ptr d = again.load_chunk(-3, cy, 2);
+		CHECK_EQ(c == NULL, d == NULL);
+		for(int z = 0; z != cube::chunk_size && c; ++z) {
+			for(int x = 0; x != cube::chunk_size; ++x) {
+				const int h = heights[z * cube::chunk_size + x];
+				for(int y = 0; y != cube::chunk_size; ++y) {
+					const int wy = cy * cube::chunk_size + y;
+					const cube::block_id expected = wy >= h ? cube::empty_block : (wy >= h - 3 ? 2 : 1);
+					CHECK_EQ(c->get(x, y, z), expected);
+					CHECK_EQ(d->get(x, y, z), expected);
+				}
+			}
+		}
+	}
+	CHECK_EQ(gen.load_chunk(0, 4, 0) == NULL, true);
+	CHECK_EQ(gen.load_chunk(0, -1, 0)->is_uniform(), true);
+
+	// A different seed gives different terrain.
+	p.seed = 4321;
+	cube::terrain_generator other(p);
+	int other_heights[cube::chunk_area];
+	other.chunk_heights(-3, 2, other_heights);
+	CHECK_EQ(std::equal(heights, heights + cube::chunk_area, other_heights), false);
+}
+
+// One chunk column at a time, as chunk_heights() would without SSE2.
+BENCHMARK(cube_terrain_heights_scalar)
+{
+	cube::terrain_generator gen((cube::terrain_params()));
+	int total = 0;
+	int cx = 0;
+	BENCHMARK_LOOP {
+		for(int z = 0; z != cube::chunk_size; ++z) {
+			for(int x = 0; x != cube::chunk_size; ++x) {
+				total += gen.surface_height(cx * cube::chunk_size + x, z);
+			}
+		}
+		++cx;
+	}
+	benchmark_sink = total;
+}
+
+BENCHMARK(cube_terrain_heights)
+{
+	cube::terrain_generator gen((cube::terrain_params()));
+	int heights[cube::chunk_area];
+	int total = 0;
+	int cx = 0;
+	BENCHMARK_LOOP {
+		gen.chunk_heights(cx++, 0, heights);
+		total += heights[0];
+	}
+	benchmark_sink = total;
+}
+
+// Every chunk in a column from bedrock to sky, as streaming would ask for
+// them.
+BENCHMARK(cube_generate_chunks)
+{
+	cube::terrain_generator gen((cube::terrain_params()));
+	int cx = 0;
+	BENCHMARK_LOOP {
+		for(int cy = 0; cy != 4; ++cy) {
+			gen.load_chunk(cx, cy, 0);
+		}
+		++cx;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hpp"
+#include "node.hpp"
+
+namespace cube
+{
+	// Shape of the generated terrain. The surface height of each column is
+	// base_height plus amplitude times a sum of octaves of gradient noise,
+	// each at lacunarity times the frequency and persistence times the
+	// weight of the one before.
+	struct terrain_params
+	{
+		terrain_params();
+		// Any keys missing from n keep their default, see the "terrain"
+		// section of data/world.cfg.
+		explicit terrain_params(const node::node& n);
+
+		uint32_t seed;
+		// Of the first octave, in cycles per block.
+		float frequency;
+		int octaves;
+		float persistence;
+		float lacunarity;
+		int base_height;
+		int amplitude;
+		// The top surface_depth blocks of each column are surface_block, the
+		// rest block.
+		block_id block;
+		block_id surface_block;
+		int surface_depth;
+	};
+
+	// 2D gradient noise in the range [-1, 1] at x, z, a different field for
+	// each seed.
+	float gradient_noise(float x, float z, uint32_t seed);
+
+	// Generates chunks on demand from a seed, so the world is unbounded and
+	// nothing is stored until it's edited. The same seed and parameters
+	// always give the same chunks. Noise is evaluated four columns at a time
+	// with SSE2 where available.
+	class terrain_generator : public chunk_source
+	{
+	public:
+		explicit terrain_generator(const terrain_params& p);
+		virtual ~terrain_generator();
+
+		const terrain_params& params() const { return params_; }
+
+		// Surface height of the column at x, z, one above its top block.
+		int surface_height(int x, int z) const;
+		// Fills heights[z * chunk_size + x] with the surface heights of the
+		// columns of chunk column cx, cz.
+		void chunk_heights(int cx, int cz, int* heights) const;
+
+		virtual chunk_ptr load_chunk(int cx, int cy, int cz);
+		// The world is unbounded, so there are no keys to list.
+		virtual void chunk_keys(std::vector<uint64_t>& keys);
+		virtual bool concurrent_loads() const { return true; }
+	private:
+		terrain_params params_;
+		// Sum of the octave weights, which the noise sum is divided by.
+		float weight_sum_;
+
+		terrain_generator();
+		terrain_generator(const terrain_generator&);
+	};
+	typedef boost::shared_ptr<terrain_generator> terrain_generator_ptr;
+}
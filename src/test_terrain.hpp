@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace test
+{
+	// Rolling terrain for benchmarks: width x width columns of block 1 from
+	// the origin, base + amplitude * sin(x * fx) * cos(z * fz) blocks high.
+	inline void build_rolling_terrain(cube::chunk_map& cm, int width, int base, int amplitude, double fx, double fz)
+	{
+		std::vector<uint8_t> heights(width * width);
+		for(int z = 0; z != width; ++z) {
+			for(int x = 0; x != width; ++x) {
+				heights[z * width + x] = uint8_t(base + amplitude * std::sin(x * fx) * std::cos(z * fz));
+			}
+		}
+		cm.build_from_heightmap(heights, width, width, 1);
+	}
+}
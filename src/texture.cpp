@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <cmath>
 #include <map>
 
 #include "asserts.hpp"
+#include "gl_state.hpp"
 #include "profile_timer.hpp"
 #include "texture.hpp"
 
@@ -30,6 +33,13 @@ namespace graphics
 	{
 	}
 
+	texture::~texture()
+	{
+		if(tex_id_ != 0) {
+			state::delete_textures(1, &tex_id_);
+		}
+	}
+
 	void texture::load_file_into_texture(const std::string& fname, texture* tex)
 	{
 		SDL_Surface* source = IMG_Load(fname.c_str());
@@ -68,7 +78,7 @@ namespace graphics
 		}
 
 		glGenTextures(1, &tex->tex_id_);
-		glBindTexture(GL_TEXTURE_2D, tex->tex_id_);
+		state::bind_texture(0, tex->tex_id_);
 		glTexImage2D(GL_TEXTURE_2D,
 			0,
 			GL_RGBA,
@@ -98,7 +108,7 @@ namespace graphics
 	}
 
 	texture::texture(surface_ptr s, unsigned tf)
-		: flags_(tf)
+		: tex_id_(0), flags_(tf)
 	{
 		texture_from_surface(s->get(), this);
 	}
@@ -132,10 +142,88 @@ namespace graphics
 		return new texture(s, tf);
 	}
 
+	namespace
+	{
+		struct taller_image
+		{
+			explicit taller_image(const std::vector<SDL_Surface*>& images) : images_(images)
+			{}
+			bool operator()(size_t a, size_t b) const
+			{
+				return images_[a]->h > images_[b]->h;
+			}
+			const std::vector<SDL_Surface*>& images_;
+		};
+	}
+
+	const_texture_ptr texture::get_atlas(const std::vector<std::string>& fnames, std::vector<rect>& areas)
+	{
+		ASSERT_LOG(!fnames.empty(), "texture::get_atlas() was given no images.");
+		std::vector<SDL_Surface*> images;
+		int total_area = 0;
+		int widest = 0;
+		for(auto it = fnames.begin(); it != fnames.end(); ++it) {
+			SDL_Surface* image = IMG_Load(it->c_str());
+			ASSERT_LOG(image != NULL, "Failed to load image: " << *it << " : " << IMG_GetError());
+			images.push_back(image);
+			total_area += image->w * image->h;
+			widest = std::max(widest, image->w);
+		}
+
+		// Shelves about as wide as the atlas is tall, tallest images first so
+		// each shelf wastes little above its shorter images.
+		std::vector<size_t> order(images.size());
+		for(size_t n = 0; n != order.size(); ++n) {
+			order[n] = n;
+		}
+		std::stable_sort(order.begin(), order.end(), taller_image(images));
+		const int width = power_of_two(std::max(widest, int(std::ceil(std::sqrt(double(total_area))))));
+		std::vector<SDL_Rect> placed(images.size());
+		int x = 0, y = 0, shelf = 0;
+		for(auto it = order.begin(); it != order.end(); ++it) {
+			SDL_Surface* image = images[*it];
+			if(x + image->w > width) {
+				x = 0;
+				y += shelf;
+				shelf = 0;
+			}
+			SDL_Rect& r = placed[*it];
+			r.x = x;
+			r.y = y;
+			r.w = image->w;
+			r.h = image->h;
+			x += image->w;
+			shelf = std::max(shelf, image->h);
+		}
+		const int height = power_of_two(y + shelf);
+
+		SDL_Surface* atlas = SDL_CreateRGBSurface(0, width, height, 32, SURFACE_MASK);
+		ASSERT_LOG(atlas != NULL, "Couldn't create a surface for a texture atlas.");
+		areas.clear();
+		for(size_t n = 0; n != images.size(); ++n) {
+			SDL_SetSurfaceBlendMode(images[n], SDL_BLENDMODE_NONE);
+			SDL_BlitSurface(images[n], NULL, atlas, &placed[n]);
+			SDL_FreeSurface(images[n]);
+			areas.push_back(rect(GLfloat(placed[n].x) / width, GLfloat(placed[n].y) / height,
+				GLfloat(placed[n].w) / width, GLfloat(placed[n].h) / height));
+		}
+
+		texture_ptr tex(new texture());
+		tex->flags_ = 0;
+		texture_from_surface(atlas, tex.get());
+		SDL_FreeSurface(atlas);
+		return tex;
+	}
+
 	void texture::rebuild_cache()
 	{
 		for(auto it = texture_cache().begin(); it != texture_cache().end(); ++it) {
 			load_file_into_texture(it->first, it->second.get());
 		}
 	}
+
+	void texture::clear_cache()
+	{
+		texture_cache().clear();
+	}
 }
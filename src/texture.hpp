@@ -1,5 +1,8 @@
 #pragma once
 
+#include <vector>
+
+#include "geometry.hpp"
 #include "graphics.hpp"
 #include "ref_counted_ptr.hpp"
 #include "surface.hpp"
@@ -19,7 +22,11 @@ namespace graphics
 			GENERATE_MIPMAP			= 2,
 			NO_CACHE				= 4,
 		};
+		virtual ~texture();
+
 		GLuint id() const { return tex_id_; }
+		// File the texture was loaded from, empty for other textures.
+		const std::string& name() const { return name_; }
 
 		GLfloat tc_x(GLfloat x) const;
 		GLfloat tc_y(GLfloat y) const;
@@ -29,7 +36,15 @@ namespace graphics
 
 		static const_texture_ptr get(const std::string& fname, unsigned tf=SCALE_IMAGE_TO_TEXTURE|GENERATE_MIPMAP);
 		static const_texture_ptr get(surface_ptr, unsigned tf=SCALE_IMAGE_TO_TEXTURE);
+		// One texture holding every image, packed in rows at their own size,
+		// with areas filled with the texture coordinates of each. Atlases
+		// aren't cached and have no mipmaps, which would blend neighbouring
+		// images together.
+		static const_texture_ptr get_atlas(const std::vector<std::string>& fnames, std::vector<rect>& areas);
 		static void rebuild_cache();
+		// Textures still referenced elsewhere are kept. Should be called
+		// while the GL context is still around.
+		static void clear_cache();
 	protected:
 		texture();
 		explicit texture(const std::string& fname, unsigned tf);
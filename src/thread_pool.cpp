@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "asserts.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
+
+namespace threading
+{
+	pool::pool(int num_threads)
+		: active_(0), shutdown_(false), num_threads_(num_threads)
+	{
+		if(num_threads_ <= 0) {
+			num_threads_ = std::max(1, int(boost::thread::hardware_concurrency()) - 1);
+		}
+		for(int n = 0; n != num_threads_; ++n) {
+			threads_.create_thread(boost::bind(&pool::worker, this));
+		}
+	}
+
+	pool::~pool()
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			shutdown_ = true;
+		}
+		work_available_.notify_all();
+		threads_.join_all();
+	}
+
+	void pool::add_job(const job& j)
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			ASSERT_LOG(!shutdown_, "threading::pool::add_job() called during shutdown.");
+			jobs_.push_back(j);
+		}
+		work_available_.notify_one();
+	}
+
+	void pool::wait()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		while(!jobs_.empty() || active_ != 0) {
+			work_done_.wait(lock);
+		}
+	}
+
+	size_t pool::pending() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		return jobs_.size() + active_;
+	}
+
+	void pool::worker()
+	{
+		for(;;) {
+			job j;
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				while(jobs_.empty() && !shutdown_) {
+					work_available_.wait(lock);
+				}
+				if(jobs_.empty()) {
+					return;
+				}
+				j = jobs_.front();
+				jobs_.pop_front();
+				++active_;
+			}
+
+			j();
+
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				--active_;
+			}
+			work_done_.notify_all();
+		}
+	}
+
+	pool& get_pool()
+	{
+		static pool res;
+		return res;
+	}
+}
+
+namespace
+{
+	void add_to_total(boost::mutex& m, int& total, int n)
+	{
+		boost::mutex::scoped_lock lock(m);
+		total += n;
+	}
+}
+
+UNIT_TEST(thread_pool)
+{
+	boost::mutex m;
+	int total = 0;
+	threading::pool p(4);
+	for(int n = 1; n <= 100; ++n) {
+		p.add_job(boost::bind(add_to_total, boost::ref(m), boost::ref(total), n));
+	}
+	p.wait();
+	CHECK_EQ(p.pending(), 0);
+	CHECK_EQ(total, 5050);
+}
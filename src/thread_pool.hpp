@@ -0,0 +1,43 @@
+#pragma once
+
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace threading
+{
+	// Fixed size set of worker threads servicing a FIFO queue of jobs.
+	class pool
+	{
+	public:
+		typedef boost::function<void ()> job;
+
+		// num_threads of 0 uses one less than the number of hardware threads,
+		// leaving a core free for the thread doing the rendering.
+		explicit pool(int num_threads=0);
+		virtual ~pool();
+
+		void add_job(const job& j);
+		// Blocks until the queue is empty and no job is running.
+		void wait();
+
+		size_t pending() const;
+		int num_threads() const { return num_threads_; }
+	private:
+		void worker();
+
+		mutable boost::mutex mutex_;
+		boost::condition_variable work_available_;
+		boost::condition_variable work_done_;
+		std::deque<job> jobs_;
+		int active_;
+		bool shutdown_;
+		int num_threads_;
+		boost::thread_group threads_;
+
+		pool(const pool&);
+	};
+
+	// Process wide pool, created on first use.
+	pool& get_pool();
+}
@@ -8,6 +8,8 @@
 
 namespace test {
 
+	volatile size_t benchmark_sink;
+
 	namespace 
 	{
 		typedef std::map<std::string, unit_test> test_map;
@@ -16,6 +18,16 @@ namespace test {
 			static test_map map;
 			return map;
 		}
+
+		typedef std::map<std::string, benchmark_test> benchmark_map;
+		benchmark_map& get_benchmark_map()
+		{
+			static benchmark_map map;
+			return map;
+		}
+
+		// Minimum run time before a benchmark result is reported.
+		const int64_t min_benchmark_time_us = 1000000;
 	}
 
 	int register_test(const std::string& name, unit_test test)
@@ -24,6 +36,12 @@ namespace test {
 		return 0;
 	}
 
+	int register_benchmark(const std::string& name, benchmark_test test)
+	{
+		get_benchmark_map()[name] = test;
+		return 0;
+	}
+
 	bool run_tests(const std::vector<std::string>* tests)
 	{
 		boost::posix_time::ptime mst1 = boost::posix_time::microsec_clock::local_time();
@@ -59,4 +77,36 @@ namespace test {
 			return true;
 		}
 	}
+
+	void run_benchmarks(const std::vector<std::string>* benchmarks)
+	{
+		std::vector<std::string> all_benchmarks;
+		if(!benchmarks) {
+			for(benchmark_map::const_iterator i = get_benchmark_map().begin(); i != get_benchmark_map().end(); ++i) {
+				all_benchmarks.push_back(i->first);
+			}
+
+			benchmarks = &all_benchmarks;
+		}
+
+		BOOST_FOREACH(const std::string& benchmark, *benchmarks) {
+			auto it = get_benchmark_map().find(benchmark);
+			if(it == get_benchmark_map().end()) {
+				std::cerr << "BENCHMARK " << benchmark << " NOT FOUND\n";
+				continue;
+			}
+
+			for(int iterations = 1; ; iterations *= 10) {
+				boost::posix_time::ptime mst1 = boost::posix_time::microsec_clock::local_time();
+				it->second(iterations);
+				boost::posix_time::ptime mst2 = boost::posix_time::microsec_clock::local_time();
+				const int64_t us = (mst2 - mst1).total_microseconds();
+				if(us >= min_benchmark_time_us || iterations >= 100000000) {
+					std::cerr << "BENCH " << benchmark << ": " << iterations << " iterations, "
+						<< double(us)/iterations << "us/iteration\n";
+					break;
+				}
+			}
+		}
+	}
 }
@@ -2,6 +2,7 @@
 
 #include <boost/function.hpp>
 
+#include <cstddef>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -13,10 +14,13 @@ namespace test {
 	};
 
 	typedef boost::function<void ()> unit_test;
+	typedef boost::function<void (int)> benchmark_test;
 
 	int register_test(const std::string& name, unit_test test);
+	int register_benchmark(const std::string& name, benchmark_test test);
 	
 	bool run_tests(const std::vector<std::string>* tests=NULL);
+	void run_benchmarks(const std::vector<std::string>* benchmarks=NULL);
 }
 
 #define CHECK(cond, msg) if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": TEST CHECK FAILED: " << #cond << ": " << msg << "\n"; throw test::failure_exception(); }
@@ -36,3 +40,20 @@ namespace test {
 	static int TEST_VAR_##name = test::register_test(#name, TEST_##name); \
     }                   \
 	void test::TEST_##name()
+
+// Benchmarks are run with an increasing number of iterations until the
+// run takes long enough to give a stable time per iteration.
+#define BENCHMARK(name) \
+	namespace test {    \
+	void BENCHMARK_##name(int benchmark_iterations); \
+	static int BENCHMARK_VAR_##name = test::register_benchmark(#name, BENCHMARK_##name); \
+	}                   \
+	void test::BENCHMARK_##name(int benchmark_iterations)
+
+#define BENCHMARK_LOOP while(benchmark_iterations-- > 0)
+
+namespace test {
+	// Benchmarks store a result here so the work they time isn't optimised
+	// away.
+	extern volatile size_t benchmark_sink;
+}
@@ -3,6 +3,7 @@
 #include <vector>
 #include "graphics.hpp"
 #include "profile_timer.hpp"
+#include "texture.hpp"
 #include "wm.hpp"
 
 namespace graphics
@@ -78,6 +79,9 @@ namespace graphics
 
 	window_manager::~window_manager()
 	{
+		// Cached textures would otherwise be deleted during static
+		// destruction, once there's no context left to delete them from.
+		texture::clear_cache();
 		SDL_GL_DeleteContext(glcontext_);
 		SDL_DestroyWindow(window_);
 	}